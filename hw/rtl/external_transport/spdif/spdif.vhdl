@@ -168,8 +168,10 @@ package spdif is
         port (
             i_clk    : in   std_logic;
             i_active : in   std_logic;
+            i_rate   : in   PcmRate_t;
             reader   : view PeriodFifo_Reader_t;
             o_spdif  : out  std_logic;
+            o_period : out  std_logic;
         );
     end component;
 
@@ -192,6 +194,7 @@ package spdif is
             playback_reader : view PeriodFifo_Reader_t;
             capture_writer  : view PeriodFifo_Writer_t;
             phy             : view SpdifPhy_t;
+            o_period        : out  std_logic;
         );
     end component;
 
@@ -1,6 +1,9 @@
 library ieee;
     use ieee.std_logic_1164.all;
 
+library unisim;
+    use unisim.vcomponents.all;
+
 library sw_transport;
     use sw_transport.ethernet.all;
 
@@ -17,19 +20,27 @@ entity spdif_trx is
         playback_reader : view PeriodFifo_Reader_t;
         capture_writer  : view PeriodFifo_Writer_t;
         phy             : view SpdifPhy_t;
+        o_period        : out  std_logic;
     );
 end spdif_trx;
 
 architecture behavioral of spdif_trx is
 
     -- TX clk generation
+    --
+    -- Note: one clk for each family of sample rates, spdif_tx divides down the
+    -- selected one to the rate requested by the host
     component ip_clk_wizard_spdif
         port (
-            i_spdif_clk : in  std_logic;
-            o_spdif_clk : out std_logic;
+            i_spdif_clk      : in  std_logic;
+            o_spdif_clk_48k  : out std_logic;
+            o_spdif_clk_44k1 : out std_logic;
         );
     end component;
-    signal spdif_tx_clk : std_logic := '0';
+    signal spdif_clk_48k  : std_logic := '0';
+    signal spdif_clk_44k1 : std_logic := '0';
+    signal spdif_clk_sel  : std_logic := '0';
+    signal spdif_tx_clk   : std_logic := '0';
 
     -- Intermediate signals
     signal phy_rx : std_logic := '0';
@@ -55,8 +66,25 @@ begin
     -- Generate SPDIF tx clk
     generate_spdif_tx_clk : ip_clk_wizard_spdif
         port map (
-            i_spdif_clk => i_clk,
-            o_spdif_clk => spdif_tx_clk
+            i_spdif_clk      => i_clk,
+            o_spdif_clk_48k  => spdif_clk_48k,
+            o_spdif_clk_44k1 => spdif_clk_44k1
+        );
+
+    -- Switch between families without glitching
+    --
+    -- Note: i_streams comes from the ethernet clk domain, but the rate only
+    -- changes while streams are being (re)started
+    with i_streams.rate select spdif_clk_sel <=
+        '1' when PcmRate_44100 | PcmRate_88200 | PcmRate_176400,
+        '0' when others;
+
+    select_spdif_tx_clk : BUFGMUX_CTRL
+        port map (
+            I0 => spdif_clk_48k,
+            I1 => spdif_clk_44k1,
+            S  => spdif_clk_sel,
+            O  => spdif_tx_clk
         );
 
     -- S/PDIF transmitter
@@ -64,8 +92,10 @@ begin
         port map (
             i_clk    => spdif_tx_clk,
             i_active => i_streams.playback.active,
+            i_rate   => i_streams.rate,
             reader   => reader,
-            o_spdif  => phy_tx
+            o_spdif  => phy_tx,
+            o_period => o_period
         );
 
     -- S/PDIF receiver
@@ -4,6 +4,7 @@ library ieee;
 
 library util;
     use util.audio.all;
+    use util.signals.all;
 
 library work;
     use work.spdif.all;
@@ -12,15 +13,18 @@ entity spdif_tx is
     port (
         i_clk    : in   std_logic;
         i_active : in   std_logic;
+        i_rate   : in   PcmRate_t;
         reader   : view PeriodFifo_Reader_t;
         o_spdif  : out  std_logic;
+        o_period : out  std_logic;
     );
 end spdif_tx;
 
 architecture behavioral of spdif_tx is
 
     -- Clock conversion
-    signal tx_clk : std_logic := '0';
+    signal tx_clk_half_period : positive  := 4;
+    signal tx_clk             : std_logic := '0';
 
     -- Timing state
     signal frame    : natural   := 0;
@@ -35,6 +39,12 @@ architecture behavioral of spdif_tx is
     signal period_end : natural  := 0;
     signal sample     : Sample_t := Sample_t_INIT;
 
+    -- Toggles each time a period boundary is played out while active
+    --
+    -- Note: a toggle (rather than a pulse) is used because consumers live in
+    -- a different clock domain
+    signal period_toggle : std_logic := '0';
+
     -- Mocked period
     constant multiplier  : natural  := 2097151 / PERIOD_SIZE;
     signal   mock_period : Period_t := Period_t_INIT;
@@ -60,13 +70,22 @@ architecture behavioral of spdif_tx is
 
 begin
 
-    -- Convert 12.288MHz clk -> 6.144MHz clk
-    generate_tx_clk : process(i_clk)
-    begin
-        if rising_edge(i_clk) then
-            tx_clk <= not tx_clk;
-        end if;
-    end process;
+    -- Convert 1024x sample rate clk -> 128x sample rate clk (2 timeslots for
+    -- each of the 64 bits in a frame)
+    --
+    -- Note: i_clk runs at 1024x the base rate of the family i_rate belongs to
+    -- (48kHz or 44.1kHz), the double & quadruple rates divide it less
+    with i_rate select tx_clk_half_period <=
+        2 when PcmRate_88200 | PcmRate_96000,
+        1 when PcmRate_176400 | PcmRate_192000,
+        4 when others;
+
+    generate_tx_clk : clk_generator
+        port map (
+            i_clk         => i_clk,
+            i_half_period => tx_clk_half_period,
+            o_clk         => tx_clk
+        );
 
     -- Timing handling
     maintain_timing_state_proc : process(tx_clk)
@@ -124,6 +143,11 @@ begin
 
                     --period <= mock_period;
 
+                    -- Report period boundary so host can track our clock
+                    if i_active = '1' then
+                        period_toggle <= not period_toggle;
+                    end if;
+
                     pos <= 0;
                     period_end <= (frame + PERIOD_SIZE) mod 192;
                 end if;
@@ -132,6 +156,7 @@ begin
     end process;
     reader.clk <= tx_clk;
     period_in <= reader.data;
+    o_period <= period_toggle;
     sample <= period(to_integer(unsigned'("" & subframe)))(pos);
     assign_aux : for i in 0 to 3 generate
         tx_subframe.aux(i) <= sample(23 - i);
@@ -293,7 +318,13 @@ begin
     channel_bits(20 to 23) <= "1000"
                               when subframe = '0' else
                               "0100";    -- Channel number
-    channel_bits(24 to 27) <= "0100";    -- Sampling frequency = 48khz
+    with i_rate select channel_bits(24 to 27) <=
+        "0000" when PcmRate_44100,
+        "0001" when PcmRate_88200,
+        "0101" when PcmRate_96000,
+        "0011" when PcmRate_176400,
+        "0111" when PcmRate_192000,
+        "0100" when others;      -- Sampling frequency
     channel_bits(32 to 35) <= "1101";    -- Word length = 24 bit, full word
 
 end behavioral;
@@ -35,6 +35,18 @@ package ethernet is
         0 to (LENGTH_SIZE * BITS_PER_BYTE) - 1
     );
 
+    -- EtherType of cco frames (IEEE 802 local experimental EtherType 1)
+    --
+    -- Note: unlike an 802.3 length, an EtherType says nothing about how much
+    -- of the payload is padding, so cco frames sent with this EtherType carry
+    -- a length of their own ahead of the payload, i.e.
+    --
+    --   [dest MAC][src MAC][ETHERTYPE_CCO][length][payload][padding][FCS]
+    --
+    -- Frames with an 802.3 length in place of the EtherType are still
+    -- accepted, for hosts that predate ETHERTYPE_CCO
+    constant ETHERTYPE_CCO : Length_t := X"88B5";
+
     -- Frame Check Sequence (FCS)
     constant FCS_SIZE       : natural := 4;
     constant FCS_LAST_DIBIT : natural := (FCS_SIZE * DIBITS_PER_BYTE) - 1;
@@ -64,6 +76,7 @@ package ethernet is
     type FrameSection_t is (
         DESTINATION_MAC,
         SOURCE_MAC,
+        ETHERTYPE,
         LENGTH,
         PAYLOAD,
         PADDING,
@@ -72,16 +85,29 @@ package ethernet is
     type Frame_t is record
         dest_mac : MacAddress_t;
         src_mac  : MacAddress_t;
+        typed    : std_logic; -- ETHERTYPE_CCO precedes length
         length   : Length_t;
         payload  : Payload_t;
     end record;
     constant Frame_t_INIT : Frame_t := (
         dest_mac => (others => '0'),
         src_mac  => (others => '0'),
+        typed    => '0',
         length   => (others => '0'),
         payload  => (others => '0')
     );
 
+    -- Returns frame with its framing set to typed
+    function set_frame_typed(
+        frame : Frame_t;
+        typed : std_logic;
+    ) return Frame_t;
+
+    -- Returns the size below which frame's payload is followed by padding
+    function get_min_payload_size(
+        frame : Frame_t;
+    ) return natural;
+
     function get_dibit_pos(
         offset  : natural;
         section : FrameSection_t;
@@ -122,6 +148,7 @@ package ethernet is
             phy             : view EthernetPhy_t;
             playback_writer : view PeriodFifo_Writer_t;
             capture_reader  : view PeriodFifo_Reader_t;
+            i_period        : in   std_logic;
             o_streams       : out  Streams_t;
         );
     end component;
@@ -179,4 +206,27 @@ package body ethernet is
         end if;
     end function;
 
+    function set_frame_typed(
+        frame : Frame_t;
+        typed : std_logic;
+    ) return Frame_t is
+        variable result : Frame_t := frame;
+    begin
+        result.typed := typed;
+        return result;
+    end function;
+
+    function get_min_payload_size(
+        frame : Frame_t;
+    ) return natural is
+    begin
+        -- The length that follows ETHERTYPE_CCO counts towards the minimum
+        -- frame size
+        if frame.typed = '1' then
+            return MIN_PAYLOAD_SIZE - LENGTH_SIZE;
+        else
+            return MIN_PAYLOAD_SIZE;
+        end if;
+    end function;
+
 end package body ethernet;
@@ -116,7 +116,8 @@ begin
 
     -- Place dibits streamed from PHY into their correct place in a Frame_t
     place_dibits : process(i_ref_clk)
-        variable pos : natural := 0;
+        variable pos    : natural  := 0;
+        variable length : Length_t := (others => '0');
     begin
         if rising_edge(i_ref_clk) then
             case place_state is
@@ -172,11 +173,21 @@ begin
                         end if;
 
                     when LENGTH =>
-                        frame.length(pos to pos + 1) <= unsigned(dibit_data);
+                        length := frame.length;
+                        length(pos to pos + 1) := unsigned(dibit_data);
+                        frame.length <= length;
 
-                        -- Wait for final length dibit, then transit
+                        -- Wait for final length dibit
                         if offset < LENGTH_LAST_DIBIT then
                             offset <= offset + 1;
+
+                        -- If what we received was ETHERTYPE_CCO rather than
+                        -- a length, expect the length to follow
+                        elsif frame.typed = '0' and length = ETHERTYPE_CCO then
+                            frame.typed <= '1';
+                            offset <= 0;
+
+                        -- Otherwise, transit
                         else
                             offset <= 0;
                             section <= PAYLOAD;
@@ -198,7 +209,8 @@ begin
                             -- Otherwise, if payload is smaller than what would
                             -- be needed to meet minimum frame size, expect
                             -- padding to follow
-                            elsif offset < MIN_PAYLOAD_SIZE * DIBITS_PER_BYTE
+                            elsif offset <
+                                  get_min_payload_size(frame) * DIBITS_PER_BYTE
                             then
                                 offset <= 0;
                                 section <= PADDING;
@@ -215,7 +227,8 @@ begin
                         --
                         -- Wait for final padding dibit, then transit
                         if offset + 1 <
-                           (MIN_PAYLOAD_SIZE - frame.length) * DIBITS_PER_BYTE
+                           (get_min_payload_size(frame) - frame.length)
+                           * DIBITS_PER_BYTE
                         then
                             offset <= offset + 1;
                         else
@@ -16,6 +16,7 @@ entity ethernet_trx is
         phy             : view EthernetPhy_t;
         playback_writer : view PeriodFifo_Writer_t;
         capture_reader  : view PeriodFifo_Reader_t;
+        i_period        : in   std_logic;
         o_streams       : out  Streams_t;
     );
 end ethernet_trx;
@@ -32,7 +33,8 @@ architecture behavioral of ethernet_trx is
         SESSION_OPEN,
         SEND_HEARTBEAT,
         SEND_CLOSE,
-        SEND_PCM_DATA
+        SEND_PCM_DATA,
+        SEND_PCM_CTL
     );
     signal session_state    : SessionState_t    := WAIT_FOR_HANDSHAKE_REQUEST;
     signal prev_rx_valid    : std_logic         := '0';
@@ -45,6 +47,51 @@ architecture behavioral of ethernet_trx is
     signal capture_period   : Period_t          := Period_t_INIT;
     signal streams          : Streams_t         := Streams_t_INIT;
 
+    -- PCM data format negotiated during the handshake
+    --
+    -- Note: hosts are sent a handshake response of the same form as the
+    -- handshake request they sent, see protocol.vhdl
+    signal pcm_format       : PcmFormat_t := PcmFormat_S24Padded;
+    signal handshake_length : Length_t    := to_unsigned(0, 16);
+
+    -- Framing of the host, see ETHERTYPE_CCO
+    --
+    -- Note: until a host has sent its handshake request, announce messages
+    -- alternate between framings so that hosts using either can find us
+    signal frame_typed : std_logic := '1';
+
+    -- Length of the last PCM control msg from the host, so that ours carry the
+    -- rate only to hosts that select one
+    signal pcm_ctl_length : Length_t := to_unsigned(0, 16);
+
+    -- Period acknowledgement state
+    --
+    -- Note: i_period toggles in the S/PDIF clock domain, so it passes through
+    -- a synchronizer before edges are detected
+    signal period_sync     : std_logic_vector(0 to 2) := (others => '0');
+    signal playback_seqnum : Seqnum_t                 := to_unsigned(0, 32);
+    signal ack_pending     : std_logic                := '0';
+
+    -- Playback loss concealment
+    --
+    -- Note: when the seqnum of a PCM data msg skips ahead, the last period
+    -- received is written again once for each period skipped (up to
+    -- MAX_CONCEALED_PERIODS), then the new one.  Seqnums that jump further
+    -- than MAX_SEQNUM_GAP either way are taken as the host restarting its
+    -- count, and PCM data msgs that arrive after their successor are dropped.
+    constant MAX_CONCEALED_PERIODS : natural := 4;
+    constant MAX_SEQNUM_GAP        : natural := 64;
+    signal playback_next_seqnum : Seqnum_t      := to_unsigned(0, 32);
+    signal playback_synced      : std_logic     := '0';
+    signal playback_lost        : LostPeriods_t := to_unsigned(0, 32);
+    signal pending_period       : Period_t      := Period_t_INIT;
+    signal conceal_count        : natural range 0 to MAX_CONCEALED_PERIODS + 1
+                                := 0;
+
+    -- Length of the last heartbeat from the host, so that ours carry
+    -- playback_lost only to hosts that send their own count
+    signal heartbeat_length : Length_t := to_unsigned(0, 16);
+
     -- 50MHz reference clk that drives ethernet PHY
     component ip_clk_wizard_ethernet is
         port (
@@ -63,6 +110,7 @@ architecture behavioral of ethernet_trx is
     signal phy_tx   : EthernetTxPhy_t;
     signal tx_frame : Frame_t   := Frame_t_INIT;
     signal tx_valid : std_logic := '0';
+    signal tx_typed : Frame_t   := Frame_t_INIT;
 
 begin
 
@@ -73,15 +121,34 @@ begin
     phy.tx.enable <= phy_tx.enable;
 
     session_sm : process(ref_clk)
-        variable pcm_ctl_msg  : PcmCtlMsg_t;
-        variable pcm_data_msg : PcmDataMsg_t;
+        variable session_caps_msg    : SessionCtlCapsMsg_t;
+        variable pcm_ctl_msg         : PcmCtlMsg_t;
+        variable pcm_data_msg        : PcmDataMsg_t;
+        variable packed_pcm_data_msg : PackedPcmDataMsg_t;
+        variable playback_restart    : boolean;
+        variable data_received       : boolean;
+        variable data_seqnum         : Seqnum_t;
+        variable data_period         : Period_t;
+        variable seqnum_gap          : Seqnum_t;
     begin
         if rising_edge(ref_clk) then
+            playback_restart := false;
+            data_received := false;
 
             -- Will be overwritten when a PCM data msg is received
             playback_writer.enable <= '0';
             capture_reader.enable <= '0';
 
+            -- Replay the last period in place of a lost one, then write the
+            -- period that followed the loss
+            if conceal_count > 0 then
+                if conceal_count = 1 then
+                    playback_period <= pending_period;
+                end if;
+                playback_writer.enable <= '1';
+                conceal_count <= conceal_count - 1;
+            end if;
+
             case session_state is
             when WAIT_FOR_HANDSHAKE_REQUEST =>
                 -- If we've received a handshake request, transit
@@ -89,6 +156,25 @@ begin
                    is_valid_handshake_request(rx_frame)
                 then
                     host_mac_address <= rx_frame.src_mac;
+                    frame_typed <= rx_frame.typed;
+
+                    -- Adopt the PCM data format selected by the host
+                    session_caps_msg := get_session_ctl_caps_msg(rx_frame);
+                    handshake_length <= rx_frame.length;
+                    if session_caps_msg.pcm_formats = PcmFormat_S24Packed then
+                        pcm_format <= PcmFormat_S24Packed;
+                    else
+                        pcm_format <= PcmFormat_S24Padded;
+                    end if;
+
+                    pcm_ctl_length <= to_unsigned(
+                        Msg_t'size + PcmCtlMsg_t'size, 16
+                    );
+                    heartbeat_length <= to_unsigned(
+                        Msg_t'size + SessionCtlMsg_t'size, 16
+                    );
+                    playback_synced <= '0';
+                    playback_lost <= to_unsigned(0, 32);
 
                     counter <= 0;
                     session_state <= SEND_HANDSHAKE_RESPONSE;
@@ -104,13 +190,18 @@ begin
             when SEND_ANNOUNCE =>
                 if counter = 0 then
                     tx_valid <= '0';
+                    frame_typed <= not frame_typed;
                     counter <= 1;
                 else
-                    tx_frame <= build_session_ctl_msg(
+                    tx_frame <= build_session_ctl_rates_msg(
                         dest_mac      => host_mac_address,
                         src_mac       => MAC_ADDRESS_CCO,
                         generation_id => generation_id,
-                        msg_type      => SessionCtl_Announce
+                        msg_type      => SessionCtl_Announce,
+                        pcm_formats   => PCM_FORMAT_CAPS,
+                        channels      => to_unsigned(NUM_CHANNELS, 8),
+                        period_frames => PERIOD_FRAMES_CAPS,
+                        rates         => PCM_RATE_CAPS
                     );
                     tx_valid <= '1';
 
@@ -123,12 +214,47 @@ begin
                     tx_valid <= '0';
                     counter <= 1;
                 else
-                    tx_frame <= build_session_ctl_msg(
-                        dest_mac      => host_mac_address,
-                        src_mac       => MAC_ADDRESS_CCO,
-                        generation_id => generation_id,
-                        msg_type      => SessionCtl_HandshakeResponse
-                    );
+                    if handshake_length =
+                       Msg_t'size + SessionCtlPeriodMsg_t'size
+                    then
+                        tx_frame <= build_session_ctl_period_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            msg_type      => SessionCtl_HandshakeResponse,
+                            pcm_formats   => pcm_format,
+                            channels      => to_unsigned(NUM_CHANNELS, 8),
+                            period_frames => PeriodFrames_Selected
+                        );
+                    elsif handshake_length =
+                          Msg_t'size + SessionCtlChannelsMsg_t'size
+                    then
+                        tx_frame <= build_session_ctl_channels_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            msg_type      => SessionCtl_HandshakeResponse,
+                            pcm_formats   => pcm_format,
+                            channels      => to_unsigned(NUM_CHANNELS, 8)
+                        );
+                    elsif handshake_length =
+                          Msg_t'size + SessionCtlCapsMsg_t'size
+                    then
+                        tx_frame <= build_session_ctl_caps_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            msg_type      => SessionCtl_HandshakeResponse,
+                            pcm_formats   => pcm_format
+                        );
+                    else
+                        tx_frame <= build_session_ctl_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            msg_type      => SessionCtl_HandshakeResponse
+                        );
+                    end if;
                     tx_valid <= '1';
 
                     counter <= 0;
@@ -145,6 +271,14 @@ begin
                     session_state <= SEND_HEARTBEAT;
                 end if;
 
+                -- If S/PDIF played out a period, acknowledge it to the host
+                --
+                -- Note: capture data takes priority, the ack stays pending
+                if ack_pending = '1' then
+                    session_state <= SEND_PCM_CTL;
+                    counter <= 0;
+                end if;
+
                 -- If we've received a period via capture, transmit it
                 if capture_reader.empty = '0' then
                     capture_period <= capture_reader.data;
@@ -163,11 +297,63 @@ begin
                     if is_valid_pcm_ctl_msg(rx_frame) then
                         pcm_ctl_msg := get_pcm_ctl_msg(rx_frame);
                         streams <= pcm_ctl_msg.streams;
+                        pcm_ctl_length <= rx_frame.length;
+
+                        -- Count played periods from host's starting seqnum
+                        if streams.playback.active = '0' and
+                           pcm_ctl_msg.streams.playback.active = '1'
+                        then
+                            playback_restart := true;
+                        end if;
 
                     elsif is_valid_pcm_data_msg(rx_frame) then
                         pcm_data_msg := get_pcm_data_msg(rx_frame);
-                        playback_period <= get_period(pcm_data_msg.period);
-                        playback_writer.enable <= '1';
+                        data_seqnum := pcm_data_msg.seqnum;
+                        data_period := get_period(pcm_data_msg.period);
+                        data_received := true;
+
+                    elsif is_valid_packed_pcm_data_msg(rx_frame) then
+                        packed_pcm_data_msg := get_packed_pcm_data_msg(rx_frame);
+                        data_seqnum := packed_pcm_data_msg.seqnum;
+                        data_period := packed_pcm_data_msg.period;
+                        data_received := true;
+
+                    elsif is_valid_session_ctl_msg(rx_frame) and
+                          get_session_ctl_msg(rx_frame).msg_type =
+                          SessionCtl_Heartbeat
+                    then
+                        heartbeat_length <= rx_frame.length;
+                    end if;
+
+                    -- Write the period, concealing any lost before it
+                    if data_received then
+                        seqnum_gap := data_seqnum - playback_next_seqnum;
+
+                        if playback_synced = '1' and seqnum_gap /= 0 and
+                           seqnum_gap <= MAX_SEQNUM_GAP
+                        then
+                            playback_lost <= playback_lost + seqnum_gap;
+                            pending_period <= data_period;
+                            if seqnum_gap > MAX_CONCEALED_PERIODS then
+                                conceal_count <= MAX_CONCEALED_PERIODS + 1;
+                            else
+                                conceal_count <= to_integer(seqnum_gap) + 1;
+                            end if;
+                            playback_next_seqnum <= data_seqnum + 1;
+
+                        elsif playback_synced = '1' and seqnum_gap /= 0 and
+                              playback_next_seqnum - data_seqnum <=
+                              MAX_SEQNUM_GAP
+                        then
+                            -- Too late, it has already been concealed
+                            null;
+
+                        else
+                            playback_period <= data_period;
+                            playback_writer.enable <= '1';
+                            playback_next_seqnum <= data_seqnum + 1;
+                            playback_synced <= '1';
+                        end if;
                     end if;
 
                 -- Otherwise, close session if we've exceeded heartbeat timeout
@@ -184,12 +370,24 @@ begin
                     tx_valid <= '0';
                     counter <= 1;
                 else
-                    tx_frame <= build_session_ctl_msg(
-                        dest_mac      => host_mac_address,
-                        src_mac       => MAC_ADDRESS_CCO,
-                        generation_id => generation_id,
-                        msg_type      => SessionCtl_Heartbeat
-                    );
+                    if heartbeat_length =
+                       Msg_t'size + SessionCtlLossMsg_t'size
+                    then
+                        tx_frame <= build_session_ctl_loss_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            msg_type      => SessionCtl_Heartbeat,
+                            lost_periods  => playback_lost
+                        );
+                    else
+                        tx_frame <= build_session_ctl_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            msg_type      => SessionCtl_Heartbeat
+                        );
+                    end if;
                     tx_valid <= '1';
 
                     counter <= 0;
@@ -226,21 +424,89 @@ begin
                     tx_valid <= '0';
                     counter <= 1;
                 else
-                    tx_frame <= build_pcm_data_msg(
-                        dest_mac      => host_mac_address,
-                        src_mac       => MAC_ADDRESS_CCO,
-                        generation_id => generation_id,
-                        seqnum        => pcm_data_seqnum,
-                        period        => capture_period
-                    );
+                    if pcm_format = PcmFormat_S24Packed then
+                        tx_frame <= build_packed_pcm_data_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            seqnum        => pcm_data_seqnum,
+                            period        => capture_period
+                        );
+                    else
+                        tx_frame <= build_pcm_data_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            seqnum        => pcm_data_seqnum,
+                            period        => capture_period
+                        );
+                    end if;
                     tx_valid <= '1';
 
                     pcm_data_seqnum <= pcm_data_seqnum + 1;
 
+                    counter <= 0;
+                    session_state <= SESSION_OPEN;
+                end if;
+
+            when SEND_PCM_CTL =>
+                if counter = 0 then
+                    tx_valid <= '0';
+                    counter <= 1;
+                else
+                    if pcm_ctl_length = Msg_t'size + PcmCtlRateMsg_t'size then
+                        tx_frame <= build_pcm_ctl_rate_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            pcm_ctl_msg   => (
+                                streams         => streams,
+                                playback_seqnum => playback_seqnum,
+                                capture_seqnum  => pcm_data_seqnum
+                            )
+                        );
+                    else
+                        tx_frame <= build_pcm_ctl_msg(
+                            dest_mac      => host_mac_address,
+                            src_mac       => MAC_ADDRESS_CCO,
+                            generation_id => generation_id,
+                            pcm_ctl_msg   => (
+                                streams         => streams,
+                                playback_seqnum => playback_seqnum,
+                                capture_seqnum  => pcm_data_seqnum
+                            )
+                        );
+                    end if;
+                    tx_valid <= '1';
+
+                    ack_pending <= '0';
+
                     counter <= 0;
                     session_state <= SESSION_OPEN;
                 end if;
             end case;
+
+            -- Track periods played out over S/PDIF
+            --
+            -- Note: done after the state machine so that a period boundary
+            -- arriving while an ack is being sent is not lost
+            period_sync <= period_sync(1 to 2) & i_period;
+            if playback_restart then
+                playback_seqnum <= pcm_ctl_msg.playback_seqnum;
+                ack_pending <= '0';
+                playback_synced <= '0';
+            elsif period_sync(0) /= period_sync(1) and
+                  (streams.playback.active = '1' or
+                   streams.capture.active = '1')
+            then
+                -- Capture is clocked by these acks too, so they are sent
+                -- while either stream is active
+                if streams.playback.active = '1' then
+                    playback_seqnum <= playback_seqnum + 1;
+                end if;
+                ack_pending <= '1';
+            end if;
+
             prev_rx_valid <= rx_valid;
         end if;
     end process;
@@ -266,11 +532,13 @@ begin
             o_valid   => rx_valid
         );
 
+    -- Ethernet sending, in the framing of the host
+    tx_typed <= set_frame_typed(tx_frame, frame_typed);
     ethernet_tx : work.ethernet.ethernet_tx
         port map (
             i_ref_clk => ref_clk,
             phy       => phy_tx,
-            i_frame   => tx_frame,
+            i_frame   => tx_typed,
             i_valid   => tx_valid
         );
 
@@ -99,6 +99,20 @@ begin
                     -- Wait for final src MAC dibit, then transit
                     if offset < MAC_LAST_DIBIT then
                         offset <= offset + 1;
+                    elsif frame.typed = '1' then
+                        offset <= 0;
+                        section <= ETHERTYPE;
+                    else
+                        offset <= 0;
+                        section <= LENGTH;
+                    end if;
+
+                when ETHERTYPE =>
+                    dibit := Dibit_t(ETHERTYPE_CCO(pos to pos + 1));
+
+                    -- Wait for final EtherType dibit, then transit
+                    if offset < LENGTH_LAST_DIBIT then
+                        offset <= offset + 1;
                     else
                         offset <= 0;
                         section <= LENGTH;
@@ -125,7 +139,8 @@ begin
                     -- Otherwise, if payload is smaller than what would be
                     -- needed to meet minimum frame size, select padding to
                     -- follow
-                    elsif offset < MIN_PAYLOAD_SIZE * DIBITS_PER_BYTE
+                    elsif offset <
+                          get_min_payload_size(frame) * DIBITS_PER_BYTE
                     then
                         offset <= 0;
                         section <= PADDING;
@@ -142,7 +157,8 @@ begin
 
                     -- Wait for final padding dibit, then transit
                     if offset + 1 <
-                        (MIN_PAYLOAD_SIZE - frame.length) * DIBITS_PER_BYTE
+                        (get_min_payload_size(frame) - frame.length)
+                        * DIBITS_PER_BYTE
                     then
                         offset <= offset + 1;
                     else
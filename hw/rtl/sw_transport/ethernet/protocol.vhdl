@@ -29,9 +29,14 @@ package protocol is
     attribute size : natural;
     attribute size of Msg_t : type is 6;
 
+    -- Note: some msg types have extended forms, so besides the length of the
+    -- original form, the range of lengths a msg type may have is given by
+    -- min_length & max_length.  Exact lengths are checked by is_valid_*_msg()
     type MsgTypeQueryResult_t is record
-        valid  : std_logic;
-        length : Length_t;
+        valid      : std_logic;
+        length     : Length_t;
+        min_length : Length_t;
+        max_length : Length_t;
     end record;
 
     function query_msg_type(
@@ -68,6 +73,98 @@ package protocol is
     constant SessionCtl_Heartbeat         : MsgType_t := X"03";
     constant SessionCtl_Close             : MsgType_t := X"04";
 
+    -- Note:
+    --
+    -- Our announce msgs carry an extra byte holding a bitmask of the PCM data
+    -- formats we support (bit n set for format n).  Hosts that understand it
+    -- reply with an extended handshake request whose extra byte selects one of
+    -- them, and we echo the selection back in an extended handshake response.
+    --
+    -- Hosts that send the original 1-byte handshake request get a 1-byte
+    -- response, and the padded format.
+    subtype PcmFormat_t is std_logic_vector(0 to BITS_PER_BYTE - 1);
+    constant PcmFormat_S24Padded : PcmFormat_t := X"00";
+    constant PcmFormat_S24Packed : PcmFormat_t := X"01";
+    constant PCM_FORMAT_CAPS     : PcmFormat_t := X"03";
+
+    type SessionCtlCapsMsg_t is record
+        msg_type    : MsgType_t;
+        pcm_formats : PcmFormat_t;
+    end record;
+    attribute size of SessionCtlCapsMsg_t : type is 2;
+
+    -- Note:
+    --
+    -- Our announce msgs also carry a third byte holding NUM_CHANNELS.  Hosts
+    -- that understand it reply with a 3-byte handshake request repeating the
+    -- channel count, and get a 3-byte handshake response in turn.
+    --
+    -- Hosts that send a shorter handshake request assume 2 channels.
+    subtype Channels_t is unsigned(0 to BITS_PER_BYTE - 1);
+
+    type SessionCtlChannelsMsg_t is record
+        msg_type    : MsgType_t;
+        pcm_formats : PcmFormat_t;
+        channels    : Channels_t;
+    end record;
+    attribute size of SessionCtlChannelsMsg_t : type is 3;
+
+    -- Note:
+    --
+    -- A fourth byte in our announce msgs holds a bitmask of the frames per
+    -- period we support (bit n set for 16 * 2^n frames), which is only ever
+    -- PERIOD_SIZE (see note in audio.vhdl).  Hosts that understand it reply with a 4-byte handshake
+    -- request whose last byte selects one of them (by n), which we echo back
+    -- in a 4-byte handshake response.
+    subtype PeriodFrames_t is std_logic_vector(0 to BITS_PER_BYTE - 1);
+    constant PERIOD_FRAMES_INDEX : natural := 3; -- PERIOD_SIZE = 16 * 2^3
+    constant PeriodFrames_Selected : PeriodFrames_t
+        := std_logic_vector(to_unsigned(PERIOD_FRAMES_INDEX, BITS_PER_BYTE));
+    constant PERIOD_FRAMES_CAPS    : PeriodFrames_t
+        := std_logic_vector(to_unsigned(2 ** PERIOD_FRAMES_INDEX, BITS_PER_BYTE));
+
+    type SessionCtlPeriodMsg_t is record
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+        period_frames : PeriodFrames_t;
+    end record;
+    attribute size of SessionCtlPeriodMsg_t : type is 4;
+
+    -- Note:
+    --
+    -- A fifth byte in our announce msgs holds a bitmask of the rates we can
+    -- clock S/PDIF at (bit n set for PcmRate_t n).  The rate isn't part of the
+    -- handshake, which stays at 4 bytes, but is selected by the host in each
+    -- PCM control msg, see below.
+    subtype PcmRates_t is std_logic_vector(0 to BITS_PER_BYTE - 1);
+    constant PCM_RATE_CAPS : PcmRates_t := X"3F";
+
+    type SessionCtlRatesMsg_t is record
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+        period_frames : PeriodFrames_t;
+        rates         : PcmRates_t;
+    end record;
+    attribute size of SessionCtlRatesMsg_t : type is 5;
+
+    -- Note:
+    --
+    -- Heartbeats may instead carry a count of the PCM data msgs their sender
+    -- has found missing, i.e. the periods skipped over by the seqnums received
+    -- (big-endian, wrapping).  We send our count to hosts whose heartbeats
+    -- carry theirs, and a 1-byte heartbeat to everyone else.
+    --
+    -- This is the same length as the rates form, which only announces use.
+    subtype LostPeriods_t is unsigned(0 to (4 * BITS_PER_BYTE) - 1);
+
+    type SessionCtlLossMsg_t is record
+        msg_type     : MsgType_t;
+        lost_periods : LostPeriods_t;
+    end record;
+    attribute size of SessionCtlLossMsg_t : type is 5;
+
     constant ANNOUNCE_INTERVAL  : natural := 1;
     constant HEARTBEAT_INTERVAL : natural := 1;
     constant TIMEOUT_INTERVAL   : natural := 3 * HEARTBEAT_INTERVAL;
@@ -80,6 +177,10 @@ package protocol is
         frame : Frame_t;
     ) return SessionCtlMsg_t;
 
+    function get_session_ctl_caps_msg(
+        frame : Frame_t;
+    ) return SessionCtlCapsMsg_t;
+
     function is_valid_handshake_request(
         frame : Frame_t;
     ) return boolean;
@@ -90,16 +191,91 @@ package protocol is
         generation_id : GenerationId_t;
         msg_type      : MsgType_t;
     ) return Frame_t;
+
+    function build_session_ctl_caps_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+    ) return Frame_t;
+
+    function build_session_ctl_channels_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+    ) return Frame_t;
+
+    function build_session_ctl_period_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+        period_frames : PeriodFrames_t;
+    ) return Frame_t;
+
+    function build_session_ctl_rates_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+        period_frames : PeriodFrames_t;
+        rates         : PcmRates_t;
+    ) return Frame_t;
+
+    function build_session_ctl_loss_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        lost_periods  : LostPeriods_t;
+    ) return Frame_t;
     ----------------------------------------------------------------------------
 
 
     ---------------------------------PCM control--------------------------------
+    subtype Seqnum_t is unsigned(0 to (4 * BITS_PER_BYTE) - 1);
+
+    -- Note:
+    --
+    -- Host -> FPGA: playback_seqnum is the seqnum of the first playback period
+    -- of the stream being started.
+    --
+    -- FPGA -> host: sent on each period boundary played out over S/PDIF,
+    -- while either stream is active.  playback_seqnum is the host's starting
+    -- seqnum plus the number of periods played out since, and capture_seqnum
+    -- is the seqnum of the next capture period to be sent.  The host uses
+    -- these to clock its hardware pointer.
     type PcmCtlMsg_t is record
-        streams : Streams_t;
+        streams         : Streams_t;
+        playback_seqnum : Seqnum_t;
+        capture_seqnum  : Seqnum_t;
     end record;
-    attribute size     of PcmCtlMsg_t : type is 1;
+    attribute size     of PcmCtlMsg_t : type is 9;
     attribute msg_type of PcmCtlMsg_t : type is X"01";
 
+    -- Note:
+    --
+    -- Hosts that saw our rates in the announce append a byte to their PCM
+    -- control msgs holding the PcmRate_t to clock S/PDIF at, which lands in
+    -- streams.rate.  We append it in turn to the msgs we send them.
+    --
+    -- Msgs without it imply PcmRate_48000.
+    type PcmCtlRateMsg_t is record
+        streams         : Streams_t;
+        playback_seqnum : Seqnum_t;
+        capture_seqnum  : Seqnum_t;
+        rate            : PcmRate_t;
+    end record;
+    attribute size of PcmCtlRateMsg_t : type is 10;
+
     function is_valid_pcm_ctl_msg(
         frame : Frame_t;
     ) return boolean;
@@ -107,6 +283,20 @@ package protocol is
     function get_pcm_ctl_msg(
         frame : Frame_t;
     ) return PcmCtlMsg_t;
+
+    function build_pcm_ctl_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        pcm_ctl_msg   : PcmCtlMsg_t;
+    ) return Frame_t;
+
+    function build_pcm_ctl_rate_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        pcm_ctl_msg   : PcmCtlMsg_t;
+    ) return Frame_t;
     ----------------------------------------------------------------------------
 
 
@@ -143,7 +333,7 @@ package protocol is
         period : UnpackedPeriod_t;
     end record;
     attribute size     of PcmDataMsg_t : type is
-        4 + (2 * PERIOD_SIZE * UNPACKED_SAMPLE_SIZE);
+        4 + (NUM_CHANNELS * PERIOD_SIZE * UNPACKED_SAMPLE_SIZE);
     attribute msg_type of PcmDataMsg_t : type is X"02";
 
     function is_valid_pcm_data_msg(
@@ -165,6 +355,38 @@ package protocol is
         seqnum        : unsigned(0 to (4 * BITS_PER_BYTE) - 1);
         period        : Period_t;
     ) return Frame_t;
+
+    -- Note:
+    --
+    -- The host splits periods carrying more channels than fit in 1400 bytes of
+    -- samples across several msgs (see protocol.h in the driver).  Ours always
+    -- fit in a single msg, which is laid out as below.
+    --
+    -- When PcmFormat_S24Packed is negotiated, samples are carried on the wire
+    -- exactly as they are stored in a Period_t, 3 bytes each, and the host
+    -- takes care of converting to & from ALSA's padded representation.
+    type PackedPcmDataMsg_t is record
+        seqnum : unsigned(0 to (4 * BITS_PER_BYTE) - 1);
+        period : Period_t;
+    end record;
+    attribute size of PackedPcmDataMsg_t : type is
+        4 + (NUM_CHANNELS * PERIOD_SIZE * SAMPLE_SIZE);
+
+    function is_valid_packed_pcm_data_msg(
+        frame : Frame_t;
+    ) return boolean;
+
+    function get_packed_pcm_data_msg(
+        frame : Frame_t;
+    ) return PackedPcmDataMsg_t;
+
+    function build_packed_pcm_data_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        seqnum        : unsigned(0 to (4 * BITS_PER_BYTE) - 1);
+        period        : Period_t;
+    ) return Frame_t;
     ----------------------------------------------------------------------------
 
 end package protocol;
@@ -180,22 +402,38 @@ package body protocol is
         when SessionCtlMsg_t'msg_type =>
             return (
                 valid => '1',
-                length => to_unsigned(Msg_t'size + SessionCtlMsg_t'size, 16)
+                length => to_unsigned(Msg_t'size + SessionCtlMsg_t'size, 16),
+                min_length => to_unsigned(
+                    Msg_t'size + SessionCtlMsg_t'size, 16
+                ),
+                max_length => to_unsigned(
+                    Msg_t'size + SessionCtlRatesMsg_t'size, 16
+                )
             );
         when PcmCtlMsg_t'msg_type =>
             return (
                 valid => '1',
-                length => to_unsigned(Msg_t'size + PcmCtlMsg_t'size, 16)
+                length => to_unsigned(Msg_t'size + PcmCtlMsg_t'size, 16),
+                min_length => to_unsigned(Msg_t'size + PcmCtlMsg_t'size, 16),
+                max_length => to_unsigned(
+                    Msg_t'size + PcmCtlRateMsg_t'size, 16
+                )
             );
         when PcmDataMsg_t'msg_type =>
             return (
                 valid => '1',
-                length => to_unsigned(Msg_t'size + PcmDataMsg_t'size, 16)
+                length => to_unsigned(Msg_t'size + PcmDataMsg_t'size, 16),
+                min_length => to_unsigned(
+                    Msg_t'size + PackedPcmDataMsg_t'size, 16
+                ),
+                max_length => to_unsigned(Msg_t'size + PcmDataMsg_t'size, 16)
             );
         when others =>
             return (
                 valid => '0',
-                length => to_unsigned(0, 16)
+                length => to_unsigned(0, 16),
+                min_length => to_unsigned(0, 16),
+                max_length => to_unsigned(0, 16)
             );
         end case;
     end function;
@@ -216,7 +454,10 @@ package body protocol is
         end if;
 
         result := query_msg_type(msg.msg_type);
-        if result.valid = '0' or frame.length /= result.length then
+        if result.valid = '0' or
+           frame.length < result.min_length or
+           frame.length > result.max_length
+        then
             return false;
         end if;
 
@@ -287,10 +528,14 @@ package body protocol is
             return false;
         end if;
 
-        -- Validate SessionCtlMsg_t
+        -- Validate SessionCtlMsg_t, or one of its extended forms
         msg := get_msg(frame);
         if msg.msg_type /= SessionCtlMsg_t'msg_type or
-           frame.length /= Msg_t'size + SessionCtlMsg_t'size
+           (frame.length /= Msg_t'size + SessionCtlMsg_t'size and
+            frame.length /= Msg_t'size + SessionCtlCapsMsg_t'size and
+            frame.length /= Msg_t'size + SessionCtlChannelsMsg_t'size and
+            frame.length /= Msg_t'size + SessionCtlPeriodMsg_t'size and
+            frame.length /= Msg_t'size + SessionCtlRatesMsg_t'size)
         then
             return false;
         end if;
@@ -309,6 +554,26 @@ package body protocol is
         );
     end function;
 
+    function get_session_ctl_caps_msg(
+        frame : Frame_t;
+    ) return SessionCtlCapsMsg_t is
+        variable pcm_formats : PcmFormat_t := PcmFormat_S24Padded;
+    begin
+        -- Msgs without the extra byte imply the padded format
+        if frame.length >= Msg_t'size + SessionCtlCapsMsg_t'size then
+            pcm_formats := frame.payload(
+                (7 * BITS_PER_BYTE) to (8 * BITS_PER_BYTE) - 1
+            );
+        end if;
+
+        return (
+            msg_type => frame.payload(
+                (6 * BITS_PER_BYTE) to (7 * BITS_PER_BYTE) - 1
+            ),
+            pcm_formats => pcm_formats
+        );
+    end function;
+
     function is_valid_handshake_request(
         frame : Frame_t;
     ) return boolean is
@@ -349,6 +614,146 @@ package body protocol is
 
         return frame;
     end function;
+
+    function build_session_ctl_caps_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+    ) return Frame_t is
+        variable frame : Frame_t := Frame_t_INIT;
+    begin
+        frame := build_session_ctl_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            msg_type      => msg_type
+        );
+
+        frame.length := to_unsigned(Msg_t'size + SessionCtlCapsMsg_t'size, 16);
+        frame.payload(
+            (7 * BITS_PER_BYTE) to (8 * BITS_PER_BYTE) - 1
+        ) := pcm_formats;
+
+        return frame;
+    end function;
+
+    function build_session_ctl_channels_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+    ) return Frame_t is
+        variable frame : Frame_t := Frame_t_INIT;
+    begin
+        frame := build_session_ctl_caps_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            msg_type      => msg_type,
+            pcm_formats   => pcm_formats
+        );
+
+        frame.length := to_unsigned(
+            Msg_t'size + SessionCtlChannelsMsg_t'size, 16
+        );
+        frame.payload(
+            (8 * BITS_PER_BYTE) to (9 * BITS_PER_BYTE) - 1
+        ) := std_logic_vector(channels);
+
+        return frame;
+    end function;
+
+    function build_session_ctl_period_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+        period_frames : PeriodFrames_t;
+    ) return Frame_t is
+        variable frame : Frame_t := Frame_t_INIT;
+    begin
+        frame := build_session_ctl_channels_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            msg_type      => msg_type,
+            pcm_formats   => pcm_formats,
+            channels      => channels
+        );
+
+        frame.length := to_unsigned(
+            Msg_t'size + SessionCtlPeriodMsg_t'size, 16
+        );
+        frame.payload(
+            (9 * BITS_PER_BYTE) to (10 * BITS_PER_BYTE) - 1
+        ) := period_frames;
+
+        return frame;
+    end function;
+
+    function build_session_ctl_rates_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        pcm_formats   : PcmFormat_t;
+        channels      : Channels_t;
+        period_frames : PeriodFrames_t;
+        rates         : PcmRates_t;
+    ) return Frame_t is
+        variable frame : Frame_t := Frame_t_INIT;
+    begin
+        frame := build_session_ctl_period_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            msg_type      => msg_type,
+            pcm_formats   => pcm_formats,
+            channels      => channels,
+            period_frames => period_frames
+        );
+
+        frame.length := to_unsigned(
+            Msg_t'size + SessionCtlRatesMsg_t'size, 16
+        );
+        frame.payload(
+            (10 * BITS_PER_BYTE) to (11 * BITS_PER_BYTE) - 1
+        ) := rates;
+
+        return frame;
+    end function;
+
+    function build_session_ctl_loss_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        msg_type      : MsgType_t;
+        lost_periods  : LostPeriods_t;
+    ) return Frame_t is
+        variable frame : Frame_t := Frame_t_INIT;
+    begin
+        frame := build_session_ctl_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            msg_type      => msg_type
+        );
+
+        frame.length := to_unsigned(
+            Msg_t'size + SessionCtlLossMsg_t'size, 16
+        );
+        frame.payload(
+            (7 * BITS_PER_BYTE) to (11 * BITS_PER_BYTE) - 1
+        ) := std_logic_vector(lost_periods);
+
+        return frame;
+    end function;
     ----------------------------------------------------------------------------
 
 
@@ -363,10 +768,11 @@ package body protocol is
             return false;
         end if;
 
-        -- Validate PcmCtlMsg_t
+        -- Validate PcmCtlMsg_t, or its extended form
         msg := get_msg(frame);
         if msg.msg_type /= PcmCtlMsg_t'msg_type or
-           frame.length /= Msg_t'size + PcmCtlMsg_t'size
+           (frame.length /= Msg_t'size + PcmCtlMsg_t'size and
+            frame.length /= Msg_t'size + PcmCtlRateMsg_t'size)
         then
             return false;
         end if;
@@ -377,7 +783,15 @@ package body protocol is
     function get_pcm_ctl_msg(
         frame : Frame_t;
     ) return PcmCtlMsg_t is
+        variable rate : PcmRate_t := PcmRate_48000;
     begin
+        -- Msgs without the extra byte imply 48kHz
+        if frame.length >= Msg_t'size + PcmCtlRateMsg_t'size then
+            rate := frame.payload(
+                (15 * BITS_PER_BYTE) to (16 * BITS_PER_BYTE) - 1
+            );
+        end if;
+
         return (
             streams => (
                 playback => (
@@ -385,10 +799,69 @@ package body protocol is
                 ),
                 capture => (
                     active => frame.payload((6 * BITS_PER_BYTE) + 6)
-                )
-            )
+                ),
+                rate => rate
+            ),
+            playback_seqnum => unsigned(frame.payload(
+                (7 * BITS_PER_BYTE) to (11 * BITS_PER_BYTE) - 1
+            )),
+            capture_seqnum => unsigned(frame.payload(
+                (11 * BITS_PER_BYTE) to (15 * BITS_PER_BYTE) - 1
+            ))
         );
     end function;
+
+    function build_pcm_ctl_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        pcm_ctl_msg   : PcmCtlMsg_t;
+    ) return Frame_t is
+        variable frame : Frame_t := Frame_t_INIT;
+    begin
+        frame := build_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            msg_type      => PcmCtlMsg_t'msg_type
+        );
+
+        frame.payload((6 * BITS_PER_BYTE) + 7) :=
+            pcm_ctl_msg.streams.playback.active;
+        frame.payload((6 * BITS_PER_BYTE) + 6) :=
+            pcm_ctl_msg.streams.capture.active;
+        frame.payload(
+            (7 * BITS_PER_BYTE) to (11 * BITS_PER_BYTE) - 1
+        ) := std_logic_vector(pcm_ctl_msg.playback_seqnum);
+        frame.payload(
+            (11 * BITS_PER_BYTE) to (15 * BITS_PER_BYTE) - 1
+        ) := std_logic_vector(pcm_ctl_msg.capture_seqnum);
+
+        return frame;
+    end function;
+
+    function build_pcm_ctl_rate_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        pcm_ctl_msg   : PcmCtlMsg_t;
+    ) return Frame_t is
+        variable frame : Frame_t := Frame_t_INIT;
+    begin
+        frame := build_pcm_ctl_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            pcm_ctl_msg   => pcm_ctl_msg
+        );
+
+        frame.length := to_unsigned(Msg_t'size + PcmCtlRateMsg_t'size, 16);
+        frame.payload(
+            (15 * BITS_PER_BYTE) to (16 * BITS_PER_BYTE) - 1
+        ) := pcm_ctl_msg.streams.rate;
+
+        return frame;
+    end function;
     ----------------------------------------------------------------------------
 
 
@@ -492,6 +965,90 @@ package body protocol is
 
         return frame;
     end function;
+
+    function is_valid_packed_pcm_data_msg(
+        frame : Frame_t;
+    ) return boolean is
+        variable msg : Msg_t;
+    begin
+        -- Validate Msg_t
+        if not is_valid_msg(frame) then
+            return false;
+        end if;
+
+        -- Validate PackedPcmDataMsg_t
+        msg := get_msg(frame);
+        if msg.msg_type /= PcmDataMsg_t'msg_type or
+           frame.length /= Msg_t'size + PackedPcmDataMsg_t'size
+        then
+            return false;
+        end if;
+
+        return true;
+    end function;
+
+    function get_packed_pcm_data_msg(
+        frame : Frame_t;
+    ) return PackedPcmDataMsg_t is
+        variable offset : natural  := 0;
+        variable period : Period_t := Period_t_INIT;
+    begin
+        for channel in 0 to NUM_CHANNELS - 1 loop
+            for sample in 0 to PERIOD_SIZE - 1 loop
+                offset := (10 * BITS_PER_BYTE) +
+                          ((PERIOD_SIZE * channel) + sample) *
+                          (SAMPLE_SIZE * BITS_PER_BYTE);
+
+                period(channel)(sample) := frame.payload(
+                    offset to offset + (SAMPLE_SIZE * BITS_PER_BYTE) - 1
+                );
+            end loop;
+        end loop;
+
+        return (
+            seqnum => unsigned(frame.payload(
+                (6 * BITS_PER_BYTE) to (10 * BITS_PER_BYTE) - 1
+            )),
+            period => period
+        );
+    end function;
+
+    function build_packed_pcm_data_msg(
+        dest_mac      : MacAddress_t;
+        src_mac       : MacAddress_t;
+        generation_id : GenerationId_t;
+        seqnum        : unsigned(0 to (4 * BITS_PER_BYTE) - 1);
+        period        : Period_t;
+    ) return Frame_t is
+        variable frame  : Frame_t := Frame_t_INIT;
+        variable offset : natural := 0;
+    begin
+        frame := build_msg(
+            dest_mac      => dest_mac,
+            src_mac       => src_mac,
+            generation_id => generation_id,
+            msg_type      => PcmDataMsg_t'msg_type
+        );
+        frame.length := to_unsigned(Msg_t'size + PackedPcmDataMsg_t'size, 16);
+
+        frame.payload(
+            (6 * BITS_PER_BYTE) to (10 * BITS_PER_BYTE) - 1
+        ) := std_logic_vector(seqnum);
+
+        for channel in 0 to NUM_CHANNELS - 1 loop
+            for sample in 0 to PERIOD_SIZE - 1 loop
+                offset := (10 * BITS_PER_BYTE) +
+                          ((PERIOD_SIZE * channel) + sample) *
+                          (SAMPLE_SIZE * BITS_PER_BYTE);
+
+                frame.payload(
+                    offset to offset + (SAMPLE_SIZE * BITS_PER_BYTE) - 1
+                ) := period(channel)(sample);
+            end loop;
+        end loop;
+
+        return frame;
+    end function;
     ----------------------------------------------------------------------------
 
 end package body protocol;
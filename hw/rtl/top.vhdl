@@ -24,6 +24,9 @@ architecture structure of top is
 
     signal streams : Streams_t := Streams_t_INIT;
 
+    -- Toggles on each period played out by S/PDIF
+    signal period : std_logic := '0';
+
     -- Intermediate signals for playback FIFO
     signal playback_reader : PeriodFifo_ReaderPins_t;
     signal playback_writer : PeriodFifo_WriterPins_t;
@@ -41,6 +44,7 @@ begin
             phy             => ethernet_phy,
             playback_writer => playback_writer,
             capture_reader  => capture_reader,
+            i_period        => period,
             o_streams       => streams
         );
 
@@ -67,7 +71,8 @@ begin
             i_streams       => streams,
             playback_reader => playback_reader,
             capture_writer  => capture_writer,
-            phy             => spdif_phy
+            phy             => spdif_phy,
+            o_period        => period
         );
 
     -- Loopback playback -> capture
@@ -11,10 +11,18 @@ package audio is
     subtype Sample_t is std_logic_vector(0 to (SAMPLE_SIZE * BITS_PER_BYTE) - 1);
     constant Sample_t_INIT : Sample_t := (others => '0');
 
+    -- Note: announced to the host as the only frames per period supported,
+    -- see protocol.vhdl.  The period FIFOs, the S/PDIF transmitter & the PCM
+    -- data msg records are all sized from it at synthesis, so running the
+    -- other sizes the host can negotiate (32 frames for low latency, 256 for
+    -- fewer packets) needs them to take a period length selected at runtime
+    -- instead.  That is yet to be done, until then only the emulator runs them
     constant PERIOD_SIZE : natural := 128;
     type ChannelPcmData_t is array (0 to PERIOD_SIZE - 1) of Sample_t;
     constant ChannelPcmData_t_INIT : ChannelPcmData_t := (others => Sample_t_INIT);
 
+    -- Note: announced to the host when a session is opened, which lays out PCM
+    -- data msgs to match.  S/PDIF carries a stereo pair
     constant NUM_CHANNELS : natural := 2;
     type Period_t is array (0 to NUM_CHANNELS - 1) of ChannelPcmData_t;
     constant Period_t_INIT : Period_t := (others => ChannelPcmData_t_INIT);
@@ -27,14 +35,26 @@ package audio is
         active => '0'
     );
 
+    -- Note: selected by the host in each PCM control msg, see protocol.vhdl.
+    -- Playback & capture share the S/PDIF clock, so they share a rate
+    subtype PcmRate_t is std_logic_vector(0 to BITS_PER_BYTE - 1);
+    constant PcmRate_44100  : PcmRate_t := X"00";
+    constant PcmRate_48000  : PcmRate_t := X"01";
+    constant PcmRate_88200  : PcmRate_t := X"02";
+    constant PcmRate_96000  : PcmRate_t := X"03";
+    constant PcmRate_176400 : PcmRate_t := X"04";
+    constant PcmRate_192000 : PcmRate_t := X"05";
+
     type Streams_t is record
         playback : StreamStatus_t;
         capture  : StreamStatus_t;
+        rate     : PcmRate_t;
     end record;
 
     constant Streams_t_INIT : Streams_t := (
         playback => StreamStatus_t_INIT,
-        capture  => StreamStatus_t_INIT
+        capture  => StreamStatus_t_INIT,
+        rate     => PcmRate_48000
     );
 
     type PeriodFifo_WriterPins_t is record
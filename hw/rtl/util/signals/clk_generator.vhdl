@@ -5,18 +5,17 @@ library ieee;
 library work;
     use work.signals.all;
 
+-- Divides i_clk by 2 * i_half_period, which may change while running
 entity clk_generator is
     port (
-        i_clk : in  std_logic;
-        o_clk : out std_logic
+        i_clk         : in  std_logic;
+        i_half_period : in  positive;
+        o_clk         : out std_logic
     );
 end clk_generator;
 
 architecture behavioral of clk_generator is
 
-    constant CYCLES_LOW  : natural := 4;
-    constant CYCLES_HIGH : natural := 4;
-
     type State_t is (LOW, HIGH);
     signal state : State_t := LOW;
     signal clk     : std_logic := '0';
@@ -30,7 +29,7 @@ begin
 
             case state is
                 when LOW =>
-                    if counter < CYCLES_LOW then
+                    if counter < i_half_period - 1 then
                         counter <= counter + 1;
                     else
                         state <= HIGH;
@@ -39,7 +38,7 @@ begin
                     end if;
 
                 when HIGH =>
-                    if counter < CYCLES_HIGH then
+                    if counter < i_half_period - 1 then
                         counter <= counter + 1;
                     else
                         state <= LOW;
@@ -13,10 +13,12 @@ package signals is
         );
     end component;
 
+    -- Divide clk by a factor selectable at runtime
     component clk_generator is
         port (
-            i_clk : in  std_logic;
-            o_clk : out std_logic
+            i_clk         : in  std_logic;
+            i_half_period : in  positive;
+            o_clk         : out std_logic
         );
     end component;
 
@@ -5,23 +5,29 @@ proc get_ip_config {ip} {
 
     switch $ip {
         ip_clk_wizard_spdif {
-            # Xilinx clock wizard for generating S/PDIF tx clk
+            # Xilinx clock wizard for generating S/PDIF tx clks
+            #
+            # Note: 1024x the 48kHz & 44.1kHz families of sample rates, within
+            # 50ppm of nominal (S/PDIF receivers tolerate 1000ppm)
             dict set config "name"    "clk_wiz"
             dict set config "vendor"  "xilinx.com"
             dict set config "library" "ip"
             dict set config "version" "6.0"
-            dict set config "props" [dict create                \
-                CONFIG.CLKOUT1_JITTER             {360.948}     \
-                CONFIG.CLKOUT1_PHASE_ERROR        {301.601}     \
-                CONFIG.CLKOUT1_REQUESTED_OUT_FREQ {12.288}      \
-                CONFIG.CLK_OUT1_PORT              {o_spdif_clk} \
-                CONFIG.MMCM_CLKFBOUT_MULT_F       {48.000}      \
-                CONFIG.MMCM_CLKOUT0_DIVIDE_F      {78.125}      \
-                CONFIG.MMCM_DIVCLK_DIVIDE         {5}           \
-                CONFIG.PRIMARY_PORT               {i_spdif_clk} \
-                CONFIG.PRIM_SOURCE                {No_buffer}   \
-                CONFIG.USE_LOCKED                 {false}       \
-                CONFIG.USE_RESET                  {false}       \
+            dict set config "props" [dict create                     \
+                CONFIG.CLKOUT1_REQUESTED_OUT_FREQ {49.152}           \
+                CONFIG.CLKOUT2_REQUESTED_OUT_FREQ {45.1584}          \
+                CONFIG.CLKOUT2_USED               {true}             \
+                CONFIG.CLK_OUT1_PORT              {o_spdif_clk_48k}  \
+                CONFIG.CLK_OUT2_PORT              {o_spdif_clk_44k1} \
+                CONFIG.MMCM_CLKFBOUT_MULT_F       {36.125}           \
+                CONFIG.MMCM_CLKOUT0_DIVIDE_F      {18.375}           \
+                CONFIG.MMCM_CLKOUT1_DIVIDE        {20}               \
+                CONFIG.MMCM_DIVCLK_DIVIDE         {4}                \
+                CONFIG.NUM_OUT_CLKS               {2}                \
+                CONFIG.PRIMARY_PORT               {i_spdif_clk}      \
+                CONFIG.PRIM_SOURCE                {No_buffer}        \
+                CONFIG.USE_LOCKED                 {false}            \
+                CONFIG.USE_RESET                  {false}            \
             ]
         }
 
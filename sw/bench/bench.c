@@ -0,0 +1,764 @@
+// Note:
+//
+// Benchmarks sustained playback over any number of cco cards, for tracking how
+// many a host can drive from one driver version to the next.  run.sh sets up
+// the cards with the emulator (see ../emulator) and runs this against them.
+//
+// One thread per card streams silence to its playback substream, through
+// snd_pcm_writen() or snd_pcm_mmap_begin()/commit() as selected, for a fixed
+// duration.  Afterwards a JSON report is written holding:
+//
+//   - packets/sec in each direction on the interface the cards are on
+//
+//   - CPU% of the whole host over the run (from /proc/stat), and of each
+//     stream's thread along with its perf counters where perf_event_open() is
+//     permitted
+//
+//   - xruns of each stream
+//
+//   - period delivery latency: how long after ALSA timestamped a period
+//     boundary the stream's thread got to refill it (per stream), and how long
+//     after a period was completed the card reported playing it (from the
+//     driver's latency histograms in debugfs, to its power-of-two buckets)
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <alsa/asoundlib.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#define NS_PER_SEC 1000000000ULL
+
+/*===============================Configuration================================*/
+enum bench_mode {
+    BENCH_MODE_RW,
+    BENCH_MODE_MMAP,
+};
+
+struct options {
+    unsigned streams;
+    enum bench_mode mode;
+    const char *device;        /* printf() format taking the stream's index */
+    snd_pcm_format_t format;
+    unsigned rate;
+    unsigned channels;
+    snd_pcm_uframes_t period_frames;
+    unsigned buffer_periods;
+    unsigned duration;         /* in seconds */
+    const char *intf;
+    const char *debugfs;
+    const char *output;
+};
+
+static struct options opts = {
+    .streams        = 1,
+    .mode           = BENCH_MODE_RW,
+    .device         = "hw:%u,0",
+    .format         = SND_PCM_FORMAT_S24_BE,
+    .rate           = 48000,
+    .channels       = 2,
+    .period_frames  = 128,
+    .buffer_periods = 4,
+    .duration       = 10,
+    .intf           = "cco0",
+    .debugfs        = "/sys/kernel/debug/cco",
+    .output         = NULL,
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -k streams   playback substreams, one per card (default 1)\n"
+            "  -m mode      \"rw\" (default) or \"mmap\"\n"
+            "  -D device    device of stream n, as a printf format "
+            "(default hw:%%u,0)\n"
+            "  -F format    ALSA sample format (default S24_BE)\n"
+            "  -r rate      in Hz (default 48000)\n"
+            "  -c channels  (default 2)\n"
+            "  -p frames    frames per period (default 128)\n"
+            "  -b periods   periods per buffer (default 4)\n"
+            "  -t seconds   duration (default 10)\n"
+            "  -i intf      interface the cards are on (default cco0)\n"
+            "  -d dir       cco debugfs dir (default /sys/kernel/debug/cco)\n"
+            "  -o file      write the JSON report here (default stdout)\n",
+            prog);
+}
+
+static int parse_options(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "k:m:D:F:r:c:p:b:t:i:d:o:h")) != -1) {
+        switch (opt) {
+        case 'k':
+            opts.streams = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            if (strcmp(optarg, "rw") == 0)
+                opts.mode = BENCH_MODE_RW;
+            else if (strcmp(optarg, "mmap") == 0)
+                opts.mode = BENCH_MODE_MMAP;
+            else
+                return -1;
+            break;
+        case 'D':
+            opts.device = optarg;
+            break;
+        case 'F':
+            opts.format = snd_pcm_format_value(optarg);
+            if (opts.format == SND_PCM_FORMAT_UNKNOWN)
+                return -1;
+            break;
+        case 'r':
+            opts.rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            opts.channels = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            opts.period_frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            opts.buffer_periods = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            opts.duration = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            opts.intf = optarg;
+            break;
+        case 'd':
+            opts.debugfs = optarg;
+            break;
+        case 'o':
+            opts.output = optarg;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (opts.streams == 0 || opts.rate == 0 || opts.channels == 0 ||
+        opts.period_frames == 0 || opts.buffer_periods < 2 ||
+        opts.duration == 0)
+        return -1;
+
+    return 0;
+}
+/*============================================================================*/
+
+
+/*=================================Sampling===================================*/
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Host CPU time from the first line of /proc/stat, in USER_HZ ticks
+struct cpu_sample {
+    uint64_t user, nice, system, idle, iowait, irq, softirq, steal;
+};
+
+static int sample_cpu(struct cpu_sample *s)
+{
+    FILE *f = fopen("/proc/stat", "r");
+    if (!f)
+        return -errno;
+
+    int n = fscanf(f, "cpu %lu %lu %lu %lu %lu %lu %lu %lu", &s->user,
+                   &s->nice, &s->system, &s->idle, &s->iowait, &s->irq,
+                   &s->softirq, &s->steal);
+    fclose(f);
+    return n == 8 ? 0 : -EINVAL;
+}
+
+static uint64_t read_u64(const char *path)
+{
+    uint64_t value = 0;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%lu", &value) != 1)
+            value = 0;
+        fclose(f);
+    }
+
+    return value;
+}
+
+struct net_sample {
+    uint64_t tx_packets;
+    uint64_t rx_packets;
+};
+
+static void sample_net(struct net_sample *s)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/tx_packets",
+             opts.intf);
+    s->tx_packets = read_u64(path);
+    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_packets",
+             opts.intf);
+    s->rx_packets = read_u64(path);
+}
+
+// Buckets of the driver's latency histogram, see CCO_PCM_LATENCY_BUCKETS
+#define LATENCY_BUCKETS 16
+
+// Sums the playback latency histograms of every session, see
+// cco_pcm_stats_show()
+static void sample_latency_hist(uint64_t hist[LATENCY_BUCKETS])
+{
+    memset(hist, 0, LATENCY_BUCKETS * sizeof(*hist));
+
+    DIR *dir = opendir(opts.debugfs);
+    if (!dir)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "session", 7) != 0)
+            continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s/stats", opts.debugfs,
+                 entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (!f)
+            continue;
+
+        // Only playback has a histogram, its buckets read "[lo, hi): count"
+        char line[256];
+        bool in_hist = false;
+        while (fgets(line, sizeof(line), f)) {
+            if (strstr(line, "latency_hist_us:")) {
+                in_hist = true;
+                continue;
+            }
+            char *lo = strchr(line, '[');
+            char *count = strrchr(line, ':');
+            if (!in_hist || !lo || !count) {
+                in_hist = false;
+                continue;
+            }
+
+            unsigned bucket = 0;
+            for (unsigned long us = strtoul(lo + 1, NULL, 10); us > 1; us >>= 1)
+                bucket++;
+            if (bucket < LATENCY_BUCKETS)
+                hist[bucket] += strtoull(count + 1, NULL, 10);
+        }
+        fclose(f);
+    }
+    closedir(dir);
+}
+/*============================================================================*/
+
+
+/*==================================Streams===================================*/
+// Counted by each stream's thread, see perf_event_open(2)
+enum perf_counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CONTEXT_SWITCHES,
+    PERF_COUNTERS,
+};
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} perf_counters[PERF_COUNTERS] = {
+    [PERF_CYCLES]           = { "cycles", PERF_TYPE_HARDWARE,
+                                PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS]     = { "instructions", PERF_TYPE_HARDWARE,
+                                PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_CONTEXT_SWITCHES] = { "context_switches", PERF_TYPE_SOFTWARE,
+                                PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+struct stream {
+    unsigned index;
+    char device[64];
+    pthread_t thread;
+    snd_pcm_t *pcm;
+    int err;
+
+    uint64_t periods;
+    uint64_t xruns;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+
+    int perf_fds[PERF_COUNTERS];
+    int64_t perf[PERF_COUNTERS];   /* -1 where unavailable */
+
+    // Period delivery latency samples, in ns
+    uint64_t *latencies;
+    size_t num_latencies;
+    size_t max_latencies;
+};
+
+static struct stream *streams;
+static atomic_uint streams_running;
+static atomic_bool stop;
+
+static int stream_open(struct stream *s)
+{
+    int err;
+
+    err = snd_pcm_open(&s->pcm, s->device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0)
+        goto exit_error;
+
+    snd_pcm_hw_params_t *hw;
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_hw_params_any(s->pcm, hw);
+
+    snd_pcm_access_t access = opts.mode == BENCH_MODE_MMAP ?
+                              SND_PCM_ACCESS_MMAP_NONINTERLEAVED :
+                              SND_PCM_ACCESS_RW_NONINTERLEAVED;
+    snd_pcm_uframes_t buffer_frames = opts.period_frames * opts.buffer_periods;
+    if ((err = snd_pcm_hw_params_set_access(s->pcm, hw, access)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(s->pcm, hw, opts.format)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(s->pcm, hw,
+                                              opts.channels)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate(s->pcm, hw, opts.rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_size(s->pcm, hw,
+                                                 opts.period_frames, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_buffer_size(s->pcm, hw,
+                                                 buffer_frames)) < 0 ||
+        (err = snd_pcm_hw_params(s->pcm, hw)) < 0)
+        goto undo_open;
+
+    // Start once the buffer is full, and timestamp period boundaries against
+    // CLOCK_MONOTONIC for measuring delivery latency
+    snd_pcm_sw_params_t *sw;
+    snd_pcm_sw_params_alloca(&sw);
+    snd_pcm_sw_params_current(s->pcm, sw);
+    if ((err = snd_pcm_sw_params_set_start_threshold(s->pcm, sw,
+                                                     buffer_frames)) < 0 ||
+        (err = snd_pcm_sw_params_set_avail_min(s->pcm, sw,
+                                               opts.period_frames)) < 0 ||
+        (err = snd_pcm_sw_params_set_tstamp_mode(s->pcm, sw,
+                                                 SND_PCM_TSTAMP_ENABLE)) < 0 ||
+        (err = snd_pcm_sw_params_set_tstamp_type(
+            s->pcm, sw, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0 ||
+        (err = snd_pcm_sw_params(s->pcm, sw)) < 0)
+        goto undo_open;
+
+    return 0;
+
+undo_open:
+    snd_pcm_close(s->pcm);
+    s->pcm = NULL;
+exit_error:
+    fprintf(stderr, "cco_bench: %s: %s\n", s->device, snd_strerror(err));
+    return err;
+}
+
+static void stream_perf_open(struct stream *s)
+{
+    for (unsigned i = 0; i < PERF_COUNTERS; ++i) {
+        struct perf_event_attr attr = {
+            .type        = perf_counters[i].type,
+            .size        = sizeof(attr),
+            .config      = perf_counters[i].config,
+            .exclude_hv  = 1,
+        };
+        s->perf_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static void stream_perf_close(struct stream *s)
+{
+    for (unsigned i = 0; i < PERF_COUNTERS; ++i) {
+        s->perf[i] = -1;
+        if (s->perf_fds[i] < 0)
+            continue;
+
+        uint64_t value;
+        if (read(s->perf_fds[i], &value, sizeof(value)) == sizeof(value))
+            s->perf[i] = value;
+        close(s->perf_fds[i]);
+    }
+}
+
+// Records how long after the last period boundary the stream got to refill it
+static void stream_record_latency(struct stream *s)
+{
+    snd_pcm_uframes_t avail;
+    snd_htimestamp_t ts;
+    if (snd_pcm_htimestamp(s->pcm, &avail, &ts) < 0 ||
+        (ts.tv_sec == 0 && ts.tv_nsec == 0))
+        return;
+
+    uint64_t boundary = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+    uint64_t now = now_ns(CLOCK_MONOTONIC);
+    if (now < boundary)
+        return;
+
+    if (s->num_latencies == s->max_latencies) {
+        size_t max = s->max_latencies ? 2 * s->max_latencies : 4096;
+        uint64_t *latencies = realloc(s->latencies, max * sizeof(*latencies));
+        if (!latencies)
+            return;
+        s->latencies = latencies;
+        s->max_latencies = max;
+    }
+    s->latencies[s->num_latencies++] = now - boundary;
+}
+
+// Recovers from an xrun or suspend, returns err if it was anything else
+static int stream_recover(struct stream *s, int err)
+{
+    if (err == -EPIPE)
+        s->xruns++;
+
+    return snd_pcm_recover(s->pcm, err, 1);
+}
+
+static int stream_run_rw(struct stream *s)
+{
+    unsigned bytes = snd_pcm_format_physical_width(opts.format) / 8;
+    void *bufs[opts.channels];
+    for (unsigned c = 0; c < opts.channels; ++c) {
+        bufs[c] = malloc(opts.period_frames * bytes);
+        if (!bufs[c])
+            return -ENOMEM;
+        snd_pcm_format_set_silence(opts.format, bufs[c], opts.period_frames);
+    }
+
+    // Writes block once the buffer is full, so each one thereafter returns as
+    // the stream's thread is woken for a period boundary
+    int err = 0;
+    uint64_t written = 0;
+    while (!atomic_load(&stop)) {
+        snd_pcm_sframes_t n = snd_pcm_writen(s->pcm, bufs, opts.period_frames);
+        if (n < 0) {
+            err = stream_recover(s, n);
+            if (err < 0)
+                break;
+            continue;
+        }
+
+        if (++written > opts.buffer_periods)
+            stream_record_latency(s);
+        s->periods++;
+    }
+
+    for (unsigned c = 0; c < opts.channels; ++c)
+        free(bufs[c]);
+
+    return err;
+}
+
+static int stream_run_mmap(struct stream *s)
+{
+    int err = 0;
+    bool waited = false;
+    while (!atomic_load(&stop)) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(s->pcm);
+        if (avail < 0) {
+            err = stream_recover(s, avail);
+            if (err < 0)
+                break;
+            continue;
+        }
+
+        if ((snd_pcm_uframes_t)avail < opts.period_frames) {
+            // The buffer is full, start it if it isn't yet running
+            if (snd_pcm_state(s->pcm) == SND_PCM_STATE_PREPARED) {
+                err = snd_pcm_start(s->pcm);
+                if (err < 0)
+                    break;
+                continue;
+            }
+
+            err = snd_pcm_wait(s->pcm, 1000);
+            if (err < 0) {
+                err = stream_recover(s, err);
+                if (err < 0)
+                    break;
+            }
+            waited = true;
+            continue;
+        }
+
+        if (waited) {
+            stream_record_latency(s);
+            waited = false;
+        }
+
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_uframes_t frames = opts.period_frames;
+        err = snd_pcm_mmap_begin(s->pcm, &areas, &offset, &frames);
+        if (err < 0) {
+            err = stream_recover(s, err);
+            if (err < 0)
+                break;
+            continue;
+        }
+
+        snd_pcm_areas_silence(areas, offset, opts.channels, frames,
+                              opts.format);
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(s->pcm, offset,
+                                                          frames);
+        if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+            err = stream_recover(s, committed < 0 ? committed : -EPIPE);
+            if (err < 0)
+                break;
+            continue;
+        }
+
+        if (frames == opts.period_frames)
+            s->periods++;
+    }
+
+    return err;
+}
+
+static void *stream_thread(void *data)
+{
+    struct stream *s = data;
+
+    stream_perf_open(s);
+    uint64_t wall = now_ns(CLOCK_MONOTONIC);
+    uint64_t cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    atomic_fetch_add(&streams_running, 1);
+    if (opts.mode == BENCH_MODE_MMAP)
+        s->err = stream_run_mmap(s);
+    else
+        s->err = stream_run_rw(s);
+
+    s->cpu_ns = now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    s->wall_ns = now_ns(CLOCK_MONOTONIC) - wall;
+    stream_perf_close(s);
+
+    snd_pcm_drop(s->pcm);
+    return NULL;
+}
+/*============================================================================*/
+
+
+/*=================================Reporting==================================*/
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p)
+{
+    if (!n)
+        return 0;
+
+    size_t rank = (size_t)(p * n + 0.999999);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+// Upper edge of the bucket holding the percentile, or its lower edge for the
+// last bucket which is unbounded
+static uint64_t hist_percentile(const uint64_t hist[LATENCY_BUCKETS], double p)
+{
+    uint64_t total = 0;
+    for (unsigned i = 0; i < LATENCY_BUCKETS; ++i)
+        total += hist[i];
+    if (!total)
+        return 0;
+
+    uint64_t rank = (uint64_t)(p * total + 0.999999);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LATENCY_BUCKETS - 1; ++i) {
+        seen += hist[i];
+        if (seen >= rank)
+            return 2ULL << i;
+    }
+
+    return 1ULL << (LATENCY_BUCKETS - 1);
+}
+
+static void report(FILE *out, double seconds, const struct cpu_sample *c0,
+                   const struct cpu_sample *c1, const struct net_sample *n0,
+                   const struct net_sample *n1,
+                   const uint64_t h0[LATENCY_BUCKETS],
+                   const uint64_t h1[LATENCY_BUCKETS])
+{
+    char version[64] = "unknown";
+    FILE *f = fopen("/sys/module/cco/srcversion", "r");
+    if (f) {
+        if (fscanf(f, "%63s", version) != 1)
+            strcpy(version, "unknown");
+        fclose(f);
+    }
+
+    uint64_t busy = (c1->user - c0->user) + (c1->nice - c0->nice) +
+                    (c1->system - c0->system) + (c1->irq - c0->irq) +
+                    (c1->softirq - c0->softirq) + (c1->steal - c0->steal);
+    uint64_t total = busy + (c1->idle - c0->idle) + (c1->iowait - c0->iowait);
+    double scale = total ? 100.0 / total : 0;
+
+    uint64_t hist[LATENCY_BUCKETS];
+    for (unsigned i = 0; i < LATENCY_BUCKETS; ++i)
+        hist[i] = h1[i] - h0[i];
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"driver_srcversion\": \"%s\",\n", version);
+    fprintf(out, "  \"config\": {\n");
+    fprintf(out, "    \"streams\": %u,\n", opts.streams);
+    fprintf(out, "    \"mode\": \"%s\",\n",
+            opts.mode == BENCH_MODE_MMAP ? "mmap" : "rw");
+    fprintf(out, "    \"format\": \"%s\",\n", snd_pcm_format_name(opts.format));
+    fprintf(out, "    \"rate\": %u,\n", opts.rate);
+    fprintf(out, "    \"channels\": %u,\n", opts.channels);
+    fprintf(out, "    \"period_frames\": %lu,\n", opts.period_frames);
+    fprintf(out, "    \"buffer_periods\": %u\n", opts.buffer_periods);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"duration_s\": %.3f,\n", seconds);
+    fprintf(out, "  \"packets_per_sec\": { \"tx\": %.1f, \"rx\": %.1f },\n",
+            (n1->tx_packets - n0->tx_packets) / seconds,
+            (n1->rx_packets - n0->rx_packets) / seconds);
+    fprintf(out, "  \"cpu_pct\": { \"busy\": %.2f, \"system\": %.2f, "
+            "\"irq\": %.2f, \"softirq\": %.2f },\n",
+            busy * scale, (c1->system - c0->system) * scale,
+            (c1->irq - c0->irq) * scale, (c1->softirq - c0->softirq) * scale);
+    fprintf(out, "  \"fpga_latency_us\": { \"p99\": %lu, \"p999\": %lu },\n",
+            hist_percentile(hist, 0.99), hist_percentile(hist, 0.999));
+
+    fprintf(out, "  \"streams\": [\n");
+    for (unsigned i = 0; i < opts.streams; ++i) {
+        struct stream *s = &streams[i];
+        qsort(s->latencies, s->num_latencies, sizeof(*s->latencies),
+              compare_u64);
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"device\": \"%s\",\n", s->device);
+        fprintf(out, "      \"error\": %s%s%s,\n", s->err ? "\"" : "",
+                s->err ? snd_strerror(s->err) : "null", s->err ? "\"" : "");
+        fprintf(out, "      \"periods\": %lu,\n", s->periods);
+        fprintf(out, "      \"xruns\": %lu,\n", s->xruns);
+        fprintf(out, "      \"cpu_pct\": %.3f,\n",
+                s->wall_ns ? 100.0 * s->cpu_ns / s->wall_ns : 0);
+        for (unsigned j = 0; j < PERF_COUNTERS; ++j) {
+            if (s->perf[j] < 0)
+                fprintf(out, "      \"%s\": null,\n", perf_counters[j].name);
+            else
+                fprintf(out, "      \"%s\": %ld,\n", perf_counters[j].name,
+                        s->perf[j]);
+        }
+        fprintf(out, "      \"delivery_latency_us\": { \"p50\": %.1f, "
+                "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f }\n",
+                percentile(s->latencies, s->num_latencies, 0.5) / 1e3,
+                percentile(s->latencies, s->num_latencies, 0.99) / 1e3,
+                percentile(s->latencies, s->num_latencies, 0.999) / 1e3,
+                percentile(s->latencies, s->num_latencies, 1.0) / 1e3);
+        fprintf(out, "    }%s\n", i + 1 < opts.streams ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+/*============================================================================*/
+
+
+/*====================================Main====================================*/
+int main(int argc, char **argv)
+{
+    int err = 0;
+
+    if (parse_options(argc, argv) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    streams = calloc(opts.streams, sizeof(*streams));
+    if (!streams) {
+        perror("calloc");
+        return 1;
+    }
+
+    // Every substream is configured before any starts, so that a card missing
+    // doesn't leave the others running
+    unsigned opened = 0;
+    for (; opened < opts.streams; ++opened) {
+        struct stream *s = &streams[opened];
+        s->index = opened;
+        snprintf(s->device, sizeof(s->device), opts.device, opened);
+        err = stream_open(s);
+        if (err < 0)
+            goto undo_open;
+    }
+
+    unsigned started = 0;
+    for (; started < opts.streams; ++started) {
+        err = pthread_create(&streams[started].thread, NULL, stream_thread,
+                             &streams[started]);
+        if (err) {
+            err = -err;
+            atomic_store(&stop, true);
+            goto undo_start;
+        }
+    }
+    while (atomic_load(&streams_running) < opts.streams)
+        usleep(1000);
+
+    // Let the streams fill their buffers & start before measuring
+    usleep(100000);
+
+    struct cpu_sample c0, c1;
+    struct net_sample n0, n1;
+    uint64_t h0[LATENCY_BUCKETS], h1[LATENCY_BUCKETS];
+    sample_cpu(&c0);
+    sample_net(&n0);
+    sample_latency_hist(h0);
+    uint64_t start = now_ns(CLOCK_MONOTONIC);
+
+    struct timespec duration = { .tv_sec = opts.duration };
+    while (nanosleep(&duration, &duration) < 0 && errno == EINTR)
+        ;
+
+    uint64_t end = now_ns(CLOCK_MONOTONIC);
+    sample_cpu(&c1);
+    sample_net(&n1);
+    sample_latency_hist(h1);
+    atomic_store(&stop, true);
+
+undo_start:
+    for (unsigned i = 0; i < started; ++i)
+        pthread_join(streams[i].thread, NULL);
+
+    if (!err) {
+        FILE *out = opts.output ? fopen(opts.output, "w") : stdout;
+        if (!out) {
+            perror(opts.output);
+            err = -errno;
+        } else {
+            report(out, (end - start) / 1e9, &c0, &c1, &n0, &n1, h0, h1);
+            if (out != stdout)
+                fclose(out);
+        }
+    }
+
+undo_open:
+    for (unsigned i = 0; i < opened; ++i) {
+        snd_pcm_close(streams[i].pcm);
+        free(streams[i].latencies);
+    }
+    free(streams);
+    return err < 0 ? 1 : 0;
+}
+/*============================================================================*/
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Runs cco_bench against cards emulated over a veth pair, e.g.
+#
+#   cco_bench.sh -k 4 -m mmap -t 30 -o /tmp/bench.json
+#
+# All arguments are passed on to cco_bench, see `cco_bench -h`.  The driver is
+# loaded with any module params given in CCO_PARAMS, and mustn't be loaded
+# beforehand.
+
+set -e
+
+# Number of cards to emulate, one per stream
+streams=1
+args=("$@")
+for ((i = 0; i < ${#args[@]}; ++i)); do
+	if [ "${args[i]}" = "-k" ]; then
+		streams="${args[i + 1]}"
+	fi
+done
+
+cleanup()
+{
+	modprobe -r cco 2> /dev/null || true
+	[ -n "${emulator}" ] && kill "${emulator}" 2> /dev/null || true
+	ip link del cco0 2> /dev/null || true
+}
+trap cleanup EXIT
+
+ip link add cco0 type veth peer name cco1
+ip link set cco0 up
+ip link set cco1 up
+
+# The emulator reports what the cards received on exit, kept off stdout
+cco_emulator -i cco1 -n "${streams}" -r 0 >&2 &
+emulator=$!
+
+mount -t debugfs none /sys/kernel/debug 2> /dev/null || true
+modprobe cco intfs=cco0 ${CCO_PARAMS}
+
+# Cards are created as the emulated ones are announced, once a second
+for ((i = 0; i < 10; ++i)); do
+	cards=$(grep -c cuoc_cho_am /proc/asound/cards || true)
+	[ "${cards}" -ge "${streams}" ] && break
+	sleep 1
+done
+if [ "${cards}" -lt "${streams}" ]; then
+	echo "cco_bench.sh: only ${cards} of ${streams} cards appeared" >&2
+	exit 1
+fi
+
+cco_bench "$@"
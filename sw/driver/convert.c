@@ -0,0 +1,459 @@
+#include "convert.h"
+
+#include <linux/cache.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#include <asm/simd.h>
+#endif
+
+#include "log.h"
+#include "protocol.h"
+
+// Note:
+//
+// On the wire, a sample is always a 24-bit big-endian value, either left padded
+// to 4 bytes as { 0x00, hi, mid, lo } (PCM_FORMAT_S24_PADDED) or packed into 3
+// bytes as { hi, mid, lo } (PCM_FORMAT_S24_PACKED).  Every ALSA format we
+// support differs from these only in byte order, width & padding, so converting
+// between the two is a pure byte shuffle:
+//
+//   dst[i] = pattern[i] < 0 ? 0 : src[pattern[i]]
+//
+// which SSSE3's pshufb applies to 4 samples at a time.  Narrower formats are
+// widened with zeroes in the low bits, and wider ones are truncated.
+//
+// Each conversion has a scalar implementation which is used for any samples
+// left over, and in its entirety on CPUs (or in contexts) where SIMD is
+// unavailable.
+//
+// Interleaved frames are de-interleaved by the same shuffle, with the pattern
+// offset to pick out one channel's samples from each frame.  With two
+// channels, the shuffles for both are applied to the same 16 bytes of frames,
+// so each frame is read only once on its way to the wire.
+
+/*===================================Lookup===================================*/
+#define Z (-1)
+
+struct cco_conversion_entry {
+    snd_pcm_format_t format;
+    uint8_t wire_format;
+    struct cco_conversion conv;
+};
+
+static const struct cco_conversion_entry to_wire[] = {
+    { SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PADDED,
+      { "S24_BE -> padded",  4, 4, { Z, 1, 2, 3 } } },
+    { SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PADDED,
+      { "S32_LE -> padded",  4, 4, { Z, 3, 2, 1 } } },
+    { SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PADDED,
+      { "S24_3LE -> padded", 3, 4, { Z, 2, 1, 0 } } },
+    { SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PADDED,
+      { "S16_LE -> padded",  2, 4, { Z, 1, 0, Z } } },
+    { SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PACKED,
+      { "S24_BE -> packed",  4, 3, { 1, 2, 3 } } },
+    { SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PACKED,
+      { "S32_LE -> packed",  4, 3, { 3, 2, 1 } } },
+    { SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PACKED,
+      { "S24_3LE -> packed", 3, 3, { 2, 1, 0 } } },
+    { SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PACKED,
+      { "S16_LE -> packed",  2, 3, { 1, 0, Z } } },
+};
+
+static const struct cco_conversion_entry from_wire[] = {
+    { SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PADDED,
+      { "padded -> S24_BE",  4, 4, { Z, 1, 2, 3 } } },
+    { SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PADDED,
+      { "padded -> S32_LE",  4, 4, { Z, 3, 2, 1 } } },
+    { SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PADDED,
+      { "padded -> S24_3LE", 4, 3, { 3, 2, 1 } } },
+    { SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PADDED,
+      { "padded -> S16_LE",  4, 2, { 2, 1 } } },
+    { SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PACKED,
+      { "packed -> S24_BE",  3, 4, { Z, 0, 1, 2 } } },
+    { SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PACKED,
+      { "packed -> S32_LE",  3, 4, { Z, 2, 1, 0 } } },
+    { SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PACKED,
+      { "packed -> S24_3LE", 3, 3, { 2, 1, 0 } } },
+    { SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PACKED,
+      { "packed -> S16_LE",  3, 2, { 1, 0 } } },
+};
+
+#undef Z
+
+static const struct cco_conversion *
+cco_conversion_lookup(const struct cco_conversion_entry *table, size_t size,
+                      snd_pcm_format_t format, uint8_t wire_format)
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (table[i].format == format && table[i].wire_format == wire_format)
+            return &table[i].conv;
+    }
+
+    return NULL;
+}
+
+const struct cco_conversion *cco_conversion_to_wire(snd_pcm_format_t format,
+                                                    uint8_t wire_format)
+{
+    return cco_conversion_lookup(to_wire, ARRAY_SIZE(to_wire), format,
+                                 wire_format);
+}
+
+const struct cco_conversion *cco_conversion_from_wire(snd_pcm_format_t format,
+                                                      uint8_t wire_format)
+{
+    return cco_conversion_lookup(from_wire, ARRAY_SIZE(from_wire), format,
+                                 wire_format);
+}
+/*============================================================================*/
+
+
+/*===================================Scalar===================================*/
+static void cco_convert_scalar(const struct cco_conversion *conv, u8 *dst,
+                               const u8 *src, unsigned samples)
+{
+    for (unsigned i = 0; i < samples; ++i) {
+        for (unsigned j = 0; j < conv->dst_size; ++j) {
+            int8_t from = conv->pattern[j];
+            dst[j] = from < 0 ? 0 : src[from];
+        }
+        dst += conv->dst_size;
+        src += conv->src_size;
+    }
+}
+
+// De-interleaves frames first up to frames, which hold channels samples each
+static void cco_deinterleave_scalar(const struct cco_conversion *conv,
+                                    u8 *dsts[], const u8 *src,
+                                    unsigned channels, unsigned first,
+                                    unsigned frames)
+{
+    for (unsigned c = 0; c < channels; ++c) {
+        const u8 *in = src + (first * channels + c) * conv->src_size;
+        u8 *out = dsts[c] + first * conv->dst_size;
+        for (unsigned i = first; i < frames; ++i) {
+            for (unsigned j = 0; j < conv->dst_size; ++j) {
+                int8_t from = conv->pattern[j];
+                out[j] = from < 0 ? 0 : in[from];
+            }
+            out += conv->dst_size;
+            in += channels * conv->src_size;
+        }
+    }
+}
+/*============================================================================*/
+
+
+/*====================================SSSE3===================================*/
+#ifdef CONFIG_X86
+static bool cco_convert_use_ssse3(void)
+{
+    return static_cpu_has(X86_FEATURE_SSSE3) && may_use_simd();
+}
+
+// Stores the low bytes of xmm0 to out
+static inline void cco_convert_store_xmm0(u8 *out, unsigned bytes)
+{
+    unsigned tmp;
+
+    switch (bytes) {
+    case 16:
+        asm volatile(
+            "movdqu %%xmm0, (%[out])\n\t"
+            :
+            : [out] "r" (out)
+            : "memory");
+        break;
+    case 12:
+        asm volatile(
+            "movq %%xmm0, (%[out])\n\t"
+            "psrldq $8, %%xmm0\n\t"
+            "movd %%xmm0, 8(%[out])\n\t"
+            :
+            : [out] "r" (out)
+            : "memory");
+        break;
+    case 8:
+        asm volatile(
+            "movq %%xmm0, (%[out])\n\t"
+            :
+            : [out] "r" (out)
+            : "memory");
+        break;
+    case 6:
+        asm volatile(
+            "movd %%xmm0, (%[out])\n\t"
+            "psrldq $4, %%xmm0\n\t"
+            "pextrw $0, %%xmm0, %[tmp]\n\t"
+            "movw %w[tmp], 4(%[out])\n\t"
+            : [tmp] "=&r" (tmp)
+            : [out] "r" (out)
+            : "memory");
+        break;
+    }
+}
+
+// Returns the number of samples converted, the caller handles the remainder
+//
+// Note: the kernel is built without SSE, so the compiler never allocates xmm
+// registers itself and they need not be listed as clobbers
+static unsigned cco_convert_ssse3(const struct cco_conversion *conv, u8 *dst,
+                                  const u8 *src, unsigned samples)
+{
+    // Expand the per-sample pattern into a pshufb mask covering 4 samples
+    u8 mask[16] __aligned(16);
+    memset(mask, 0x80, sizeof(mask));
+    for (unsigned i = 0; i < 4; ++i) {
+        for (unsigned j = 0; j < conv->dst_size; ++j) {
+            int8_t from = conv->pattern[j];
+            if (from >= 0)
+                mask[i * conv->dst_size + j] = i * conv->src_size + from;
+        }
+    }
+
+    // Each iteration loads 16 bytes but may consume fewer, so stop while there
+    // are still 16 bytes left to read
+    unsigned done = 0;
+    kernel_fpu_begin();
+    asm volatile("movdqa %0, %%xmm7" : : "m" (mask));
+    for (; (samples - done) * conv->src_size >= 16; done += 4) {
+        const u8 *in = src + done * conv->src_size;
+        u8 *out = dst + done * conv->dst_size;
+
+        asm volatile(
+            "movdqu (%[in]), %%xmm0\n\t"
+            "pshufb %%xmm7, %%xmm0\n\t"
+            :
+            : [in] "r" (in)
+            : "memory");
+
+        // Store only the 4 samples' worth of bytes produced
+        cco_convert_store_xmm0(out, 4 * conv->dst_size);
+    }
+    kernel_fpu_end();
+
+    return done;
+}
+
+// De-interleaves stereo frames, returns the number converted, the caller
+// handles the remainder
+static unsigned cco_deinterleave_ssse3(const struct cco_conversion *conv,
+                                       u8 *dsts[], const u8 *src,
+                                       unsigned frames)
+{
+    // As many frames as fit in 16 bytes are shuffled at a time, with a mask
+    // for each channel
+    const unsigned frame_size = 2 * conv->src_size;
+    const unsigned step = 16 / frame_size;
+    u8 masks[2][16] __aligned(16);
+    memset(masks, 0x80, sizeof(masks));
+    for (unsigned c = 0; c < 2; ++c) {
+        for (unsigned i = 0; i < step; ++i) {
+            for (unsigned j = 0; j < conv->dst_size; ++j) {
+                int8_t from = conv->pattern[j];
+                if (from >= 0)
+                    masks[c][i * conv->dst_size + j] = i * frame_size +
+                                                       c * conv->src_size +
+                                                       from;
+            }
+        }
+    }
+
+    unsigned done = 0;
+    kernel_fpu_begin();
+    asm volatile("movdqa %0, %%xmm6" : : "m" (masks[0]));
+    asm volatile("movdqa %0, %%xmm7" : : "m" (masks[1]));
+    for (; (frames - done) * frame_size >= 16; done += step) {
+        const u8 *in = src + done * frame_size;
+
+        asm volatile(
+            "movdqu (%[in]), %%xmm0\n\t"
+            "movdqa %%xmm0, %%xmm1\n\t"
+            "pshufb %%xmm6, %%xmm0\n\t"
+            "pshufb %%xmm7, %%xmm1\n\t"
+            :
+            : [in] "r" (in)
+            : "memory");
+        cco_convert_store_xmm0(dsts[0] + done * conv->dst_size,
+                               step * conv->dst_size);
+
+        asm volatile("movdqa %%xmm1, %%xmm0" : : : "memory");
+        cco_convert_store_xmm0(dsts[1] + done * conv->dst_size,
+                               step * conv->dst_size);
+    }
+    kernel_fpu_end();
+
+    return done;
+}
+#endif
+/*============================================================================*/
+
+
+/*=================================Conversion=================================*/
+void cco_convert(const struct cco_conversion *conv, void *dst, const void *src,
+                 unsigned samples)
+{
+    unsigned done = 0;
+
+#ifdef CONFIG_X86
+    if (cco_convert_use_ssse3())
+        done = cco_convert_ssse3(conv, dst, src, samples);
+#endif
+
+    cco_convert_scalar(conv, (u8 *)dst + done * conv->dst_size,
+                       (const u8 *)src + done * conv->src_size,
+                       samples - done);
+}
+
+void cco_convert_deinterleave(const struct cco_conversion *conv, void *dsts[],
+                              const void *src, unsigned channels,
+                              unsigned frames)
+{
+    unsigned done = 0;
+
+#ifdef CONFIG_X86
+    if (channels == 2 && cco_convert_use_ssse3())
+        done = cco_deinterleave_ssse3(conv, (u8 **)dsts, src, frames);
+#endif
+
+    cco_deinterleave_scalar(conv, (u8 **)dsts, src, channels, done, frames);
+}
+/*============================================================================*/
+
+
+/*================================Benchmarking================================*/
+#define CCO_BENCHMARK_ITERATIONS 4096
+
+typedef void (*cco_convert_fn_t)(const struct cco_conversion *conv, u8 *dst,
+                                 const u8 *src, unsigned samples);
+
+#ifdef CONFIG_X86
+static void cco_convert_ssse3_only(const struct cco_conversion *conv, u8 *dst,
+                                   const u8 *src, unsigned samples)
+{
+    unsigned done = cco_convert_ssse3(conv, dst, src, samples);
+    cco_convert_scalar(conv, dst + done * conv->dst_size,
+                       src + done * conv->src_size, samples - done);
+}
+#endif
+
+// Returns average time taken to convert a channel's worth of samples
+static uint64_t cco_convert_time(cco_convert_fn_t fn,
+                                 const struct cco_conversion *conv,
+                                 u8 *dst, const u8 *src)
+{
+    ktime_t start = ktime_get();
+    for (unsigned i = 0; i < CCO_BENCHMARK_ITERATIONS; ++i) {
+        fn(conv, dst, src, CCO_DEFAULT_PERIOD_FRAMES);
+    }
+    ktime_t end = ktime_get();
+
+    return div_u64(ktime_to_ns(ktime_sub(end, start)),
+                   CCO_BENCHMARK_ITERATIONS);
+}
+
+static void cco_convert_benchmark_one(const struct cco_conversion *conv,
+                                      u8 *dst, const u8 *src)
+{
+    uint64_t scalar_ns = cco_convert_time(cco_convert_scalar, conv, dst, src);
+
+    printk(KERN_INFO "cco: convert %-18s scalar=%llu ns", conv->name,
+           scalar_ns);
+#ifdef CONFIG_X86
+    if (cco_convert_use_ssse3()) {
+        uint64_t simd_ns = cco_convert_time(cco_convert_ssse3_only, conv, dst,
+                                            src);
+        printk(KERN_CONT " ssse3=%llu ns", simd_ns);
+    }
+#endif
+    printk(KERN_CONT " (per %d samples)\n", CCO_DEFAULT_PERIOD_FRAMES);
+}
+
+// Returns average time taken to de-interleave a period of stereo frames, which
+// src & dst must each have room for, w/ SIMD if simd is set & available
+static uint64_t cco_deinterleave_time(bool simd,
+                                      const struct cco_conversion *conv,
+                                      u8 *dst, const u8 *src)
+{
+    void *dsts[2] = { dst, dst + CCO_DEFAULT_PERIOD_FRAMES * conv->dst_size };
+    const unsigned frames = CCO_DEFAULT_PERIOD_FRAMES;
+
+    ktime_t start = ktime_get();
+    for (unsigned i = 0; i < CCO_BENCHMARK_ITERATIONS; ++i) {
+        if (simd)
+            cco_convert_deinterleave(conv, dsts, src, 2, frames);
+        else
+            cco_deinterleave_scalar(conv, (u8 **)dsts, src, 2, 0, frames);
+    }
+    ktime_t end = ktime_get();
+
+    return div_u64(ktime_to_ns(ktime_sub(end, start)),
+                   CCO_BENCHMARK_ITERATIONS);
+}
+
+static void
+cco_convert_benchmark_deinterleave(const struct cco_conversion *conv, u8 *dst,
+                                   const u8 *src)
+{
+    uint64_t scalar_ns = cco_deinterleave_time(false, conv, dst, src);
+
+    printk(KERN_INFO "cco: deinterleave %-18s scalar=%llu ns", conv->name,
+           scalar_ns);
+#ifdef CONFIG_X86
+    if (cco_convert_use_ssse3()) {
+        uint64_t simd_ns = cco_deinterleave_time(true, conv, dst, src);
+        printk(KERN_CONT " ssse3=%llu ns", simd_ns);
+    }
+#endif
+    printk(KERN_CONT " (per %d stereo frames)\n", CCO_DEFAULT_PERIOD_FRAMES);
+}
+
+// Times the scalar & SIMD implementations of every conversion, logging results
+void cco_convert_benchmark(void)
+{
+    int err;
+
+    // Room for a period of stereo frames, for de-interleaving
+    const size_t size = CCO_DEFAULT_PERIOD_FRAMES * 2 * 4;
+    u8 *src = kmalloc(size, GFP_KERNEL);
+    u8 *dst = kmalloc(size, GFP_KERNEL);
+    if (!src || !dst) {
+        err = -ENOMEM;
+        goto exit_error;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        src[i] = i;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(to_wire); ++i) {
+        cco_convert_benchmark_one(&to_wire[i].conv, dst, src);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(from_wire); ++i) {
+        cco_convert_benchmark_one(&from_wire[i].conv, dst, src);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(to_wire); ++i) {
+        cco_convert_benchmark_deinterleave(&to_wire[i].conv, dst, src);
+    }
+
+    kfree(dst);
+    kfree(src);
+
+    return;
+
+exit_error:
+    kfree(dst);
+    kfree(src);
+    CCO_LOG_FUNCTION_FAILURE(err);
+}
+/*============================================================================*/
+
+
+#if IS_ENABLED(CONFIG_SND_CCO_KUNIT_TEST)
+#include "convert_kunit.c"
+#endif
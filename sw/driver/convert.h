@@ -0,0 +1,32 @@
+#ifndef CCO_CONVERT_H
+#define CCO_CONVERT_H
+
+#include <linux/types.h>
+#include <sound/pcm.h>
+
+// Describes how each sample is rearranged on its way between an ALSA format
+// and the wire format, see note in convert.c
+struct cco_conversion {
+    const char *name;
+    uint8_t src_size;
+    uint8_t dst_size;
+    int8_t pattern[4];
+};
+
+// Lookup
+const struct cco_conversion *cco_conversion_to_wire(snd_pcm_format_t format,
+                                                    uint8_t wire_format);
+const struct cco_conversion *cco_conversion_from_wire(snd_pcm_format_t format,
+                                                      uint8_t wire_format);
+
+// Conversion
+void cco_convert(const struct cco_conversion *conv, void *dst, const void *src,
+                 unsigned samples);
+void cco_convert_deinterleave(const struct cco_conversion *conv, void *dsts[],
+                              const void *src, unsigned channels,
+                              unsigned frames);
+
+// Benchmarking
+void cco_convert_benchmark(void);
+
+#endif
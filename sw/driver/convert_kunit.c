@@ -0,0 +1,267 @@
+// KUnit tests of convert.c, which includes this file w/
+// CONFIG_SND_CCO_KUNIT_TEST so that its statics can be reached, see Kconfig
+//
+// The SSSE3 paths are checked against the scalar ones, which are checked
+// against known samples.  Where SSSE3 can't be used (e.g. under UML), only the
+// latter run, see .kunitconfig for running the rest under QEMU.
+#include <kunit/test.h>
+#include <linux/prandom.h>
+
+#define CCO_CONVERT_TEST_SEED   0xcc0
+#define CCO_CONVERT_TEST_ROUNDS 64
+
+// Room for the most samples converted at once by the copy path, plus some
+// misalignment
+#define CCO_CONVERT_TEST_SIZE (CCO_MAX_PERIOD_FRAMES * 2 * 4 + 16)
+
+/*===================================Scalar===================================*/
+struct cco_convert_test_sample {
+    bool to_wire;
+    snd_pcm_format_t format;
+    uint8_t wire_format;
+    u8 src[4];
+    u8 dst[4];
+};
+
+static const struct cco_convert_test_sample cco_convert_test_samples[] = {
+    { true,  SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PADDED,
+      { 0x00, 0x12, 0x34, 0x56 }, { 0x00, 0x12, 0x34, 0x56 } },
+    { true,  SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PADDED,
+      { 0x78, 0x56, 0x34, 0x12 }, { 0x00, 0x12, 0x34, 0x56 } },
+    { true,  SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PADDED,
+      { 0x56, 0x34, 0x12 },       { 0x00, 0x12, 0x34, 0x56 } },
+    { true,  SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PADDED,
+      { 0x34, 0x12 },             { 0x00, 0x12, 0x34, 0x00 } },
+    { true,  SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PACKED,
+      { 0x00, 0x12, 0x34, 0x56 }, { 0x12, 0x34, 0x56 } },
+    { true,  SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PACKED,
+      { 0x78, 0x56, 0x34, 0x12 }, { 0x12, 0x34, 0x56 } },
+    { true,  SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PACKED,
+      { 0x56, 0x34, 0x12 },       { 0x12, 0x34, 0x56 } },
+    { true,  SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PACKED,
+      { 0x34, 0x12 },             { 0x12, 0x34, 0x00 } },
+    { false, SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PADDED,
+      { 0x00, 0x12, 0x34, 0x56 }, { 0x00, 0x12, 0x34, 0x56 } },
+    { false, SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PADDED,
+      { 0x00, 0x12, 0x34, 0x56 }, { 0x00, 0x56, 0x34, 0x12 } },
+    { false, SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PADDED,
+      { 0x00, 0x12, 0x34, 0x56 }, { 0x56, 0x34, 0x12 } },
+    { false, SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PADDED,
+      { 0x00, 0x12, 0x34, 0x56 }, { 0x34, 0x12 } },
+    { false, SNDRV_PCM_FORMAT_S24_BE,  PCM_FORMAT_S24_PACKED,
+      { 0x12, 0x34, 0x56 },       { 0x00, 0x12, 0x34, 0x56 } },
+    { false, SNDRV_PCM_FORMAT_S32_LE,  PCM_FORMAT_S24_PACKED,
+      { 0x12, 0x34, 0x56 },       { 0x00, 0x56, 0x34, 0x12 } },
+    { false, SNDRV_PCM_FORMAT_S24_3LE, PCM_FORMAT_S24_PACKED,
+      { 0x12, 0x34, 0x56 },       { 0x56, 0x34, 0x12 } },
+    { false, SNDRV_PCM_FORMAT_S16_LE,  PCM_FORMAT_S24_PACKED,
+      { 0x12, 0x34, 0x56 },       { 0x34, 0x12 } },
+};
+
+// Every conversion looked up turns a known sample into the expected bytes
+static void cco_convert_test_scalar(struct kunit *test)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(cco_convert_test_samples); ++i) {
+        const struct cco_convert_test_sample *sample;
+        sample = &cco_convert_test_samples[i];
+
+        const struct cco_conversion *conv;
+        if (sample->to_wire)
+            conv = cco_conversion_to_wire(sample->format,
+                                          sample->wire_format);
+        else
+            conv = cco_conversion_from_wire(sample->format,
+                                            sample->wire_format);
+        KUNIT_ASSERT_NOT_NULL_MSG(test, conv, "sample %zu", i);
+
+        u8 dst[4] = { 0xa5, 0xa5, 0xa5, 0xa5 };
+        cco_convert_scalar(conv, dst, sample->src, 1);
+        KUNIT_EXPECT_MEMEQ_MSG(test, dst, sample->dst, conv->dst_size,
+                               "%s", conv->name);
+    }
+}
+/*============================================================================*/
+
+
+/*====================================SSSE3===================================*/
+struct cco_convert_test_bufs {
+    u8 *src;
+    u8 *simd;
+    u8 *scalar;
+};
+
+static bool cco_convert_test_use_ssse3(void)
+{
+#ifdef CONFIG_X86
+    return cco_convert_use_ssse3();
+#else
+    return false;
+#endif
+}
+
+static int cco_convert_test_init(struct kunit *test)
+{
+    struct cco_convert_test_bufs *bufs;
+    bufs = kunit_kzalloc(test, sizeof(*bufs), GFP_KERNEL);
+    if (!bufs)
+        return -ENOMEM;
+
+    bufs->src = kunit_kmalloc(test, CCO_CONVERT_TEST_SIZE, GFP_KERNEL);
+    bufs->simd = kunit_kmalloc(test, CCO_CONVERT_TEST_SIZE, GFP_KERNEL);
+    bufs->scalar = kunit_kmalloc(test, CCO_CONVERT_TEST_SIZE, GFP_KERNEL);
+    if (!bufs->src || !bufs->simd || !bufs->scalar)
+        return -ENOMEM;
+
+    test->priv = bufs;
+
+    return 0;
+}
+
+// Both outputs start out the same, so that bytes stored past the end of either
+// also show up as a difference
+static void cco_convert_test_fill(struct cco_convert_test_bufs *bufs,
+                                  struct rnd_state *rnd)
+{
+    prandom_bytes_state(rnd, bufs->src, CCO_CONVERT_TEST_SIZE);
+    memset(bufs->simd, 0xa5, CCO_CONVERT_TEST_SIZE);
+    memset(bufs->scalar, 0xa5, CCO_CONVERT_TEST_SIZE);
+}
+
+// cco_convert() matches the scalar conversion for random sample counts, from
+// & to misaligned buffers
+static void cco_convert_test_ssse3(struct kunit *test)
+{
+    struct cco_convert_test_bufs *bufs = test->priv;
+
+    if (!cco_convert_test_use_ssse3())
+        kunit_skip(test, "SSSE3 unavailable");
+
+    struct rnd_state rnd;
+    prandom_seed_state(&rnd, CCO_CONVERT_TEST_SEED);
+
+    for (size_t i = 0; i < ARRAY_SIZE(to_wire) + ARRAY_SIZE(from_wire); ++i) {
+        const struct cco_conversion *conv;
+        if (i < ARRAY_SIZE(to_wire))
+            conv = &to_wire[i].conv;
+        else
+            conv = &from_wire[i - ARRAY_SIZE(to_wire)].conv;
+
+        for (unsigned round = 0; round < CCO_CONVERT_TEST_ROUNDS; ++round) {
+            unsigned samples = prandom_u32_state(&rnd) %
+                               (CCO_MAX_PERIOD_FRAMES + 1);
+            unsigned src_offset = prandom_u32_state(&rnd) % 16;
+            unsigned dst_offset = prandom_u32_state(&rnd) % 16;
+
+            cco_convert_test_fill(bufs, &rnd);
+            cco_convert(conv, bufs->simd + dst_offset,
+                        bufs->src + src_offset, samples);
+            cco_convert_scalar(conv, bufs->scalar + dst_offset,
+                               bufs->src + src_offset, samples);
+
+            KUNIT_ASSERT_MEMEQ_MSG(test, bufs->simd, bufs->scalar,
+                                   CCO_CONVERT_TEST_SIZE,
+                                   "%s, %u samples at +%u -> +%u",
+                                   conv->name, samples, src_offset,
+                                   dst_offset);
+        }
+    }
+}
+
+// cco_convert_deinterleave() matches the scalar de-interleaving of stereo
+// frames for random frame counts
+static void cco_convert_test_deinterleave_ssse3(struct kunit *test)
+{
+    struct cco_convert_test_bufs *bufs = test->priv;
+
+    if (!cco_convert_test_use_ssse3())
+        kunit_skip(test, "SSSE3 unavailable");
+
+    struct rnd_state rnd;
+    prandom_seed_state(&rnd, CCO_CONVERT_TEST_SEED);
+
+    for (size_t i = 0; i < ARRAY_SIZE(to_wire); ++i) {
+        const struct cco_conversion *conv = &to_wire[i].conv;
+
+        for (unsigned round = 0; round < CCO_CONVERT_TEST_ROUNDS; ++round) {
+            unsigned frames = prandom_u32_state(&rnd) %
+                              (CCO_MAX_PERIOD_FRAMES + 1);
+            unsigned channel_bytes = CCO_MAX_PERIOD_FRAMES * conv->dst_size;
+            void *simd[2] = { bufs->simd, bufs->simd + channel_bytes };
+            u8 *scalar[2] = { bufs->scalar, bufs->scalar + channel_bytes };
+
+            cco_convert_test_fill(bufs, &rnd);
+            cco_convert_deinterleave(conv, simd, bufs->src, 2, frames);
+            cco_deinterleave_scalar(conv, scalar, bufs->src, 2, 0, frames);
+
+            KUNIT_ASSERT_MEMEQ_MSG(test, bufs->simd, bufs->scalar,
+                                   CCO_CONVERT_TEST_SIZE,
+                                   "%s, %u frames", conv->name, frames);
+        }
+    }
+}
+/*============================================================================*/
+
+
+/*================================Benchmarking================================*/
+// Times the conversions of the copy path as cco_convert_benchmark() does, but
+// reports through KUnit
+static void cco_convert_test_benchmark(struct kunit *test)
+{
+    struct cco_convert_test_bufs *bufs = test->priv;
+    bool simd = cco_convert_test_use_ssse3();
+
+    struct rnd_state rnd;
+    prandom_seed_state(&rnd, CCO_CONVERT_TEST_SEED);
+    cco_convert_test_fill(bufs, &rnd);
+
+    for (size_t i = 0; i < ARRAY_SIZE(to_wire) + ARRAY_SIZE(from_wire); ++i) {
+        const struct cco_conversion *conv;
+        if (i < ARRAY_SIZE(to_wire))
+            conv = &to_wire[i].conv;
+        else
+            conv = &from_wire[i - ARRAY_SIZE(to_wire)].conv;
+
+        uint64_t scalar_ns = cco_convert_time(cco_convert_scalar, conv,
+                                              bufs->scalar, bufs->src);
+        uint64_t simd_ns = 0;
+#ifdef CONFIG_X86
+        if (simd)
+            simd_ns = cco_convert_time(cco_convert_ssse3_only, conv,
+                                       bufs->simd, bufs->src);
+#endif
+        kunit_info(test, "convert %-18s scalar=%llu ns ssse3=%llu ns "
+                   "(per %d samples)\n", conv->name, scalar_ns, simd_ns,
+                   CCO_DEFAULT_PERIOD_FRAMES);
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(to_wire); ++i) {
+        const struct cco_conversion *conv = &to_wire[i].conv;
+
+        uint64_t scalar_ns = cco_deinterleave_time(false, conv, bufs->scalar,
+                                                   bufs->src);
+        uint64_t simd_ns = 0;
+        if (simd)
+            simd_ns = cco_deinterleave_time(true, conv, bufs->simd,
+                                            bufs->src);
+        kunit_info(test, "deinterleave %-18s scalar=%llu ns ssse3=%llu ns "
+                   "(per %d stereo frames)\n", conv->name, scalar_ns, simd_ns,
+                   CCO_DEFAULT_PERIOD_FRAMES);
+    }
+}
+/*============================================================================*/
+
+
+static struct kunit_case cco_convert_test_cases[] = {
+    KUNIT_CASE(cco_convert_test_scalar),
+    KUNIT_CASE(cco_convert_test_ssse3),
+    KUNIT_CASE(cco_convert_test_deinterleave_ssse3),
+    KUNIT_CASE_SLOW(cco_convert_test_benchmark),
+    {}
+};
+
+static struct kunit_suite cco_convert_test_suite = {
+    .name = "cco_convert",
+    .init = cco_convert_test_init,
+    .test_cases = cco_convert_test_cases,
+};
+kunit_test_suites(&cco_convert_test_suite);
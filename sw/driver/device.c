@@ -1,8 +1,15 @@
 #include "device.h"
 
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/etherdevice.h>
+#include <linux/hashtable.h>
 #include <linux/if_ether.h>
+#include <linux/jhash.h>
 #include <linux/kfifo.h>
+#include <linux/moduleparam.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <sound/pcm.h>
 
@@ -17,6 +24,11 @@
 // Full definition is at the bottom of "Driver management" section
 static struct platform_driver cco_driver;
 
+// See note in "Debugfs" section
+static struct dentry *debugfs_root;
+// Full definition is in "Debugfs" section
+static const struct file_operations cco_drops_fops;
+
 int cco_register_driver(void)
 {
     int err;
@@ -27,6 +39,10 @@ int cco_register_driver(void)
         goto exit_error;
     }
 
+    // Note: debugfs is best effort, its functions cope w/ a missing parent
+    debugfs_root = debugfs_create_dir("cco", NULL);
+    debugfs_create_file("drops", 0444, debugfs_root, NULL, &cco_drops_fops);
+
     return 0;
 
 exit_error:
@@ -36,6 +52,9 @@ exit_error:
 
 void cco_unregister_driver(void)
 {
+    debugfs_remove_recursive(debugfs_root);
+    debugfs_root = NULL;
+
     if (driver_find(cco_driver.driver.name, &platform_bus_type))
         platform_driver_unregister(&cco_driver);
 }
@@ -173,19 +192,106 @@ static void cco_release_device(struct device *dev)
 /*============================================================================*/
 
 
+/*==================================Debugfs===================================*/
+// Note:
+//
+// Each session gets a dir at /sys/kernel/debug/cco/sessionN, where N is the
+// session's id.  Its stats file shows the packet counters of the session, and
+// once the handshake completes, the PCM stats of its device.  This is the only
+// place they're shown, /proc/asound/cardN/cco_stats merely points here.
+//
+// Frames are dropped before their session is known, so the drop counts are
+// shared by every session, at /sys/kernel/debug/cco/drops.
+//
+// The dir is removed before the session's device is unregistered, which waits
+// out any reader of the file.
+static int cco_session_stats_show(struct seq_file *m, void *v)
+{
+    struct cco_session *session = m->private;
+    struct cco_session_stats *stats = &session->stats;
+
+    seq_printf(m, "session:\n");
+    seq_printf(m, "  xmit_success:           %lld\n",
+               atomic64_read(&stats->xmit_success));
+    seq_printf(m, "  xmit_drop:              %lld\n",
+               atomic64_read(&stats->xmit_drop));
+    seq_printf(m, "  xmit_cn:                %lld\n",
+               atomic64_read(&stats->xmit_cn));
+    seq_printf(m, "  xmit_busy:              %lld\n",
+               atomic64_read(&stats->xmit_busy));
+    seq_printf(m, "  alloc_failures:         %lld\n",
+               atomic64_read(&stats->alloc_failures));
+    seq_printf(m, "  fpga_lost_periods:      %lld\n",
+               atomic64_read(&stats->fpga_lost_periods));
+
+    struct cco_device *dev = smp_load_acquire(&session->dev);
+    if (dev)
+        cco_pcm_stats_show(m, dev);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cco_session_stats);
+
+static int cco_drops_show(struct seq_file *m, void *v)
+{
+    for (unsigned i = 0; i < CCO_DROP_COUNT; ++i)
+        seq_printf(m, "%s:%*s%ld\n", cco_drop_names[i],
+                   (int)(25 - strlen(cco_drop_names[i])), "",
+                   atomic_long_read(&cco_drops[i]));
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cco_drops);
+
+static void cco_session_debugfs_init(struct cco_session *session)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "session%d", session->id);
+    session->debugfs = debugfs_create_dir(name, debugfs_root);
+    debugfs_create_file("stats", 0444, session->debugfs, session,
+                        &cco_session_stats_fops);
+}
+
+static void cco_session_debugfs_exit(struct cco_session *session)
+{
+    debugfs_remove_recursive(session->debugfs);
+    session->debugfs = NULL;
+}
+/*============================================================================*/
+
+
 /*=============================Session management=============================*/
+// Note:
+//
+// Every packet received looks up its session from softirq, so sessions are
+// also kept in a hash table keyed by (MAC, generation_id) that is read under
+// RCU.  Sessions are only ever created & closed by the session manager kthread
+// (or once it has stopped, by cco_close_sessions()), so writers need no lock.
+//
+// A closed session is unhashed, then freed after a grace period.  Its
+// cco_device is unregistered only once packets that may still be using it have
+// been handled, since those reach the device through session->dev.
+//
+// sessions[] holds the same sessions by id, for the session manager to iterate.
+#define SESSION_TABLE_BITS 6
+
 static struct cco_session *sessions[SNDRV_CARDS];
+static DEFINE_HASHTABLE(session_table, SESSION_TABLE_BITS);
 
 static struct task_struct *sm_task;
 
-struct cco_session *cco_get_session(unsigned char *mac, uint8_t generation_id)
+static u32 cco_session_hash(const unsigned char *mac, uint8_t generation_id)
 {
-    for (unsigned i = 0; i < ARRAY_SIZE(sessions); ++i) {
-        struct cco_session *session = sessions[i];
-        if (!session)
-            continue;
+    return jhash(mac, ETH_ALEN, generation_id);
+}
 
-        if (memcmp(session->mac, mac, ETH_ALEN) == 0 &&
+struct cco_session *cco_get_session(unsigned char *mac, uint8_t generation_id)
+{
+    struct cco_session *session;
+    hash_for_each_possible_rcu(session_table, session, node,
+                               cco_session_hash(mac, generation_id))
+    {
+        if (ether_addr_equal(session->mac, mac) &&
             session->generation_id == generation_id)
             return session;
     }
@@ -194,7 +300,8 @@ struct cco_session *cco_get_session(unsigned char *mac, uint8_t generation_id)
 }
 
 static struct cco_session *
-cco_create_session(unsigned char *mac, uint8_t generation_id)
+cco_create_session(struct net_device *netdev, unsigned char *mac,
+                   uint8_t generation_id)
 {
     for (unsigned i = 0; i < ARRAY_SIZE(sessions); ++i) {
         struct cco_session *session = sessions[i];
@@ -202,7 +309,10 @@ cco_create_session(unsigned char *mac, uint8_t generation_id)
             continue;
 
         session = kzalloc(sizeof(*session), GFP_KERNEL);
+        if (!session)
+            return NULL;
         session->id = i;
+        session->netdev = netdev;
         memcpy(session->mac, mac, ETH_ALEN);
         session->generation_id = generation_id;
 
@@ -210,10 +320,13 @@ cco_create_session(unsigned char *mac, uint8_t generation_id)
         session->ts_last_recv = now;
         session->ts_last_send = now;
 
-        printk(KERN_INFO "cco: [%pM, %d]: session opened\n",
-               session->mac, session->generation_id);
+        printk(KERN_INFO "cco: [%pM, %d]: session opened on %s\n",
+               session->mac, session->generation_id, netdev->name);
 
         sessions[i] = session;
+        hash_add_rcu(session_table, &session->node,
+                     cco_session_hash(mac, generation_id));
+        cco_session_debugfs_init(session);
         return session;
     }
 
@@ -222,12 +335,14 @@ cco_create_session(unsigned char *mac, uint8_t generation_id)
 
 static void cco_close_session(struct cco_session *session, const char *reason)
 {
-    for (unsigned i = 0; i < ARRAY_SIZE(sessions); ++i) {
-        if (sessions[i] == session)
-            sessions[i] = NULL;
-    }
+    sessions[session->id] = NULL;
+    hash_del_rcu(&session->node);
+    cco_session_debugfs_exit(session);
 
     if (session->dev) {
+        // Wait out packets still being handled on the device
+        synchronize_rcu();
+
         // Note: kfree of cco_device occurs in cco_release_device()
         cco_unregister_device(session->dev);
     }
@@ -239,7 +354,7 @@ static void cco_close_session(struct cco_session *session, const char *reason)
     }
     printk(KERN_CONT "\n");
 
-    kfree(session);
+    kfree_rcu(session, rcu);
 }
 
 void cco_close_sessions(void)
@@ -253,6 +368,148 @@ void cco_close_sessions(void)
     }
 }
 
+static bool packed_format = true;
+module_param(packed_format, bool, 0444);
+MODULE_PARM_DESC(packed_format,
+                 "Negotiate 3-byte samples on the wire with bitstreams that "
+                 "support it (default Y)");
+
+static unsigned period_frames = CCO_DEFAULT_PERIOD_FRAMES;
+module_param(period_frames, uint, 0444);
+MODULE_PARM_DESC(period_frames,
+                 "Frames per period on the wire, one of 16, 32, 64, 128 or 256, "
+                 "with bitstreams that support it, see note in protocol.h "
+                 "(default 128)");
+
+// Picks the index of the frames per period to request out of those supported
+static uint8_t select_period_frames(uint8_t caps)
+{
+    for (uint8_t n = 0; n < PCM_PERIOD_FRAMES_COUNT; ++n) {
+        if (PCM_PERIOD_FRAMES(n) == period_frames &&
+            (caps & PCM_PERIOD_FRAMES_CAP(n)))
+            return n;
+    }
+
+    printk(KERN_WARNING "cco: period_frames=%u unsupported by FPGA, using "
+           "%d\n", period_frames, CCO_DEFAULT_PERIOD_FRAMES);
+    return CCO_DEFAULT_PERIOD_FRAMES_INDEX;
+}
+
+// Records the PCM data formats, channel count, frames per period & rates
+// advertised in an announce msg, and picks the ones to request in our handshake
+static int handle_announce(struct cco_session *session, struct sk_buff *skb)
+{
+    session->pcm_formats = 0;
+    session->pcm_format = PCM_FORMAT_S24_PADDED;
+    session->pcm_channels = 0;
+    session->pcm_period_frames_caps = 0;
+    session->pcm_period_frames = CCO_DEFAULT_PERIOD_FRAMES_INDEX;
+    session->pcm_rates = 0;
+
+    // Bitstreams predating format negotiation send the 1-byte form
+    unsigned len = get_cco_payload_len(skb);
+    if (len == sizeof(SessionCtlMsg_t))
+        return 0;
+
+    // Note: fields past pcm_formats are only present in the longer forms
+    SessionCtlRatesMsg_t *caps_msg;
+    caps_msg = (SessionCtlRatesMsg_t *)get_cco_msg(skb)->payload;
+    session->pcm_formats = caps_msg->pcm_formats |
+                           PCM_FORMAT_CAP(PCM_FORMAT_S24_PADDED);
+
+    if (packed_format &&
+        (session->pcm_formats & PCM_FORMAT_CAP(PCM_FORMAT_S24_PACKED)))
+        session->pcm_format = PCM_FORMAT_S24_PACKED;
+
+    // Bitstreams predating channel negotiation send the 2-byte form
+    if (len < sizeof(SessionCtlChannelsMsg_t))
+        return 0;
+
+    if (caps_msg->channels == 0 || caps_msg->channels > CCO_MAX_CHANNELS) {
+        printk(KERN_ERR "cco: FPGA announced unsupported channel count %d\n",
+               caps_msg->channels);
+        return -EINVAL;
+    }
+    session->pcm_channels = caps_msg->channels;
+
+    // Bitstreams predating period negotiation send the 3-byte form
+    if (len < sizeof(SessionCtlPeriodMsg_t))
+        return 0;
+
+    session->pcm_period_frames_caps =
+        caps_msg->period_frames |
+        PCM_PERIOD_FRAMES_CAP(CCO_DEFAULT_PERIOD_FRAMES_INDEX);
+    session->pcm_period_frames =
+        select_period_frames(session->pcm_period_frames_caps);
+
+    // Bitstreams predating rate negotiation send the 4-byte form
+    if (len < sizeof(SessionCtlRatesMsg_t))
+        return 0;
+
+    session->pcm_rates = caps_msg->rates | PCM_RATE_CAP(CCO_DEFAULT_RATE);
+
+    return 0;
+}
+
+// Settles on the PCM data format echoed back by the FPGA, and lays out PCM
+// data msgs accordingly
+static int handle_handshake_response(struct cco_session *session,
+                                     struct sk_buff *skb)
+{
+    // Note: fields past msg_type are only present in the longer forms
+    unsigned len = get_cco_payload_len(skb);
+    SessionCtlPeriodMsg_t *caps_msg;
+    caps_msg = (SessionCtlPeriodMsg_t *)get_cco_msg(skb)->payload;
+
+    session->pcm_format = PCM_FORMAT_S24_PADDED;
+    if (len >= sizeof(SessionCtlCapsMsg_t)) {
+        if (caps_msg->pcm_formats == PCM_FORMAT_S24_PADDED ||
+            caps_msg->pcm_formats == PCM_FORMAT_S24_PACKED)
+            session->pcm_format = caps_msg->pcm_formats;
+        else
+            printk(KERN_ERR "cco: FPGA selected unknown PCM format %d, "
+                   "falling back to padded\n", caps_msg->pcm_formats);
+    }
+
+    // The channel count was fixed by the announce, the FPGA must agree on it
+    uint8_t expected = session->pcm_channels ?: CCO_DEFAULT_CHANNELS;
+    uint8_t channels = CCO_DEFAULT_CHANNELS;
+    if (len >= sizeof(SessionCtlChannelsMsg_t))
+        channels = caps_msg->channels;
+    if (channels != expected) {
+        printk(KERN_ERR "cco: FPGA responded w/ %d channels, expected %d\n",
+               channels, expected);
+        return -EINVAL;
+    }
+
+    // As must the frames per period we requested
+    uint8_t frames_index = CCO_DEFAULT_PERIOD_FRAMES_INDEX;
+    if (len == sizeof(SessionCtlPeriodMsg_t))
+        frames_index = caps_msg->period_frames;
+    if (frames_index != session->pcm_period_frames) {
+        printk(KERN_ERR "cco: FPGA responded w/ period frames index %d, "
+               "expected %d\n", frames_index, session->pcm_period_frames);
+        return -EINVAL;
+    }
+
+    pcm_layout_init(&session->pcm_layout, session->pcm_format, channels,
+                    PCM_PERIOD_FRAMES(frames_index));
+
+    return 0;
+}
+
+// Records the count of playback periods lost carried by extended heartbeats
+static void handle_heartbeat(struct cco_session *session, struct sk_buff *skb)
+{
+    if (get_cco_payload_len(skb) != sizeof(SessionCtlLossMsg_t))
+        return;
+
+    SessionCtlLossMsg_t *loss_msg;
+    loss_msg = (SessionCtlLossMsg_t *)get_cco_msg(skb)->payload;
+    atomic64_set(&session->stats.fpga_lost_periods,
+                 ntohl(loss_msg->lost_periods));
+}
+
 static void handle_session_ctl_msg(struct sk_buff *skb)
 {
     // Extract sections of the packet
@@ -260,10 +517,15 @@ static void handle_session_ctl_msg(struct sk_buff *skb)
     Msg_t *msg = get_cco_msg(skb);
 
     // Locate or create session
+    //
+    // Note: only we close sessions, so it stays valid past the RCU section
     struct cco_session *session;
+    rcu_read_lock();
     session = cco_get_session(hdr->h_source, msg->generation_id);
+    rcu_read_unlock();
     if (!session) {
-        session = cco_create_session(hdr->h_source, msg->generation_id);
+        session = cco_create_session(skb->dev, hdr->h_source,
+                                     msg->generation_id);
         if (!session) {
             printk(KERN_ERR "cco: failed to open session for mac=%pM, "
                    "gen_id=%d\n", hdr->h_source, msg->generation_id);
@@ -274,10 +536,31 @@ static void handle_session_ctl_msg(struct sk_buff *skb)
     SessionCtlMsg_t *session_msg = (SessionCtlMsg_t *)msg->payload;
     switch (session_msg->msg_type) {
     case SESSION_CTL_ANNOUNCE:
+        // Negotiation is settled once the device is bound, and it's running
+        // with the channel count & layout picked, so ignore announces resent
+        if (session->dev)
+            break;
+
+        if (handle_announce(session, skb) < 0) {
+            send_close(session);
+            cco_close_session(session, "unsupported announce");
+            return;
+        }
         send_handshake_request(session);
         break;
 
     case SESSION_CTL_HANDSHAKE_RESPONSE:
+        // As with announces, a response resent once bound changes nothing
+        if (session->dev)
+            break;
+
+        // Layout must be settled before the device starts exchanging PCM data
+        if (handle_handshake_response(session, skb) < 0) {
+            send_close(session);
+            cco_close_session(session, "handshake mismatch");
+            return;
+        }
+
         struct cco_device *dev = cco_register_device(session);
         if (!dev) {
             send_close(session);
@@ -286,7 +569,12 @@ static void handle_session_ctl_msg(struct sk_buff *skb)
         }
         printk(KERN_ERR "cco: [%pM, %d]: device created w/ id=%d\n",
                hdr->h_source, msg->generation_id, session->id);
-        session->dev = dev;
+        // Publish the fully registered device to softirq
+        smp_store_release(&session->dev, dev);
+        break;
+
+    case SESSION_CTL_HEARTBEAT:
+        handle_heartbeat(session, skb);
         break;
 
     case SESSION_CTL_CLOSE:
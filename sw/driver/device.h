@@ -1,10 +1,14 @@
 #ifndef CCO_DEVICE_H
 #define CCO_DEVICE_H
 
+#include <linux/atomic.h>
 #include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/netdevice.h>
 #include <linux/platform_device.h>
 #include <linux/skbuff.h>
 #include <linux/timekeeping.h>
+#include <linux/wait.h>
 #include <sound/core.h>
 
 #include "mixer.h"
@@ -15,6 +19,7 @@ struct cco_device {
     struct snd_card *card;
 
     struct task_struct *pcm_manager_task;
+    wait_queue_head_t pcm_manager_wq;
     struct cco_pcm playback;
     struct cco_pcm capture;
 
@@ -23,13 +28,63 @@ struct cco_device {
     struct cco_session *session;
 };
 
+// Counted on every packet of a session, shown in its debugfs dir along with its
+// device's PCM stats
+struct cco_session_stats {
+    // Results of handing packets to the qdisc, or to the driver directly
+    atomic64_t xmit_success; /* NET_XMIT_SUCCESS */
+    atomic64_t xmit_drop;    /* NET_XMIT_DROP */
+    atomic64_t xmit_cn;      /* NET_XMIT_CN */
+    atomic64_t xmit_busy;    /* NETDEV_TX_BUSY, or any other failure */
+
+    // sk_buff's or periods that couldn't be allocated
+    atomic64_t alloc_failures;
+
+    // Playback periods the FPGA found missing, as of its last heartbeat
+    atomic64_t fpga_lost_periods;
+};
+
 struct cco_session {
     struct cco_device *dev;
     int id;
+
+    // Entry in the session table, see note in device.c
+    struct hlist_node node;
+    struct rcu_head rcu;
+
     unsigned char mac[ETH_ALEN];
     uint8_t generation_id;
+
+    // Interface the FPGA announced itself on, which all our packets go out of
+    struct net_device *netdev;
+
+    // PCM data formats supported by the FPGA, and the one negotiated with it
+    uint8_t pcm_formats;
+    uint8_t pcm_format;
+
+    // Channels carried by the FPGA, 0 if it didn't announce a count
+    uint8_t pcm_channels;
+
+    // Frames per period supported by the FPGA (0 if it didn't announce any),
+    // and the index n of the PCM_PERIOD_FRAMES(n) negotiated with it
+    uint8_t pcm_period_frames_caps;
+    uint8_t pcm_period_frames;
+
+    // Rates supported by the FPGA, 0 if it didn't announce any
+    uint8_t pcm_rates;
+
+    // Layout of PCM data msgs, settled once the handshake completes
+    struct cco_pcm_layout pcm_layout;
+
     ktime_t ts_last_recv;
     ktime_t ts_last_send;
+
+    // PCM data msgs were left in the qdisc by packet_send_batch(), which only
+    // sends directly again once it has drained
+    bool xmit_queued;
+
+    struct cco_session_stats stats;
+    struct dentry *debugfs;
 };
 
 #define pdev_to_cco(pdev) container_of((pdev), struct cco_device, pdev)
@@ -40,6 +95,9 @@ int cco_register_driver(void);
 void cco_unregister_driver(void);
 
 // Session management
+//
+// Note: cco_get_session() must be called in an RCU read-side critical section,
+// see note in device.c
 struct cco_session *cco_get_session(unsigned char *mac, uint8_t generation_id);
 void cco_close_sessions(void);
 int cco_session_manager_init(void);
@@ -2,24 +2,77 @@
 
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <linux/if_vlan.h>
 #include <linux/ip.h> 
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/netdevice.h>
+#include <linux/pkt_sched.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/timekeeping.h>
+#include <net/sch_generic.h>
 
 #include "device.h"
 #include "log.h"
+#include "pcm.h"
 #include "protocol.h"
+#include "trace.h"
 
 /*===============================Initialization===============================*/
-const char *intf_name = "eth0";
-struct net_device *netdev = NULL;
-
-static struct packet_type *proto;
+// Note:
+//
+// FPGAs are looked for on every interface listed in intfs, each of which gets
+// a receive handler of its own.  A session is bound to the interface its FPGA
+// announced itself on, and every packet of the session is sent out of it.
+#define CCO_MAX_INTFS 8
+
+static char *intfs[CCO_MAX_INTFS] = { "eth0" };
+static int num_intfs = 1;
+module_param_array(intfs, charp, &num_intfs, 0444);
+MODULE_PARM_DESC(intfs,
+                 "Comma-separated list of interfaces to look for FPGAs on "
+                 "(default eth0)");
+
+// Note:
+//
+// cco frames are sent with EtherType ethertype, so the stack dispatches only
+// our frames to packet_recv() rather than every 802.2 LLC frame on the wire,
+// see protocol.h for the framing.  With ethertype=0, 802.3 frames are used
+// instead, where the length takes the place of the EtherType, for FPGAs whose
+// bitstream predates CCO_ETHERTYPE.
+//
+// Frames of one FPGA arrive in order only if they land on the same RX queue.
+// NICs hash frames they can't parse onto queue 0 at best, so cco frames
+// should be steered to a queue explicitly, with ethtool's ntuple filters:
+//
+//   ethtool -K eth0 ntuple on
+//   ethtool -N eth0 flow-type ether proto 0x88b5 action <queue>
+//
+// and that queue's IRQ pinned to a CPU through /proc/irq/<irq>/smp_affinity.
+// check_rx_steering() warns about interfaces that can't do this.
+static ushort ethertype = CCO_ETHERTYPE;
+module_param(ethertype, ushort, 0444);
+MODULE_PARM_DESC(ethertype,
+                 "EtherType of cco frames, 0 for 802.3 framing "
+                 "(default 0x88B5)");
+
+struct cco_intf {
+    struct net_device *netdev;
+    struct packet_type proto;
+    int tx_queue; /* tx_queue if the intf has it, else -1 */
+};
+
+static struct cco_intf cco_intfs[CCO_MAX_INTFS];
+static unsigned num_cco_intfs;
+
+// Defined in "Packet sending" section
+static int check_tx_params(void);
+static int check_tx_queue(struct net_device *netdev);
 
 // Defined in "Packet receiving" section
+static void check_rx_steering(struct net_device *netdev);
 static int packet_recv(struct sk_buff *skb, struct net_device *dev,
                        struct packet_type *pt, struct net_device *orig_dev);
 
@@ -27,31 +80,40 @@ int cco_ethernet_init(void)
 {
     int err;
 
-    // Search for the interface we plan to use for communication with the FPGA
-    netdev = dev_get_by_name(&init_net, intf_name);
-    if (!netdev) {
-        printk(KERN_ERR "cco: unable to find intf \"%s\"\n", intf_name);
-        err = -ENODEV;
-        goto exit_error;
-    }
-
     INIT_KFIFO(session_ctl_fifo);
+    err = check_tx_params();
+    if (err < 0)
+        goto exit_error;
 
-    proto = kzalloc(sizeof(*proto), GFP_KERNEL);
-    if (!proto) {
-        err = -ENOMEM;
-        goto undo_select_net_dev;
+    // Search for the interfaces we plan to use for communication with FPGAs,
+    // skipping any that don't exist
+    for (int i = 0; i < num_intfs; ++i) {
+        struct net_device *netdev = dev_get_by_name(&init_net, intfs[i]);
+        if (!netdev) {
+            printk(KERN_WARNING "cco: unable to find intf \"%s\"\n",
+                   intfs[i]);
+            continue;
+        }
+
+        check_rx_steering(netdev);
+
+        struct cco_intf *intf = &cco_intfs[num_cco_intfs++];
+        intf->netdev = netdev;
+        intf->tx_queue = check_tx_queue(netdev);
+        intf->proto.type = htons(ethertype ? ethertype : ETH_P_802_2);
+        intf->proto.dev = netdev;
+        intf->proto.func = packet_recv;
+        dev_add_pack(&intf->proto);
     }
 
-    proto->type = htons(ETH_P_802_2);
-    proto->dev = netdev;
-    proto->func = packet_recv;
-    dev_add_pack(proto);
+    if (!num_cco_intfs) {
+        printk(KERN_ERR "cco: none of the intfs given were found\n");
+        err = -ENODEV;
+        goto exit_error;
+    }
 
     return 0;
 
-undo_select_net_dev:
-    netdev = NULL;
 exit_error:
     CCO_LOG_FUNCTION_FAILURE(err);
     return err;
@@ -59,30 +121,186 @@ exit_error:
 
 void cco_ethernet_exit(void)
 {
-    if (proto) {
-        dev_remove_pack(proto);
-        proto = NULL;
+    for (unsigned i = 0; i < num_cco_intfs; ++i) {
+        dev_remove_pack(&cco_intfs[i].proto);
+        dev_put(cco_intfs[i].netdev);
+        cco_intfs[i].netdev = NULL;
+    }
+    num_cco_intfs = 0;
+
+    // The session manager is stopped before our handlers are removed, so free
+    // any session ctl msgs received in between
+    //
+    // Note: dev_remove_pack() waits out handlers still running
+    struct sk_buff *skb;
+    while (kfifo_get(&session_ctl_fifo, &skb)) {
+        kfree_skb(skb);
     }
 }
 /*============================================================================*/
 
 
 /*===============================Packet sending===============================*/
+// Note:
+//
+// Bulk traffic sharing the NIC with us (backups, scp, ...) can queue ahead of
+// PCM data msgs and starve the FPGA.  To keep tail latency down, every cco
+// packet is marked so it can be told apart:
+//
+//   - skb->priority is set to tx_priority.  With an mqprio qdisc mapping it to
+//     its own traffic class, this alone steers cco packets to a hardware tx
+//     queue of their own.
+//
+//   - tx_queue pins cco packets to a hardware tx queue directly.  The qdisc
+//     picks queues by itself, so this only takes effect where the qdisc is
+//     bypassed: for batched PCM data msgs (see xmit_batch), and for every
+//     packet with qdisc_bypass.
+//
+//   - With vlan_id set, packets are 802.1Q tagged with vlan_pcp as priority,
+//     for switches to prioritize them.  The FPGA doesn't understand tags, so
+//     the last switch before it must strip them.  On NICs that can't insert
+//     tags themselves, PCM data sk_buff's aren't recycled, see
+//     can_recycle_pcm_data().
+//
+// qdisc_bypass sends every cco packet straight to the driver, as pktgen does.
+// Packets that find the hardware queue full are dropped rather than queued.
+static unsigned tx_priority = TC_PRIO_INTERACTIVE;
+module_param(tx_priority, uint, 0644);
+MODULE_PARM_DESC(tx_priority,
+                 "skb->priority of cco packets, for mapping to a traffic "
+                 "class (default 6, TC_PRIO_INTERACTIVE)");
+
+static int tx_queue = -1;
+module_param(tx_queue, int, 0444);
+MODULE_PARM_DESC(tx_queue,
+                 "Hardware tx queue to pin cco packets to wherever the qdisc "
+                 "is bypassed, -1 to let the stack pick (default -1)");
+
+static int vlan_id = -1;
+module_param(vlan_id, int, 0444);
+MODULE_PARM_DESC(vlan_id,
+                 "802.1Q VLAN to tag cco packets with, -1 to send them "
+                 "untagged (default -1)");
+
+static unsigned vlan_pcp = 5;
+module_param(vlan_pcp, uint, 0444);
+MODULE_PARM_DESC(vlan_pcp,
+                 "802.1Q priority code point of tagged cco packets (default "
+                 "5)");
+
+static bool qdisc_bypass = false;
+module_param(qdisc_bypass, bool, 0644);
+MODULE_PARM_DESC(qdisc_bypass,
+                 "Send every cco packet straight to the NIC driver, dropping "
+                 "it if the tx queue is full (default N)");
+
+// Returns -EINVAL if tx_queue or vlan_id are out of range, as values below -1
+// would otherwise pass for -1 wherever they're checked
+static int check_tx_params(void)
+{
+    if (tx_queue < -1) {
+        printk(KERN_ERR "cco: invalid tx_queue %d\n", tx_queue);
+        return -EINVAL;
+    }
+
+    if (vlan_id < -1 || vlan_id >= VLAN_N_VID - 1) {
+        printk(KERN_ERR "cco: invalid vlan_id %d\n", vlan_id);
+        return -EINVAL;
+    }
+
+    if (vlan_pcp > 7) {
+        printk(KERN_WARNING "cco: invalid vlan_pcp %u, using 5\n", vlan_pcp);
+        vlan_pcp = 5;
+    }
+
+    return 0;
+}
+
+// Returns the tx queue to pin packets sent out of netdev to, -1 to let the
+// stack pick
+//
+// Note: intfs are checked one by one, so that one lacking tx_queue doesn't
+// turn pinning off on the others
+static int check_tx_queue(struct net_device *netdev)
+{
+    if (tx_queue >= (int)netdev->real_num_tx_queues) {
+        printk(KERN_WARNING "cco: intf \"%s\" has no tx queue %d, letting "
+               "the stack pick\n", netdev->name, tx_queue);
+        return -1;
+    }
+
+    return tx_queue;
+}
+
+// Tx queue checked for netdev by check_tx_queue()
+static int intf_tx_queue(struct net_device *netdev)
+{
+    for (unsigned i = 0; i < num_cco_intfs; ++i) {
+        if (cco_intfs[i].netdev == netdev)
+            return cco_intfs[i].tx_queue;
+    }
+
+    return -1;
+}
+
+// Applies the marks described above
+static void mark_cco_packet(struct sk_buff *skb)
+{
+    skb->priority = tx_priority;
+
+    int queue = intf_tx_queue(skb->dev);
+    if (queue >= 0)
+        skb_set_queue_mapping(skb, queue);
+
+    if (vlan_id >= 0)
+        __vlan_hwaccel_put_tag(skb, htons(ETH_P_8021Q),
+                               vlan_id | (vlan_pcp << VLAN_PRIO_SHIFT));
+}
+
+// Picks the hardware tx queue skb goes out on when bypassing the qdisc
+static struct netdev_queue *pick_tx_queue(struct sk_buff *skb)
+{
+    int queue = intf_tx_queue(skb->dev);
+    if (queue >= 0)
+        return netdev_get_tx_queue(skb->dev, queue);
+
+    return netdev_core_pick_tx(skb->dev, skb, NULL);
+}
+
 static int create_cco_packet(struct cco_session *session, uint8_t msg_type,
+                             unsigned payload_len, unsigned paged_len,
                              struct sk_buff **skb_out);
 
 int send_handshake_request(struct cco_session *session)
 {
     int err;
 
+    // Only bitstreams that announced their formats (channel count & frames per
+    // period) understand the extended handshake requests, see note in
+    // protocol.h
+    unsigned len = sizeof(SessionCtlMsg_t);
+    if (session->pcm_period_frames_caps)
+        len = sizeof(SessionCtlPeriodMsg_t);
+    else if (session->pcm_channels)
+        len = sizeof(SessionCtlChannelsMsg_t);
+    else if (session->pcm_formats)
+        len = sizeof(SessionCtlCapsMsg_t);
+
     struct sk_buff *skb;
-    err = create_cco_packet(session, SESSION_CTL, &skb);
+    err = create_cco_packet(session, SESSION_CTL, len, 0, &skb);
     if (err < 0)
         goto exit_error;
 
-    SessionCtlMsg_t *msg;
-    msg = (SessionCtlMsg_t *)skb_put(skb, sizeof(SessionCtlMsg_t));
+    // Note: each form of the request is a prefix of SessionCtlPeriodMsg_t
+    SessionCtlPeriodMsg_t *msg;
+    msg = (SessionCtlPeriodMsg_t *)skb_put(skb, len);
     msg->msg_type = SESSION_CTL_HANDSHAKE_REQUEST;
+    if (len >= sizeof(SessionCtlCapsMsg_t))
+        msg->pcm_formats = session->pcm_format;
+    if (len >= sizeof(SessionCtlChannelsMsg_t))
+        msg->channels = session->pcm_channels;
+    if (len >= sizeof(SessionCtlPeriodMsg_t))
+        msg->period_frames = session->pcm_period_frames;
 
     err = packet_send(session, skb);
     if (err < 0)
@@ -99,14 +317,27 @@ int send_heartbeat(struct cco_session *session)
 {
     int err;
 
+    // Only bitstreams that announced their rates understand the extended
+    // heartbeat, see note in protocol.h
+    bool with_loss = session->pcm_rates != 0;
+    unsigned len = with_loss ? sizeof(SessionCtlLossMsg_t)
+                             : sizeof(SessionCtlMsg_t);
+
     struct sk_buff *skb;
-    err = create_cco_packet(session, SESSION_CTL, &skb);
+    err = create_cco_packet(session, SESSION_CTL, len, 0, &skb);
     if (err < 0)
         goto exit_error;
 
-    SessionCtlMsg_t *msg;
-    msg = (SessionCtlMsg_t *)skb_put(skb, sizeof(SessionCtlMsg_t));
+    // Note: SessionCtlLossMsg_t only extends SessionCtlMsg_t with the count
+    SessionCtlLossMsg_t *msg;
+    msg = (SessionCtlLossMsg_t *)skb_put(skb, len);
     msg->msg_type = SESSION_CTL_HEARTBEAT;
+    if (with_loss) {
+        uint64_t gaps = 0;
+        if (session->dev)
+            gaps = READ_ONCE(session->dev->capture.stats.gaps);
+        msg->lost_periods = htonl((uint32_t)gaps);
+    }
 
     err = packet_send(session, skb);
     if (err < 0)
@@ -124,7 +355,8 @@ int send_close(struct cco_session *session)
     int err;
 
     struct sk_buff *skb;
-    err = create_cco_packet(session, SESSION_CTL, &skb);
+    err = create_cco_packet(session, SESSION_CTL, sizeof(SessionCtlMsg_t), 0,
+                            &skb);
     if (err < 0)
         goto exit_error;
 
@@ -155,14 +387,26 @@ int send_pcm_ctl(struct cco_session *session)
     if (dev->capture.active)
         streams |= PCM_CTL_CAPTURE;
 
+    // Only bitstreams that announced their rates understand the extended msg,
+    // see note in protocol.h.  Both streams run at the same rate, so take it
+    // from whichever is configured
+    bool with_rate = session->pcm_rates != 0;
+    unsigned rate = dev->playback.rate ?: dev->capture.rate;
+    unsigned len = with_rate ? sizeof(PcmCtlRateMsg_t) : sizeof(PcmCtlMsg_t);
+
     struct sk_buff *skb;
-    err = create_cco_packet(session, PCM_CTL, &skb);
+    err = create_cco_packet(session, PCM_CTL, len, 0, &skb);
     if (err < 0)
         goto exit_error;
 
-    PcmCtlMsg_t *msg;
-    msg = (PcmCtlMsg_t *)skb_put(skb, sizeof(PcmCtlMsg_t));
+    // Note: PcmCtlRateMsg_t only extends PcmCtlMsg_t with the trailing rate
+    PcmCtlRateMsg_t *msg;
+    msg = (PcmCtlRateMsg_t *)skb_put(skb, len);
     msg->streams = streams;
+    msg->playback_seqnum = htonl(dev->playback.start_seqnum);
+    msg->capture_seqnum = htonl(0);
+    if (with_rate)
+        msg->rate = pcm_rate_from_hz(rate);
 
     err = packet_send(session, skb);
     if (err < 0)
@@ -175,19 +419,41 @@ exit_error:
     return err;
 }
 
-int build_pcm_data(struct cco_session *session, uint32_t seqnum,
+// Fills in the header of msg within a PCM data msg
+static void put_pcm_data_header(struct cco_session *session,
+                                struct sk_buff *skb, uint32_t seqnum,
+                                unsigned msg)
+{
+    const struct cco_pcm_layout *layout = &session->pcm_layout;
+
+    // Note: PcmDataMsg_t & SplitPcmDataMsg_t share the same seqnum field
+    PcmDataMsg_t *pcm_data_msg;
+    pcm_data_msg = (PcmDataMsg_t *)skb_put(skb, pcm_layout_header_size(layout));
+    pcm_data_msg->seqnum = htonl(seqnum);
+
+    if (pcm_layout_is_split(layout)) {
+        SplitPcmDataMsg_t *split_msg = (SplitPcmDataMsg_t *)pcm_data_msg;
+        split_msg->first_channel = msg * layout->channels_per_msg;
+    }
+}
+
+// Builds msg within the PCM data msgs making up the period seqnum, see note in
+// protocol.h
+int build_pcm_data(struct cco_session *session, uint32_t seqnum, unsigned msg,
                    struct sk_buff **result)
 {
     int err;
 
+    const struct cco_pcm_layout *layout = &session->pcm_layout;
     struct sk_buff *skb;
-    err = create_cco_packet(session, PCM_DATA, &skb);
+    err = create_cco_packet(session, PCM_DATA, pcm_layout_msg_size(layout, msg),
+                            0, &skb);
     if (err < 0)
         goto exit_error;
 
-    PcmDataMsg_t *msg;
-    msg = (PcmDataMsg_t *)skb_put(skb, sizeof(PcmDataMsg_t));
-    msg->seqnum = htonl(seqnum);
+    put_pcm_data_header(session, skb, seqnum, msg);
+    skb_put(skb, pcm_layout_msg_size(layout, msg) -
+                 pcm_layout_header_size(layout));
 
     *result = skb;
 
@@ -198,41 +464,140 @@ exit_error:
     return err;
 }
 
+// Builds a PCM data msg whose sample data is not copied, but instead referenced
+// in place by one page fragment per channel it carries
+//
+// Each channel's data must lie within a single page.  A reference is taken on
+// every page, and is dropped by the network stack once the NIC is done with it
+//
+// Pages hold samples as laid out by ALSA, so this only applies to sessions
+// using PCM_FORMAT_S24_PADDED
+int build_pcm_data_paged(struct cco_session *session, uint32_t seqnum,
+                         unsigned msg, struct page *pages[],
+                         unsigned offsets[], struct sk_buff **result)
+{
+    int err;
+
+    const struct cco_pcm_layout *layout = &session->pcm_layout;
+    const unsigned channel_bytes = layout->frames * SAMPLE_SIZE;
+    const unsigned channels = pcm_layout_msg_channels(layout, msg);
+    const unsigned paged_len = channels * channel_bytes;
+
+    if (WARN_ON_ONCE(session->pcm_format != PCM_FORMAT_S24_PADDED)) {
+        err = -EINVAL;
+        goto exit_error;
+    }
+
+    struct sk_buff *skb;
+    err = create_cco_packet(session, PCM_DATA, pcm_layout_msg_size(layout, msg),
+                            paged_len, &skb);
+    if (err < 0)
+        goto exit_error;
+
+    put_pcm_data_header(session, skb, seqnum, msg);
+
+    for (int i = 0; i < channels; ++i) {
+        get_page(pages[i]);
+        skb_fill_page_desc(skb, i, pages[i], offsets[i], channel_bytes);
+    }
+    skb->len += paged_len;
+    skb->data_len += paged_len;
+    skb->truesize += paged_len;
+
+    *result = skb;
+
+    return 0;
+
+exit_error:
+    CCO_LOG_FUNCTION_FAILURE(err);
+    return err;
+}
+
+// Pooled PCM data sk_buff's are handed to the NIC again once their refcount
+// drops back to one and no clone shares their data, which is only legal on
+// devices that tolerate shared sk_buff's (the same requirement pktgen has)
+//
+// Note: tags the NIC can't insert itself are pushed into the packet data by the
+// stack on the way out, reallocating the head of an sk_buff built without room
+// for them, which it can't do to a shared one.  Even with room, the tag would
+// be pushed in place, shifting the msg from where recycle_pcm_data() expects it
+bool can_recycle_pcm_data(struct cco_session *session)
+{
+    struct net_device *netdev = session->netdev;
+    if (vlan_id >= 0 && !(netdev->features & NETIF_F_HW_VLAN_CTAG_TX))
+        return false;
+
+    return netdev->priv_flags & IFF_TX_SKB_SHARING;
+}
+
+// Size of the link headers ahead of the cco msg in packets we build
+static unsigned cco_link_hlen(void)
+{
+    return ethertype ? ETH_HLEN + CCO_LENGTH_SIZE : ETH_HLEN;
+}
+
+// Returns the cco msg of an sk_buff from create_cco_packet(), whose data
+// pointer is left at the link headers
+Msg_t *get_built_cco_msg(struct sk_buff *skb)
+{
+    return (Msg_t *)(skb->data + cco_link_hlen());
+}
+
+// Prepares an sk_buff from build_pcm_data() for another trip to the NIC
+//
+// Only the seqnum needs rewriting, the ethernet & cco headers are unchanged and
+// sample data is overwritten by the PCM layer before the next send
+void recycle_pcm_data(struct sk_buff *skb, uint32_t seqnum)
+{
+    Msg_t *msg = get_built_cco_msg(skb);
+    PcmDataMsg_t *pcm_data_msg = (PcmDataMsg_t *)msg->payload;
+    pcm_data_msg->seqnum = htonl(seqnum);
+}
+
+// Allocates an sk_buff for a msg of msg_type, whose payload of payload_len
+// bytes is left for the caller to put
 static int create_cco_packet(struct cco_session *session, uint8_t msg_type,
+                             unsigned payload_len, unsigned paged_len,
                              struct sk_buff **skb_out)
 {
     int err;
 
-    // Calculate payload size based on msg_type
-    unsigned len = sizeof(Msg_t);
-    switch (msg_type) {
-    case SESSION_CTL:
-        len += sizeof(SessionCtlMsg_t);
-        break;
-    case PCM_CTL:
-        len += sizeof(PcmCtlMsg_t);
-        break;
-    case PCM_DATA:
-        len += sizeof(PcmDataMsg_t);
-        break;
-    default:
+    if (msg_type != SESSION_CTL && msg_type != PCM_CTL &&
+        msg_type != PCM_DATA)
+    {
         printk(KERN_ERR "cco: \"%d\" is not a valid msgtype\n", msg_type);
         err = -EINVAL;
         goto exit_error;
     }
+    unsigned len = sizeof(Msg_t) + payload_len;
 
     // Allocate sk_buff
-    struct sk_buff *skb = alloc_skb(ETH_HLEN + len, GFP_KERNEL);
-    if (IS_ERR(skb)) {
-        printk(KERN_ERR "cco: failed to allocate sk_buff\n");
+    //
+    // Note: the last paged_len bytes of the payload are attached afterwards as
+    // page fragments, so only the headers need room in the linear area
+    unsigned hlen = cco_link_hlen();
+    struct sk_buff *skb = alloc_skb(hlen + len - paged_len, GFP_KERNEL);
+    if (!skb) {
+        atomic64_inc(&session->stats.alloc_failures);
+        printk_ratelimited(KERN_ERR "cco: failed to allocate sk_buff\n");
         err = -ENOMEM;
         goto exit_error;
     }
+    struct net_device *netdev = session->netdev;
     skb->dev = netdev;
 
-    // Create 802.3 ethernet header
-    skb_reserve(skb, ETH_HLEN);
-    dev_hard_header(skb, netdev, ETH_P_802_3, session->mac, netdev->dev_addr, len);
+    // Create ethernet header, followed by the length of the cco msg unless
+    // it is carried by the ethernet header itself
+    skb_reserve(skb, hlen);
+    if (ethertype) {
+        __be16 *length = skb_push(skb, CCO_LENGTH_SIZE);
+        *length = htons(len);
+        dev_hard_header(skb, netdev, ethertype, session->mac, netdev->dev_addr,
+                        len);
+    } else {
+        dev_hard_header(skb, netdev, ETH_P_802_3, session->mac,
+                        netdev->dev_addr, len);
+    }
 
     // Create cco header
     Msg_t *msg = (Msg_t *)skb_put(skb, sizeof(Msg_t));
@@ -240,6 +605,8 @@ static int create_cco_packet(struct cco_session *session, uint8_t msg_type,
     msg->generation_id = session->generation_id;
     msg->msg_type = msg_type;
 
+    mark_cco_packet(skb);
+
     *skb_out = skb;
 
     return 0;
@@ -249,14 +616,43 @@ exit_error:
     return err;
 }
 
+static void count_xmit(struct cco_session *session, int ret)
+{
+    struct cco_session_stats *stats = &session->stats;
+    switch (ret) {
+    case NET_XMIT_SUCCESS:
+        atomic64_inc(&stats->xmit_success);
+        break;
+    case NET_XMIT_DROP:
+        atomic64_inc(&stats->xmit_drop);
+        break;
+    case NET_XMIT_CN:
+        atomic64_inc(&stats->xmit_cn);
+        break;
+    default:
+        atomic64_inc(&stats->xmit_busy);
+    }
+}
+
 int packet_send(struct cco_session *session, struct sk_buff *skb)
 {
     int err;
 
-    if (dev_queue_xmit(skb) != NET_XMIT_SUCCESS) {
-        printk(KERN_ERR "cco: failed to enqueue packet\n");
+    // Note: dev_direct_xmit() & dev_queue_xmit() both consume skb, whether or
+    // not they succeed
+    int ret;
+    if (qdisc_bypass) {
+        pick_tx_queue(skb);
+        ret = dev_direct_xmit(skb, skb_get_queue_mapping(skb));
+    } else {
+        ret = dev_queue_xmit(skb);
+    }
+    trace_cco_xmit(session, ret);
+    count_xmit(session, ret);
+
+    if (ret != NET_XMIT_SUCCESS) {
+        printk_ratelimited(KERN_ERR "cco: failed to enqueue packet\n");
         err = -EAGAIN;
-        kfree_skb(skb);
         goto exit_error;
     }
 
@@ -269,40 +665,219 @@ exit_error:
     return err;
 
 }
+
+// Note:
+//
+// PCM data msgs that are ready at the same time are sent as a batch.  Rather
+// than passing each through dev_queue_xmit(), which takes the qdisc lock and
+// has the driver ring the NIC's doorbell for every msg, the batch is handed
+// straight to the driver under a single hold of the tx queue lock, with
+// xmit_more set on all but the last msg so that the doorbell is rung once.
+//
+// As with pktgen, msgs sent this way skip the qdisc and packet taps, which is
+// why it's off by default.  Should the tx queue be stopped partway, the rest of
+// the batch falls back to dev_queue_xmit(), whose qdisc holds on to it until
+// the queue wakes up.  Later batches then go through the qdisc as well until it
+// has drained, as sending them directly would overtake the msgs it still holds
+// and reorder periods on the wire.
+static bool xmit_batch = false;
+module_param(xmit_batch, bool, 0644);
+MODULE_PARM_DESC(xmit_batch,
+                 "Hand PCM data msgs ready at the same time to the NIC driver "
+                 "as a single batch, bypassing the qdisc (default N)");
+
+// Whether the qdisc of txq has handed everything queued on it to the driver,
+// called w/ bh disabled
+static bool tx_qdisc_drained(struct netdev_queue *txq)
+{
+    struct Qdisc *qdisc = rcu_dereference_bh(txq->qdisc);
+    return qdisc_is_empty(qdisc) && !qdisc_is_running(qdisc);
+}
+
+// Sends every sk_buff in batch, which is left empty.  Returns the number of
+// sk_buff's the driver accepted directly
+int packet_send_batch(struct cco_session *session, struct sk_buff_head *batch)
+{
+    int sent = 0;
+    unsigned msgs = skb_queue_len(batch);
+
+    struct sk_buff *skb = skb_peek(batch);
+    if (!skb || !xmit_batch)
+        goto fallback;
+
+    // Msgs of a session all go out on the same tx queue so they stay in order
+    struct net_device *netdev = session->netdev;
+    struct netdev_queue *txq = pick_tx_queue(skb);
+    u16 queue = skb_get_queue_mapping(skb);
+
+    local_bh_disable();
+    if (session->xmit_queued && !tx_qdisc_drained(txq)) {
+        local_bh_enable();
+        goto fallback;
+    }
+    session->xmit_queued = false;
+
+    HARD_TX_LOCK(netdev, txq, smp_processor_id());
+    while ((skb = __skb_dequeue(batch))) {
+        if (netif_xmit_frozen_or_drv_stopped(txq)) {
+            __skb_queue_head(batch, skb);
+            break;
+        }
+
+        // Checksums & fragments are fixed up for the NIC, as dev_queue_xmit()
+        // would
+        bool again = false;
+        skb_set_queue_mapping(skb, queue);
+        skb = validate_xmit_skb_list(skb, netdev, &again);
+        if (!skb) {
+            atomic64_inc(&session->stats.xmit_drop);
+            continue;
+        }
+
+        netdev_tx_t ret = netdev_start_xmit(skb, netdev, txq,
+                                            !skb_queue_empty(batch));
+        if (ret == NETDEV_TX_BUSY) {
+            __skb_queue_head(batch, skb);
+            break;
+        }
+        if (dev_xmit_complete(ret))
+            ++sent;
+    }
+    HARD_TX_UNLOCK(netdev, txq);
+    local_bh_enable();
+
+    if (sent)
+        session->ts_last_send = ktime_get();
+    atomic64_add(sent, &session->stats.xmit_success);
+    trace_cco_xmit_batch(session, msgs, sent);
+
+fallback:
+    // Note: dev_direct_xmit() leaves nothing behind to be overtaken
+    if (!skb_queue_empty(batch) && !qdisc_bypass)
+        session->xmit_queued = true;
+    while ((skb = __skb_dequeue(batch)))
+        packet_send(session, skb);
+
+    return sent;
+}
 /*============================================================================*/
 
 
 /*==============================Packet receiving==============================*/
+// Note: packet_recv() runs on as many CPUs at once as there are intfs, each
+// pushing onto session_ctl_fifo, so pushes are serialized by its lock.  The
+// session manager is its only consumer, which needs no locking
 SessionCtlFifo_t session_ctl_fifo;
+static DEFINE_SPINLOCK(session_ctl_lock);
+
+static void check_rx_steering(struct net_device *netdev)
+{
+    if (!(netdev->hw_features & NETIF_F_NTUPLE))
+        printk(KERN_INFO "cco: intf \"%s\" can't steer cco frames to an RX "
+               "queue of their own, see note in ethernet.c\n", netdev->name);
+}
+
+// Strips the framing ahead of & padding behind the cco msg, see protocol.h
+static bool unwrap_cco_packet(struct sk_buff *skb)
+{
+    unsigned len;
+    if (ethertype) {
+        if (!pskb_may_pull(skb, CCO_LENGTH_SIZE)) {
+            CCO_LOG_DROP(CCO_DROP_TRUNCATED,
+                         "cco: rejecting packet due to missing length\n");
+            return false;
+        }
+        len = ntohs(*(__be16 *)skb->data);
+        skb_pull(skb, CCO_LENGTH_SIZE);
+    } else {
+        len = ntohs(eth_hdr(skb)->h_proto);
+    }
+
+    if (len > skb->len) {
+        CCO_LOG_DROP(CCO_DROP_TRUNCATED,
+                     "cco: rejecting packet due to truncation\n");
+        return false;
+    }
+    return pskb_trim(skb, len) == 0;
+}
 
 static int packet_recv(struct sk_buff *skb, struct net_device *dev,
                        struct packet_type *pt, struct net_device *orig_dev)
 {
-    if (!is_valid_cco_packet(skb)) {
+    // Taps such as tcpdump may hold the same sk_buff, which unwrapping it
+    // would modify from under them
+    skb = skb_share_check(skb, GFP_ATOMIC);
+    if (!skb)
+        return 0;
+
+    if (!unwrap_cco_packet(skb) || !is_valid_cco_packet(skb)) {
         kfree_skb(skb);
         return 0;
     }
 
     // Update recv timestamp for the session if it exists
+    //
+    // Note: the session & its device stay valid until rcu_read_unlock(), see
+    // note in device.c
     struct ethhdr *hdr = eth_hdr(skb);
     Msg_t *msg = get_cco_msg(skb);
     struct cco_session *session;
+    struct cco_device *cco = NULL;
+    rcu_read_lock();
     session = cco_get_session(hdr->h_source, msg->generation_id);
+
+    // Frames of a session's FPGA may also reach us on another of our intfs,
+    // through bridged or bonded NICs or a switch flooding them.  Only those on
+    // the session's own intf are handled, so that its capture ring is only
+    // ever fed from the one softirq, see note in pcm.c
+    if (session && session->netdev != dev) {
+        rcu_read_unlock();
+        CCO_LOG_DROP(CCO_DROP_INTF,
+                     "cco: recv'd session's msg on another intf\n");
+        kfree_skb(skb);
+        return 0;
+    }
+
     if (session) {
         session->ts_last_recv = ktime_get();
+        cco = smp_load_acquire(&session->dev);
     }
 
     switch (msg->msg_type) {
     case SESSION_CTL:
-        if (!kfifo_put(&session_ctl_fifo, skb))
+        if (!kfifo_in_spinlocked(&session_ctl_fifo, &skb, 1,
+                                 &session_ctl_lock))
+            kfree_skb(skb);
+        break;
+
+    case PCM_CTL:
+        // Period acknowledgements from the FPGA are time-sensitive, so they
+        // are handled directly in softirq context
+        if (cco)
+            cco_pcm_handle_ctl(cco, (PcmCtlMsg_t *)msg->payload);
+        kfree_skb(skb);
+        break;
+
+    case PCM_DATA:
+        // Ownership of skb passes to the capture ring
+        if (cco)
+            cco_pcm_put_period(&cco->capture, skb);
+        else
             kfree_skb(skb);
         break;
 
     default:
-        printk(KERN_ERR "cco: recv'd message with unsupported msgtype\n");
+        CCO_LOG_DROP(CCO_DROP_MSG_TYPE,
+                     "cco: recv'd message with unsupported msgtype\n");
         kfree_skb(skb);
     }
+    rcu_read_unlock();
 
     return 0;
 }
 /*============================================================================*/
+
+
+#if IS_ENABLED(CONFIG_SND_CCO_KUNIT_TEST)
+#include "ethernet_kunit.c"
+#endif
@@ -6,6 +6,7 @@
 #include <linux/types.h>
 
 #include "device.h"
+#include "protocol.h"
 
 // Initialization
 int cco_ethernet_init(void);
@@ -16,9 +17,16 @@ int send_handshake_request(struct cco_session *session);
 int send_heartbeat(struct cco_session *session);
 int send_close(struct cco_session *session);
 int send_pcm_ctl(struct cco_session *session);
-int build_pcm_data(struct cco_session *session, uint32_t seqnum,
+int build_pcm_data(struct cco_session *session, uint32_t seqnum, unsigned msg,
                    struct sk_buff **result);
+int build_pcm_data_paged(struct cco_session *session, uint32_t seqnum,
+                         unsigned msg, struct page *pages[],
+                         unsigned offsets[], struct sk_buff **result);
+Msg_t *get_built_cco_msg(struct sk_buff *skb);
+bool can_recycle_pcm_data(struct cco_session *session);
+void recycle_pcm_data(struct sk_buff *skb, uint32_t seqnum);
 int packet_send(struct cco_session *session, struct sk_buff *skb);
+int packet_send_batch(struct cco_session *session, struct sk_buff_head *batch);
 
 #define SESSION_CTL_FIFO_SIZE 8
 typedef STRUCT_KFIFO(struct sk_buff *, SESSION_CTL_FIFO_SIZE) SessionCtlFifo_t;
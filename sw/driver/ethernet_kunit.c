@@ -0,0 +1,392 @@
+// KUnit tests of the validation of received frames, which ethernet.c includes
+// w/ CONFIG_SND_CCO_KUNIT_TEST so that its statics can be reached, see Kconfig
+//
+// Frames are handed to unwrap_cco_packet() & is_valid_cco_packet() as
+// packet_recv() would, their ethernet header already pulled, under both
+// settings of the ethertype module param.
+#include <kunit/test.h>
+#include <linux/etherdevice.h>
+#include <linux/prandom.h>
+
+#define CCO_ETHERNET_TEST_SEED   0xcc0
+#define CCO_ETHERNET_TEST_ROUNDS 4096
+
+// Longest msg that could be valid, see is_valid_cco_packet()
+#define CCO_ETHERNET_TEST_MAX_MSG \
+    (sizeof(Msg_t) + sizeof(SplitPcmDataMsg_t) + PCM_DATA_MAX_SAMPLE_BYTES)
+
+static const ushort cco_ethernet_test_ethertypes[] = { CCO_ETHERTYPE, 0 };
+
+struct cco_ethernet_test {
+    ushort ethertype; /* module param, restored on exit */
+    u8 *msg;
+    struct rnd_state rnd;
+};
+
+static int cco_ethernet_test_init(struct kunit *test)
+{
+    struct cco_ethernet_test *t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+    if (!t)
+        return -ENOMEM;
+
+    t->msg = kunit_kzalloc(test, CCO_ETHERNET_TEST_MAX_MSG + 1, GFP_KERNEL);
+    if (!t->msg)
+        return -ENOMEM;
+
+    t->ethertype = ethertype;
+    prandom_seed_state(&t->rnd, CCO_ETHERNET_TEST_SEED);
+    test->priv = t;
+
+    return 0;
+}
+
+static void cco_ethernet_test_exit(struct kunit *test)
+{
+    struct cco_ethernet_test *t = test->priv;
+
+    ethertype = t->ethertype;
+}
+
+static long cco_ethernet_test_drops(void)
+{
+    long total = 0;
+    for (unsigned i = 0; i < CCO_DROP_COUNT; ++i) {
+        total += atomic_long_read(&cco_drops[i]);
+    }
+
+    return total;
+}
+
+// Fills t->msg w/ a random valid msg, returns its length
+static unsigned cco_ethernet_test_msg(struct cco_ethernet_test *t)
+{
+    static const unsigned session_ctl_sizes[] = {
+        sizeof(SessionCtlMsg_t),
+        sizeof(SessionCtlCapsMsg_t),
+        sizeof(SessionCtlChannelsMsg_t),
+        sizeof(SessionCtlPeriodMsg_t),
+        sizeof(SessionCtlRatesMsg_t),
+    };
+    static const unsigned pcm_ctl_sizes[] = {
+        sizeof(PcmCtlMsg_t),
+        sizeof(PcmCtlRateMsg_t),
+    };
+    const unsigned pcm_data_sizes = CCO_ETHERNET_TEST_MAX_MSG - sizeof(Msg_t) -
+                                    sizeof(PcmDataMsg_t) + 1;
+
+    Msg_t *msg = (Msg_t *)t->msg;
+    msg->magic = htonl(CCO_MAGIC);
+    msg->generation_id = prandom_u32_state(&t->rnd);
+    msg->msg_type = prandom_u32_state(&t->rnd) % (PCM_DATA + 1);
+
+    unsigned r = prandom_u32_state(&t->rnd);
+    unsigned len;
+    switch (msg->msg_type) {
+    case SESSION_CTL:
+        len = session_ctl_sizes[r % ARRAY_SIZE(session_ctl_sizes)];
+        prandom_bytes_state(&t->rnd, msg->payload, len);
+        ((SessionCtlMsg_t *)msg->payload)->msg_type =
+            prandom_u32_state(&t->rnd) % (SESSION_CTL_CLOSE + 1);
+        break;
+
+    case PCM_CTL:
+        len = pcm_ctl_sizes[r % ARRAY_SIZE(pcm_ctl_sizes)];
+        prandom_bytes_state(&t->rnd, msg->payload, len);
+        break;
+
+    default:
+        len = sizeof(PcmDataMsg_t) + r % pcm_data_sizes;
+        prandom_bytes_state(&t->rnd, msg->payload, len);
+    }
+
+    return sizeof(Msg_t) + len;
+}
+
+// Frames msg_len bytes of t->msg, w/ length (as found in the framing) &
+// padding bytes behind it
+static struct sk_buff *cco_ethernet_test_frame(struct kunit *test,
+                                               unsigned msg_len,
+                                               unsigned length,
+                                               unsigned padding)
+{
+    struct cco_ethernet_test *t = test->priv;
+
+    struct sk_buff *skb = alloc_skb(ETH_HLEN + CCO_LENGTH_SIZE + msg_len +
+                                    padding, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+
+    struct ethhdr *hdr = skb_put_zero(skb, ETH_HLEN);
+    eth_random_addr(hdr->h_source);
+    eth_random_addr(hdr->h_dest);
+    if (ethertype) {
+        hdr->h_proto = htons(ethertype);
+        __be16 *len = skb_put(skb, CCO_LENGTH_SIZE);
+        *len = htons(length);
+    } else {
+        hdr->h_proto = htons(length);
+    }
+    skb_put_data(skb, t->msg, msg_len);
+    skb_put_zero(skb, padding);
+
+    skb_reset_mac_header(skb);
+    skb_pull(skb, ETH_HLEN);
+
+    return skb;
+}
+
+// Moves the last bytes of skb into a page fragment
+static void cco_ethernet_test_page(struct kunit *test, struct sk_buff *skb,
+                                   unsigned bytes)
+{
+    struct page *page = alloc_page(GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, page);
+
+    memcpy(page_address(page), skb_tail_pointer(skb) - bytes, bytes);
+    skb_trim(skb, skb->len - bytes);
+    skb_add_rx_frag(skb, 0, page, 0, bytes, PAGE_SIZE);
+}
+
+// Passes skb through the checks of packet_recv(), which must either take it
+// w/ the msg's length, or drop it counting a single reason
+static bool cco_ethernet_test_recv(struct kunit *test, struct sk_buff *skb,
+                                   unsigned msg_len)
+{
+    long drops = cco_ethernet_test_drops();
+    bool valid = unwrap_cco_packet(skb) && is_valid_cco_packet(skb);
+
+    KUNIT_EXPECT_EQ(test, cco_ethernet_test_drops(), drops + !valid);
+    if (valid) {
+        KUNIT_EXPECT_EQ(test, skb->len, msg_len);
+        KUNIT_EXPECT_EQ(test, skb_headlen(skb), msg_len);
+        KUNIT_EXPECT_EQ(test, ntohl(get_cco_msg(skb)->magic), CCO_MAGIC);
+        KUNIT_EXPECT_LE(test, get_cco_msg(skb)->msg_type, PCM_DATA);
+    }
+
+    return valid;
+}
+
+// Every valid msg is taken, however much padding follows it
+static void cco_ethernet_test_valid(struct kunit *test)
+{
+    struct cco_ethernet_test *t = test->priv;
+
+    for (size_t i = 0; i < ARRAY_SIZE(cco_ethernet_test_ethertypes); ++i) {
+        ethertype = cco_ethernet_test_ethertypes[i];
+
+        for (unsigned round = 0; round < CCO_ETHERNET_TEST_ROUNDS; ++round) {
+            unsigned len = cco_ethernet_test_msg(t);
+            unsigned padding = prandom_u32_state(&t->rnd) % ETH_ZLEN;
+            struct sk_buff *skb = cco_ethernet_test_frame(test, len, len,
+                                                          padding);
+
+            bool valid = cco_ethernet_test_recv(test, skb, len);
+            KUNIT_EXPECT_TRUE_MSG(test, valid, "ethertype %#x, type %u, %u "
+                                  "bytes", ethertype,
+                                  ((Msg_t *)t->msg)->msg_type, len);
+            if (valid)
+                KUNIT_EXPECT_MEMEQ(test, skb->data, t->msg, len);
+            kfree_skb(skb);
+
+            if (!valid)
+                break;
+        }
+    }
+}
+
+// Ways of spoiling a valid msg, each dropped for a given reason
+enum cco_ethernet_test_flaw {
+    CCO_ETHERNET_TEST_NO_LENGTH,
+    CCO_ETHERNET_TEST_LONG_LENGTH,
+    CCO_ETHERNET_TEST_PAGED,
+    CCO_ETHERNET_TEST_SHORT_HEADER,
+    CCO_ETHERNET_TEST_MAGIC,
+    CCO_ETHERNET_TEST_MSG_TYPE,
+    CCO_ETHERNET_TEST_SESSION_CTL_SIZE,
+    CCO_ETHERNET_TEST_SESSION_CTL_TYPE,
+    CCO_ETHERNET_TEST_PCM_CTL_SIZE,
+    CCO_ETHERNET_TEST_PCM_DATA_SHORT,
+    CCO_ETHERNET_TEST_PCM_DATA_LONG,
+};
+
+struct cco_ethernet_test_flaw_case {
+    const char *name;
+    enum cco_ethernet_test_flaw flaw;
+    enum CcoDrop_t drop;
+};
+
+static const struct cco_ethernet_test_flaw_case
+cco_ethernet_test_flaw_cases[] = {
+    { "no length",        CCO_ETHERNET_TEST_NO_LENGTH,
+      CCO_DROP_TRUNCATED },
+    { "long length",      CCO_ETHERNET_TEST_LONG_LENGTH,
+      CCO_DROP_TRUNCATED },
+    { "paged",            CCO_ETHERNET_TEST_PAGED,
+      CCO_DROP_PAGED },
+    { "short header",     CCO_ETHERNET_TEST_SHORT_HEADER,
+      CCO_DROP_HEADER },
+    { "magic",            CCO_ETHERNET_TEST_MAGIC,
+      CCO_DROP_MAGIC },
+    { "msg type",         CCO_ETHERNET_TEST_MSG_TYPE,
+      CCO_DROP_MSG_TYPE },
+    { "session ctl size", CCO_ETHERNET_TEST_SESSION_CTL_SIZE,
+      CCO_DROP_MSG_SIZE },
+    { "session ctl type", CCO_ETHERNET_TEST_SESSION_CTL_TYPE,
+      CCO_DROP_MSG_TYPE },
+    { "pcm ctl size",     CCO_ETHERNET_TEST_PCM_CTL_SIZE,
+      CCO_DROP_MSG_SIZE },
+    { "pcm data short",   CCO_ETHERNET_TEST_PCM_DATA_SHORT,
+      CCO_DROP_MSG_SIZE },
+    { "pcm data long",    CCO_ETHERNET_TEST_PCM_DATA_LONG,
+      CCO_DROP_MSG_SIZE },
+};
+
+static void
+cco_ethernet_test_flaw_desc(const struct cco_ethernet_test_flaw_case *c,
+                            char *desc)
+{
+    strscpy(desc, c->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(cco_ethernet_test_flaw, cco_ethernet_test_flaw_cases,
+                  cco_ethernet_test_flaw_desc);
+
+// Builds the frame of a msg w/ flaw
+static struct sk_buff *
+cco_ethernet_test_flawed_frame(struct kunit *test,
+                               enum cco_ethernet_test_flaw flaw)
+{
+    struct cco_ethernet_test *t = test->priv;
+    Msg_t *msg = (Msg_t *)t->msg;
+
+    msg->magic = htonl(CCO_MAGIC);
+    msg->generation_id = 0;
+    msg->msg_type = SESSION_CTL;
+    msg->payload[0] = SESSION_CTL_HEARTBEAT;
+    unsigned len = sizeof(Msg_t) + sizeof(SessionCtlMsg_t);
+    unsigned length = len;
+
+    switch (flaw) {
+    case CCO_ETHERNET_TEST_NO_LENGTH: {
+        // Only the first byte of the length made it
+        struct sk_buff *skb = cco_ethernet_test_frame(test, 0, len, 0);
+        skb_trim(skb, 1);
+        return skb;
+    }
+    case CCO_ETHERNET_TEST_LONG_LENGTH:
+        length = len + 1;
+        break;
+    case CCO_ETHERNET_TEST_PAGED: {
+        struct sk_buff *skb = cco_ethernet_test_frame(test, len, len, 0);
+        cco_ethernet_test_page(test, skb, 1);
+        return skb;
+    }
+    case CCO_ETHERNET_TEST_SHORT_HEADER:
+        len = length = sizeof(Msg_t) - 1;
+        break;
+    case CCO_ETHERNET_TEST_MAGIC:
+        msg->magic ^= htonl(1);
+        break;
+    case CCO_ETHERNET_TEST_MSG_TYPE:
+        msg->msg_type = PCM_DATA + 1;
+        break;
+    case CCO_ETHERNET_TEST_SESSION_CTL_SIZE:
+        len = length = sizeof(Msg_t) + sizeof(SessionCtlRatesMsg_t) + 1;
+        break;
+    case CCO_ETHERNET_TEST_SESSION_CTL_TYPE:
+        msg->payload[0] = SESSION_CTL_CLOSE + 1;
+        break;
+    case CCO_ETHERNET_TEST_PCM_CTL_SIZE:
+        msg->msg_type = PCM_CTL;
+        len = length = sizeof(Msg_t) + sizeof(PcmCtlMsg_t) - 1;
+        break;
+    case CCO_ETHERNET_TEST_PCM_DATA_SHORT:
+        msg->msg_type = PCM_DATA;
+        len = length = sizeof(Msg_t) + sizeof(PcmDataMsg_t) - 1;
+        break;
+    case CCO_ETHERNET_TEST_PCM_DATA_LONG:
+        msg->msg_type = PCM_DATA;
+        len = length = CCO_ETHERNET_TEST_MAX_MSG + 1;
+        break;
+    }
+
+    return cco_ethernet_test_frame(test, len, length, 0);
+}
+
+// Each flaw is dropped, counted under its reason
+static void cco_ethernet_test_flawed(struct kunit *test)
+{
+    const struct cco_ethernet_test_flaw_case *c = test->param_value;
+
+    for (size_t i = 0; i < ARRAY_SIZE(cco_ethernet_test_ethertypes); ++i) {
+        ethertype = cco_ethernet_test_ethertypes[i];
+
+        // Without a length of its own, a frame can't lack it
+        if (c->flaw == CCO_ETHERNET_TEST_NO_LENGTH && !ethertype)
+            continue;
+
+        struct sk_buff *skb = cco_ethernet_test_flawed_frame(test, c->flaw);
+        long drops = atomic_long_read(&cco_drops[c->drop]);
+
+        KUNIT_EXPECT_FALSE_MSG(test, cco_ethernet_test_recv(test, skb, 0),
+                               "ethertype %#x", ethertype);
+        KUNIT_EXPECT_EQ_MSG(test, atomic_long_read(&cco_drops[c->drop]),
+                            drops + 1, "ethertype %#x", ethertype);
+        kfree_skb(skb);
+    }
+}
+
+// Valid frames mangled at random, as the emulator does w/ -z, are either taken
+// whole or dropped w/ a reason
+static void cco_ethernet_test_fuzz(struct kunit *test)
+{
+    struct cco_ethernet_test *t = test->priv;
+
+    for (size_t i = 0; i < ARRAY_SIZE(cco_ethernet_test_ethertypes); ++i) {
+        ethertype = cco_ethernet_test_ethertypes[i];
+
+        for (unsigned round = 0; round < CCO_ETHERNET_TEST_ROUNDS; ++round) {
+            unsigned len = cco_ethernet_test_msg(t);
+            unsigned length = len;
+            unsigned padding = prandom_u32_state(&t->rnd) % ETH_ZLEN;
+            unsigned r = prandom_u32_state(&t->rnd);
+
+            // Lie about the length, or flip a few bits of the msg
+            if (r & 1) {
+                length = prandom_u32_state(&t->rnd) % (len + padding + 8);
+            } else {
+                for (unsigned bits = (r >> 8) & 3; bits-- > 0;) {
+                    unsigned bit = prandom_u32_state(&t->rnd) % (len * 8);
+                    t->msg[bit / 8] ^= 1 << (bit % 8);
+                }
+            }
+            struct sk_buff *skb = cco_ethernet_test_frame(test, len, length,
+                                                          padding);
+
+            // Cut the frame short, or page part of it
+            if (r & 2)
+                skb_trim(skb, prandom_u32_state(&t->rnd) % (skb->len + 1));
+            else if (r & 4 && skb->len)
+                cco_ethernet_test_page(test, skb, 1 + prandom_u32_state(
+                                                          &t->rnd) % skb->len);
+
+            cco_ethernet_test_recv(test, skb, length);
+            kfree_skb(skb);
+        }
+    }
+}
+
+static struct kunit_case cco_ethernet_test_cases[] = {
+    KUNIT_CASE(cco_ethernet_test_valid),
+    KUNIT_CASE_PARAM(cco_ethernet_test_flawed,
+                     cco_ethernet_test_flaw_gen_params),
+    KUNIT_CASE(cco_ethernet_test_fuzz),
+    {}
+};
+
+static struct kunit_suite cco_ethernet_test_suite = {
+    .name = "cco_ethernet",
+    .init = cco_ethernet_test_init,
+    .exit = cco_ethernet_test_exit,
+    .test_cases = cco_ethernet_test_cases,
+};
+kunit_test_suites(&cco_ethernet_test_suite);
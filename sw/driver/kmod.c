@@ -1,6 +1,8 @@
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 
+#include "convert.h"
 #include "device.h"
 #include "ethernet.h"
 #include "log.h"
@@ -9,10 +11,19 @@ MODULE_AUTHOR("Jake Whitton <jwhitton@alum.mit.edu>");
 MODULE_DESCRIPTION("Cuoc Cho Am soundcard");
 MODULE_LICENSE("GPL");
 
+static bool convert_benchmark = false;
+module_param(convert_benchmark, bool, 0444);
+MODULE_PARM_DESC(convert_benchmark,
+                 "Log timings of the scalar & SIMD sample format conversions "
+                 "upon loading");
+
 static int __init kmod_init(void)
 {
     int err;
-    
+
+    if (convert_benchmark)
+        cco_convert_benchmark();
+
     err = cco_register_driver();
     if (err < 0)
         goto exit_error;
@@ -38,9 +49,11 @@ exit_error:
 
 static void __exit kmod_exit(void)
 {
-    cco_ethernet_exit();
+    // Note: sessions are closed before their intfs are released, so that the
+    // close msgs can still be sent
     cco_session_manager_exit();
     cco_close_sessions();
+    cco_ethernet_exit();
     cco_unregister_driver();
 }
 
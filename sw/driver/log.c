@@ -0,0 +1,54 @@
+#include "log.h"
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+/*=================================Debugging==================================*/
+#ifdef CCO_DEBUG
+DEFINE_STATIC_KEY_FALSE(cco_debug_enabled);
+
+static int set_debug(const char *val, const struct kernel_param *kp)
+{
+    bool enable;
+    int err = kstrtobool(val, &enable);
+    if (err < 0)
+        return err;
+
+    if (enable)
+        static_branch_enable(&cco_debug_enabled);
+    else
+        static_branch_disable(&cco_debug_enabled);
+
+    return 0;
+}
+
+static int get_debug(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%c\n",
+                   static_key_enabled(&cco_debug_enabled) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops debug_ops = {
+    .set = set_debug,
+    .get = get_debug,
+};
+module_param_cb(debug, &debug_ops, NULL, 0644);
+MODULE_PARM_DESC(debug, "Log per-packet debug msgs (default N)");
+#endif
+/*============================================================================*/
+
+
+/*===================================Drops====================================*/
+atomic_long_t cco_drops[CCO_DROP_COUNT];
+
+const char *const cco_drop_names[CCO_DROP_COUNT] = {
+    [CCO_DROP_TRUNCATED] = "truncated",
+    [CCO_DROP_PAGED]     = "paged",
+    [CCO_DROP_HEADER]    = "header",
+    [CCO_DROP_MAGIC]     = "magic",
+    [CCO_DROP_MSG_TYPE]  = "msg_type",
+    [CCO_DROP_MSG_SIZE]  = "msg_size",
+    [CCO_DROP_INTF]      = "intf",
+};
+/*============================================================================*/
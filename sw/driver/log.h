@@ -1,6 +1,61 @@
 #ifndef CCO_LOG_H
 #define CCO_LOG_H
 
-#define CCO_LOG_FUNCTION_FAILURE(err) printk(KERN_ERR "cco: %s() failed w/ err=%d\n", __func__, (err))
+#include <linux/atomic.h>
+#include <linux/jump_label.h>
+#include <linux/printk.h>
+
+// Note: each call site is rate-limited separately, so that failures in the
+// packet path can't flood the console, while failures elsewhere still print
+#define CCO_LOG_FUNCTION_FAILURE(err) printk_ratelimited(KERN_ERR "cco: %s() failed w/ err=%d\n", __func__, (err))
+
+/*=================================Debugging==================================*/
+// Note:
+//
+// Per-packet debug logging is compiled out entirely unless the module is built
+// with CCO_DEBUG=1.  Even then, it stays behind a static key that costs a
+// single patched-out jump until the debug module param is set.
+#ifdef CCO_DEBUG
+DECLARE_STATIC_KEY_FALSE(cco_debug_enabled);
+
+#define CCO_LOG_DEBUG(fmt, ...)                                     \
+    do {                                                            \
+        if (static_branch_unlikely(&cco_debug_enabled))             \
+            printk_ratelimited(KERN_DEBUG fmt, ##__VA_ARGS__);      \
+    } while (0)
+#else
+#define CCO_LOG_DEBUG(fmt, ...) no_printk(KERN_DEBUG fmt, ##__VA_ARGS__)
+#endif
+/*============================================================================*/
+
+
+/*===================================Drops====================================*/
+// Note:
+//
+// Frames dropped by packet_recv() are counted rather than printed, as a burst
+// of foreign or malformed frames would otherwise spend softirq time writing to
+// the console and stall audio.  The counts are shown in debugfs, see note in
+// device.c.
+enum CcoDrop_t
+{
+    CCO_DROP_TRUNCATED,
+    CCO_DROP_PAGED,
+    CCO_DROP_HEADER,
+    CCO_DROP_MAGIC,
+    CCO_DROP_MSG_TYPE,
+    CCO_DROP_MSG_SIZE,
+    CCO_DROP_INTF,
+    CCO_DROP_COUNT
+};
+
+extern atomic_long_t cco_drops[CCO_DROP_COUNT];
+extern const char *const cco_drop_names[CCO_DROP_COUNT];
+
+#define CCO_LOG_DROP(reason, fmt, ...)                              \
+    do {                                                            \
+        atomic_long_inc(&cco_drops[(reason)]);                      \
+        CCO_LOG_DEBUG(fmt, ##__VA_ARGS__);                          \
+    } while (0)
+/*============================================================================*/
 
 #endif
@@ -1,18 +1,31 @@
 #include "pcm.h"
 
-#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 #include <linux/minmax.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
+#include <linux/sched.h>
 #include <linux/skbuff.h>
 #include <linux/slab.h>
 #include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 #include <sound/core.h>
+#include <sound/info.h>
+#include <linux/seq_file.h>
 #include <sound/pcm.h>
 
+#include "convert.h"
 #include "device.h"
 #include "ethernet.h"
 #include "log.h"
 #include "protocol.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
 /*===============================Initialization===============================*/
 // Full definition is in "PCM <-> Ethernet" section
 static int pcm_manager(void * data);
@@ -20,6 +33,21 @@ static int pcm_manager(void * data);
 // Full definition is in "PCM interface" section
 static const struct snd_pcm_ops cco_pcm_ops;
 
+// Full definition is in "Zero-copy playback" section
+static bool zero_copy;
+static const struct snd_pcm_ops cco_pcm_zero_copy_ops;
+
+// Full definition is in "Statistics" section
+static void cco_pcm_proc_read(struct snd_info_entry *entry,
+                              struct snd_info_buffer *buffer);
+static void cco_pcm_account_xmit(struct cco_pcm *pcm, uint32_t seqnum,
+                                 ktime_t ts_complete);
+static void cco_pcm_account_ack(struct cco_pcm *pcm, uint32_t seqnum);
+
+// Full definition is in "Buffer Management" section
+static unsigned capture_ring_size;
+static void cco_pcm_capture_reset(struct cco_pcm *pcm);
+
 static int cco_pcm_device_init(struct cco_pcm *pcm, struct cco_device *dev,
                                int id, const char *name, bool is_playback)
 {
@@ -53,7 +81,20 @@ static int cco_pcm_device_init(struct cco_pcm *pcm, struct cco_device *dev,
     // Sound core will propagate to snd_pcm_substream->private_data
     pcm_tmp->private_data = dev;
 
-    if (is_playback) {
+    pcm->zero_copy = is_playback && zero_copy;
+    if (pcm->zero_copy) {
+        snd_pcm_set_ops(pcm_tmp, SNDRV_PCM_STREAM_PLAYBACK,
+                        &cco_pcm_zero_copy_ops);
+
+        // Sound core allocates the buffer in hw_params(), page by page so
+        // that each page can be handed to the NIC
+        err = snd_pcm_set_managed_buffer_all(pcm_tmp, SNDRV_DMA_TYPE_VMALLOC,
+                                             NULL, 0, 0);
+        if (err < 0) {
+            printk(KERN_ERR "cco: snd_pcm_set_managed_buffer_all() failed\n");
+            goto undo_pcm_new;
+        }
+    } else if (is_playback) {
         snd_pcm_set_ops(pcm_tmp, SNDRV_PCM_STREAM_PLAYBACK, &cco_pcm_ops);
     } else {
         snd_pcm_set_ops(pcm_tmp, SNDRV_PCM_STREAM_CAPTURE, &cco_pcm_ops);
@@ -63,15 +104,42 @@ static int cco_pcm_device_init(struct cco_pcm *pcm, struct cco_device *dev,
 
     pcm->active = false;
 
-    INIT_LIST_HEAD(&pcm->periods);
-    for (int i = 0; i < ARRAY_SIZE(pcm->cursors); ++i) {
-        pcm->cursors[i] = &pcm->periods;
+    spin_lock_init(&pcm->substream_lock);
+    pcm->substream = NULL;
+
+    mutex_init(&pcm->lock);
+    pcm->periods = NULL;
+    pcm->num_periods = 0;
+    cco_pcm_reset(pcm);
+
+    // Set up ring that carries capture periods out of softirq
+    if (!is_playback) {
+        err = kfifo_alloc(&pcm->ring, capture_ring_size, GFP_KERNEL);
+        if (err < 0) {
+            printk(KERN_ERR "cco: kfifo_alloc() failed\n");
+            goto undo_pcm_new;
+        }
     }
+    pcm->slots = NULL;
+    pcm->num_slots = 0;
+    pcm->slot_msgs = 0;
+    pcm->synced = false;
+
+    pcm->conversion = NULL;
+    pcm->sample_bytes = SAMPLE_SIZE;
+
+    pcm->paged = false;
+    pcm->dma_area = NULL;
+    pcm->appl_ptr = 0;
+    pcm->xmit_ptr = 0;
 
     pcm->dev = dev;
 
     return 0;
 
+undo_pcm_new:
+    snd_device_free(dev->card, pcm_tmp);
+    pcm->pcm = NULL;
 exit_error:
     CCO_LOG_FUNCTION_FAILURE(err);
     return err;
@@ -85,6 +153,16 @@ static void cco_pcm_device_exit(struct cco_pcm *pcm)
         snd_device_free(dev->card, pcm->pcm);
         pcm->pcm = NULL;
     }
+
+    cco_pcm_capture_reset(pcm);
+    kfree(pcm->slots);
+    pcm->slots = NULL;
+    kfree(pcm->read_skews);
+    pcm->read_skews = NULL;
+    kfree(pcm->conceal_buf);
+    pcm->conceal_buf = NULL;
+    pcm->num_slots = 0;
+    kfifo_free(&pcm->ring);
 }
 
 int cco_pcm_init(struct cco_device *cco)
@@ -92,6 +170,10 @@ int cco_pcm_init(struct cco_device *cco)
     int err;
 
     // Boot infrastructure for transporting PCM data to and from ethernet
+    //
+    // Note: the pcm manager sleeps until the copy path completes a period, so
+    // it runs SCHED_FIFO to get packets out as soon as it is woken
+    init_waitqueue_head(&cco->pcm_manager_wq);
     struct task_struct *task;
     task = kthread_run(pcm_manager, cco, "cco_pcm_manager");
     if (IS_ERR(task)) {
@@ -99,6 +181,7 @@ int cco_pcm_init(struct cco_device *cco)
         err = -EAGAIN;
         goto exit_error;
     }
+    sched_set_fifo(task);
     cco->pcm_manager_task = task;
 
     // Set up playback device
@@ -115,6 +198,13 @@ int cco_pcm_init(struct cco_device *cco)
         goto exit_error;
     }
 
+    // Point to the stats from /proc/asound/cardN/cco_stats
+    err = snd_card_ro_proc_new(cco->card, "cco_stats", cco, cco_pcm_proc_read);
+    if (err < 0) {
+        printk(KERN_ERR "cco: failed to create stats proc entry\n");
+        goto exit_error;
+    }
+
     return 0;
 
 exit_error:
@@ -139,89 +229,189 @@ void cco_pcm_exit(struct cco_device *cco)
 
 
 /*==============================Buffer Management=============================*/
+// Note:
+//
+// Playback periods are held in a ring of pcm->num_periods slots, a power of two
+// so that period seqnum lives in slot seqnum & (num_periods - 1).  The ring
+// holds every period from tail_seqnum, the oldest not yet taken by the pcm
+// manager, up to but excluding seqnum, the next to be started.
+//
+// ALSA issues one copy() per channel, so each channel fills periods in turn
+// from its own fill_seqnums entry, counting the samples it has put into each
+// in the period's sizes.  A channel that reaches seqnum starts the next period,
+// and a period is ready to be sent once every channel has filled it.
+//
+// The ring is sized in hw_params() to cover the ALSA buffer, which bounds how
+// far ahead of the pcm manager the copy path can run.  Should the pcm manager
+// fall a whole ring behind regardless, its oldest period is dropped unsent to
+// make room (counted in ring_overflows).
+//
+// A period may be split across several PCM data msgs (see note in protocol.h),
+// in which case it holds one sk_buff per msg.  Unused entries of skbs are NULL.
 struct cco_pcm_period {
-    struct sk_buff *skb;
-    struct list_head list;
-    unsigned sizes[CHANNELS_PER_PACKET];
+    struct sk_buff *skbs[PCM_DATA_MAX_MSGS_PER_PERIOD];
+    unsigned sizes[CCO_MAX_CHANNELS]; /* in samples */
+    uint32_t seqnum;
+    ktime_t ts_complete;
 };
 
-static void cco_pcm_reset(struct cco_pcm *pcm)
+static const struct cco_pcm_layout *cco_pcm_layout(struct cco_pcm *pcm)
 {
-    // Free all PCM data stored
-    struct list_head *pos = pcm->periods.next;
-    while (!list_is_head(pos, &pcm->periods)) {
-        struct list_head *next = pos->next;
-        struct cco_pcm_period *period;
-        period = list_entry(pos, struct cco_pcm_period, list);
+    return &pcm->dev->session->pcm_layout;
+}
 
-        // Remove period from list
-        list_del(pos);
+static struct cco_pcm_period *cco_pcm_period(struct cco_pcm *pcm,
+                                             uint32_t seqnum)
+{
+    return &pcm->periods[seqnum & (pcm->num_periods - 1)];
+}
+
+static bool cco_pcm_period_complete(struct cco_pcm *pcm,
+                                    struct cco_pcm_period *period)
+{
+    for (int i = 0; i < cco_pcm_layout(pcm)->channels; ++i) {
+        if (period->sizes[i] != cco_pcm_layout(pcm)->frames)
+            return false;
+    }
 
-        // Free memory associated with period
-        if (period->skb)
-            kfree_skb(period->skb);
-        kfree(period);
+    return true;
+}
 
-        pos = next;
+static void cco_pcm_period_free_skbs(struct cco_pcm_period *period)
+{
+    for (int i = 0; i < ARRAY_SIZE(period->skbs); ++i) {
+        if (period->skbs[i]) {
+            kfree_skb(period->skbs[i]);
+            period->skbs[i] = NULL;
+        }
     }
+}
 
-    // Reset list & cursors
-    INIT_LIST_HEAD(&pcm->periods);
-    for (int i = 0; i < ARRAY_SIZE(pcm->cursors); ++i) {
-        pcm->cursors[i] = &pcm->periods;
+// Empties the ring, keeping each period's sk_buff's for reuse.  Caller must
+// hold pcm->lock
+static void cco_pcm_reset(struct cco_pcm *pcm)
+{
+    pcm->tail_seqnum = pcm->seqnum;
+    for (int i = 0; i < ARRAY_SIZE(pcm->fill_seqnums); ++i) {
+        pcm->fill_seqnums[i] = pcm->seqnum;
     }
+    atomic_set(&pcm->periods_ready, 0);
 }
 
-static int cco_pcm_alloc_period(struct cco_pcm *pcm, struct sk_buff *skb,
-                                struct cco_pcm_period **result)
+static void cco_pcm_free_periods(struct cco_pcm *pcm)
+{
+    mutex_lock(&pcm->lock);
+
+    cco_pcm_reset(pcm);
+
+    // Note: an sk_buff still queued on the NIC holds its own reference and
+    // will be freed by the network stack once transmission completes
+    for (unsigned i = 0; i < pcm->num_periods; ++i) {
+        cco_pcm_period_free_skbs(&pcm->periods[i]);
+    }
+    kfree(pcm->periods);
+
+    pcm->periods = NULL;
+    pcm->num_periods = 0;
+
+    mutex_unlock(&pcm->lock);
+}
+
+static int cco_pcm_alloc_periods(struct cco_pcm *pcm, unsigned count)
 {
     int err;
 
-    // Allocate space for linked list node
-    struct cco_pcm_period *period;
-    period = kzalloc(sizeof(*period), GFP_KERNEL);
-    if (!period) {
+    cco_pcm_free_periods(pcm);
+
+    count = roundup_pow_of_two(count);
+    struct cco_pcm_period *periods;
+    periods = kcalloc(count, sizeof(*periods), GFP_KERNEL);
+    if (!periods) {
         err = -ENOMEM;
         goto exit_error;
     }
 
-    // Allocate and populate skb if one is not provided
-    if (!skb) {
-        err = build_pcm_data(pcm->dev->session, pcm->seqnum, &skb);
-        if (err < 0)
-            goto undo_alloc_period;
-
-        ++pcm->seqnum;
+    // Where the NIC lets sk_buff's be recycled, build each period's up front,
+    // seqnum is filled in upon reuse.  Otherwise they're built as each period
+    // is started, and handed over to the NIC with it
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    if (can_recycle_pcm_data(pcm->dev->session)) {
+        for (unsigned i = 0; i < count; ++i) {
+            for (unsigned j = 0; j < layout->msgs_per_period; ++j) {
+                err = build_pcm_data(pcm->dev->session, 0, j,
+                                     &periods[i].skbs[j]);
+                if (err < 0)
+                    goto undo_alloc_periods;
+            }
+        }
     }
-    period->skb = skb;
 
-    *result = period;
+    mutex_lock(&pcm->lock);
+    pcm->periods = periods;
+    pcm->num_periods = count;
+    cco_pcm_reset(pcm);
+    mutex_unlock(&pcm->lock);
 
     return 0;
 
-undo_alloc_period:
-    kfree(period);
+undo_alloc_periods:
+    for (unsigned i = 0; i < count; ++i) {
+        cco_pcm_period_free_skbs(&periods[i]);
+    }
+    kfree(periods);
 exit_error:
     CCO_LOG_FUNCTION_FAILURE(err);
     return err;
 }
 
-static int cco_pcm_advance_cursor(struct cco_pcm *pcm, int channel)
+// Starts period pcm->seqnum at the head of the ring.  Caller must hold
+// pcm->lock
+static int cco_pcm_push_period(struct cco_pcm *pcm)
 {
     int err;
 
-    struct list_head **cursor = &pcm->cursors[channel];
-    if (list_is_last(*cursor, &pcm->periods)) {
-        // Next period doesn't yet exist, attempt to allocate it
-        struct cco_pcm_period *period;
-        err = cco_pcm_alloc_period(pcm, NULL, &period);
-        if (err < 0)
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+
+    // Make room by dropping the oldest period, which the pcm manager has
+    // fallen too far behind to send in time
+    if (pcm->seqnum - pcm->tail_seqnum == pcm->num_periods) {
+        struct cco_pcm_period *oldest = cco_pcm_period(pcm, pcm->tail_seqnum);
+        if (!cco_pcm_period_complete(pcm, oldest)) {
+            err = -ENOBUFS;
             goto exit_error;
+        }
 
-        list_add_tail(&period->list, &pcm->periods);
+        pcm->tail_seqnum++;
+        atomic_dec(&pcm->periods_ready);
+        pcm->stats.ring_overflows++;
     }
 
-    *cursor = (*cursor)->next;
+    // Reuse the slot's sk_buff's unless the NIC still holds a reference to
+    // them, or they were handed over to it
+    //
+    // Note: packet taps such as tcpdump clone the sk_buff's passed through
+    // dev_queue_xmit(), which shares their data without taking a reference,
+    // so cloned ones are left to the taps too
+    struct cco_pcm_period *period = cco_pcm_period(pcm, pcm->seqnum);
+    for (unsigned i = 0; i < layout->msgs_per_period; ++i) {
+        struct sk_buff **skb = &period->skbs[i];
+        if (*skb && !skb_shared(*skb) && !skb_cloned(*skb)) {
+            recycle_pcm_data(*skb, pcm->seqnum);
+            continue;
+        }
+
+        if (*skb) {
+            kfree_skb(*skb);
+            *skb = NULL;
+        }
+        err = build_pcm_data(pcm->dev->session, pcm->seqnum, i, skb);
+        if (err < 0) {
+            atomic64_inc(&pcm->dev->session->stats.alloc_failures);
+            goto exit_error;
+        }
+    }
+    memset(period->sizes, 0, sizeof(period->sizes));
+    period->seqnum = pcm->seqnum++;
 
     return 0;
 
@@ -230,86 +420,842 @@ exit_error:
     return err;
 }
 
-static int cco_pcm_put_period(struct cco_pcm *pcm, struct sk_buff *skb)
+// Note:
+//
+// The playback ring must hold, at all times:
+//
+//   - no more than num_periods periods, each in the slot of its seqnum
+//   - for each channel, a fill_seqnums entry within the ring or at its head,
+//     full periods before it and empty ones past it
+//   - periods_ready equal to the number of complete periods
+//
+// Builds w/ CCO_DEBUG=1 check these whenever samples are put or a period is
+// taken while the debug module param is set, warning once if any don't hold.
+#ifdef CCO_DEBUG
+// Caller must hold pcm->lock
+static void cco_pcm_check_periods(struct cco_pcm *pcm)
 {
-    // TODO
+    if (!static_branch_unlikely(&cco_debug_enabled))
+        return;
+
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    uint32_t count = pcm->seqnum - pcm->tail_seqnum;
+    if (WARN_ONCE(count > pcm->num_periods,
+                  "cco: %u periods in a ring of %u\n", count,
+                  pcm->num_periods))
+        return;
+
+    for (int i = 0; i < layout->channels; ++i) {
+        WARN_ONCE(pcm->fill_seqnums[i] - pcm->tail_seqnum > count,
+                  "cco: channel %d fills period %u outside of [%u, %u]\n", i,
+                  pcm->fill_seqnums[i], pcm->tail_seqnum, pcm->seqnum);
+    }
+
+    int ready = 0;
+    for (uint32_t seqnum = pcm->tail_seqnum; seqnum != pcm->seqnum; ++seqnum) {
+        struct cco_pcm_period *period = cco_pcm_period(pcm, seqnum);
+        WARN_ONCE(period->seqnum != seqnum, "cco: period %u in slot of %u\n",
+                  period->seqnum, seqnum);
+
+        for (int i = 0; i < layout->channels; ++i) {
+            int32_t ahead = seqnum - pcm->fill_seqnums[i];
+            WARN_ONCE(ahead < 0 && period->sizes[i] != layout->frames,
+                      "cco: period %u holds %u samples of channel %d before "
+                      "the one it fills\n", seqnum, period->sizes[i], i);
+            WARN_ONCE(ahead == 0 && period->sizes[i] >= layout->frames,
+                      "cco: period %u filled by channel %d is full\n", seqnum,
+                      i);
+            WARN_ONCE(ahead > 0 && period->sizes[i] != 0,
+                      "cco: period %u holds %u samples of channel %d past the "
+                      "one it fills\n", seqnum, period->sizes[i], i);
+        }
+
+        if (cco_pcm_period_complete(pcm, period))
+            ready++;
+    }
+
+    WARN_ONCE(ready != atomic_read(&pcm->periods_ready),
+              "cco: %d periods complete but %d ready\n", ready,
+              atomic_read(&pcm->periods_ready));
+}
+#else
+static inline void cco_pcm_check_periods(struct cco_pcm *pcm) { }
+#endif
+
+/*---------------------------------Capture----------------------------------*/
+// Note:
+//
+// Capture periods pass through two stages on their way to userspace:
+//
+//   1. In softirq, packet_recv() pushes each PCM data msg onto pcm->ring.  It
+//      is the ring's only producer and copy() is its only consumer, so the
+//      kfifo needs no locking and the rx path never contends with copy().
+//
+//      Note: packet_recv() is only a single producer while the card's frames
+//      are handled by one softirq at a time.  It drops frames arriving on any
+//      intf but the session's, and within that intf they must all land on one
+//      RX queue, which ethtool's ntuple filters ensure (see note in
+//      ethernet.c).  RPS must not spread them across CPUs either.
+//
+//   2. In copy(), the ring is drained into pcm->slots, which are indexed by
+//      seqnum.  This reorders periods that arrive out of order, and exposes
+//      periods that never arrived so they can be read out as silence.
+//
+// Each channel is read through its own (seqnum, offset) cursor since ALSA
+// issues one copy() per channel, and a period is freed once every channel has
+// read past it.
+//
+// A period split across several PCM data msgs occupies one slot, holding each
+// msg separately.  Channels whose msg never arrived are read out as silence.
+static unsigned capture_ring_size = 64;
+module_param(capture_ring_size, uint, 0444);
+MODULE_PARM_DESC(capture_ring_size,
+                 "Capture periods buffered between softirq and copy(), "
+                 "rounded up to a power of two (default 64)");
+
+// Extra slots beyond the ALSA buffer that allow for reordering
+#define CCO_CAPTURE_REORDER_DEPTH 8
+
+// Note:
+//
+// NICs coalesce interrupts, so capture periods arrive in bursts rather than one
+// at a time.  Were each period read the moment it is due, those arriving late
+// in a burst would be read out as gaps.  Instead, the reader is held a number
+// of periods behind, its target depth.
+//
+// The target depth follows the interarrival jitter, which is measured in
+// softirq as in RFC 3550: each period's arrival is compared against when it
+// was due relative to the previous one, and the jitter is a running average of
+// the difference.  The target is as many periods as cover four times the
+// jitter, at most capture_jitter_max.
+//
+// The reader is moved one period at a time, as channel 0 crosses a period
+// boundary:
+//
+//   - When the period due next hasn't arrived and the reader is held back by
+//     less than target, the period just read is read again
+//
+//   - When more than target periods were waiting ahead of the reader for a
+//     whole window of periods, a period is skipped
+//
+// The adjustment made at each boundary is kept in read_skews, so that every
+// other channel makes the same one as it crosses that boundary.  Channel 0 is
+// always the first to cross, as the sound core copies channels in order.
+//
+// The periods waiting ahead of the reader are reported as runtime->delay.
+static unsigned capture_jitter_max = 8;
+module_param(capture_jitter_max, uint, 0444);
+MODULE_PARM_DESC(capture_jitter_max,
+                 "Max periods the capture jitter buffer may hold back the "
+                 "reader by (default 8)");
+
+#define CCO_CAPTURE_JITTER_WINDOW 64
+
+// Note:
+//
+// Periods that never arrived are concealed from the periods around them, as
+// selected by capture_conceal when the stream is prepared:
+//
+//   - "silence": read out as silence
+//
+//   - "repeat": the period before is read out again
+//
+//   - "fade": the period before is read out again, fading linearly to silence
+//
+//   - "crossfade": the period before is crossfaded linearly into the period
+//     after, or faded to silence if that hasn't arrived either
+//
+// Each channel holds on to the last period it read for this.  Only the first
+// of several missing periods in a row is concealed, the rest are read out as
+// silence rather than looping the same period.
+//
+// Concealment is synthesized in the wire format into conceal_buf as a channel
+// starts reading the missing period, and converted on its way out like any
+// other period.
+// Parsed when written, as it's read without kernel_param_lock()
+static int capture_conceal = CCO_PCM_CONCEAL_FADE;
+
+static const char *const cco_pcm_conceal_names[] = {
+    [CCO_PCM_CONCEAL_SILENCE]   = "silence",
+    [CCO_PCM_CONCEAL_REPEAT]    = "repeat",
+    [CCO_PCM_CONCEAL_FADE]      = "fade",
+    [CCO_PCM_CONCEAL_CROSSFADE] = "crossfade",
+};
+
+static int set_capture_conceal(const char *val, const struct kernel_param *kp)
+{
+    int conceal = sysfs_match_string(cco_pcm_conceal_names, val);
+    if (conceal < 0)
+        return conceal;
+
+    WRITE_ONCE(capture_conceal, conceal);
     return 0;
 }
 
-static int cco_pcm_get_period(struct cco_pcm *pcm, struct sk_buff **result)
+static int get_capture_conceal(char *buffer, const struct kernel_param *kp)
 {
-    if (list_empty(&pcm->periods))
-        return -ENODATA;
+    return sprintf(buffer, "%s\n",
+                   cco_pcm_conceal_names[READ_ONCE(capture_conceal)]);
+}
 
-    struct list_head *pos = pcm->periods.next;
-    struct cco_pcm_period *period = list_entry(pos, struct cco_pcm_period, list);
-    for (int i = 0; i < CHANNELS_PER_PACKET; ++i) {
-        if (period->sizes[i] != sizeof(ChannelPcmData_t))
-            return -ENODATA;
+static const struct kernel_param_ops capture_conceal_ops = {
+    .set = set_capture_conceal,
+    .get = get_capture_conceal,
+};
+module_param_cb(capture_conceal, &capture_conceal_ops, NULL, 0644);
+MODULE_PARM_DESC(capture_conceal,
+                 "Concealment of lost capture periods: \"silence\", "
+                 "\"repeat\", \"fade\" (default) or \"crossfade\"");
+
+// Updates the interarrival jitter with the arrival of period seqnum, called
+// from softirq
+static void cco_pcm_capture_measure(struct cco_pcm *pcm, uint32_t seqnum)
+{
+    ktime_t now = ktime_get();
+
+    // Start measuring afresh once the stream has been reset.  That is done here
+    // rather than by cco_pcm_capture_reset(), as the arrival state is only ever
+    // written from softirq
+    if (atomic_xchg(&pcm->arrival_reset, 0)) {
+        pcm->arrival_ts = 0;
+        WRITE_ONCE(pcm->jitter_ns_16, 0);
+    }
+
+    int32_t periods = seqnum - pcm->arrival_seqnum;
+
+    // Periods that arrived out of order say nothing about jitter, and neither
+    // does the first period after a long silence
+    if (pcm->arrival_ts && periods <= 0)
+        return;
+    if (pcm->arrival_ts && periods < CCO_CAPTURE_JITTER_WINDOW) {
+        s64 late = ktime_to_ns(ktime_sub(now, pcm->arrival_ts)) -
+                   (s64)periods * pcm->period_ns;
+        uint64_t jitter = pcm->jitter_ns_16;
+        WRITE_ONCE(pcm->jitter_ns_16, jitter + abs(late) - (jitter >> 4));
+    }
+
+    pcm->arrival_seqnum = seqnum;
+    pcm->arrival_ts = now;
+}
+
+// Called from softirq for each PCM data msg received, takes ownership of skb
+int cco_pcm_put_period(struct cco_pcm *pcm, struct sk_buff *skb)
+{
+    if (!READ_ONCE(pcm->active)) {
+        kfree_skb(skb);
+        return 0;
+    }
+
+    // Drop msgs that don't match the layout negotiated for the session
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    void *msg = get_cco_msg(skb)->payload;
+    unsigned first_channel = pcm_layout_first_channel(layout, msg);
+    if (first_channel >= layout->channels ||
+        first_channel % layout->channels_per_msg != 0 ||
+        get_cco_payload_len(skb) !=
+        pcm_layout_msg_size(layout, pcm_layout_msg(layout, first_channel)))
+    {
+        WRITE_ONCE(pcm->stats.rx_drops, pcm->stats.rx_drops + 1);
+        kfree_skb(skb);
+        return -EINVAL;
+    }
+
+    if (first_channel == 0)
+        cco_pcm_capture_measure(pcm, ntohl(((PcmDataMsg_t *)msg)->seqnum));
+
+    if (!kfifo_put(&pcm->ring, skb)) {
+        WRITE_ONCE(pcm->stats.rx_drops, pcm->stats.rx_drops + 1);
+        kfree_skb(skb);
+        return -ENOBUFS;
+    }
+
+    unsigned depth = kfifo_len(&pcm->ring);
+    if (depth > pcm->stats.rx_ring_max_depth)
+        WRITE_ONCE(pcm->stats.rx_ring_max_depth, depth);
+
+    trace_cco_period_recv(pcm, ntohl(((PcmDataMsg_t *)msg)->seqnum), 0);
+
+    return 0;
+}
+
+// Caller must hold pcm->lock
+static void cco_pcm_capture_reset(struct cco_pcm *pcm)
+{
+    struct sk_buff *skb;
+    while (kfifo_get(&pcm->ring, &skb)) {
+        kfree_skb(skb);
+    }
+
+    for (unsigned i = 0; i < pcm->num_slots * pcm->slot_msgs; ++i) {
+        if (pcm->slots[i]) {
+            kfree_skb(pcm->slots[i]);
+            pcm->slots[i] = NULL;
+        }
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(pcm->last_skbs); ++i) {
+        kfree_skb(pcm->last_skbs[i]);
+        pcm->last_skbs[i] = NULL;
+        pcm->concealing[i] = false;
+    }
+
+    pcm->synced = false;
+    pcm->jitter_depth = 0;
+
+    // Note: picked up by cco_pcm_capture_measure() on the next arrival
+    atomic_set(&pcm->arrival_reset, 1);
+}
+
+// Locates the sk_buff holding msg of the period seqnum
+static struct sk_buff **cco_pcm_capture_slot(struct cco_pcm *pcm,
+                                             uint32_t seqnum, unsigned msg)
+{
+    unsigned slot = seqnum & (pcm->num_slots - 1);
+    return &pcm->slots[slot * pcm->slot_msgs + msg];
+}
+
+static void cco_pcm_capture_free_slots(struct cco_pcm *pcm)
+{
+    mutex_lock(&pcm->lock);
+
+    cco_pcm_capture_reset(pcm);
+    kfree(pcm->slots);
+    pcm->slots = NULL;
+    kfree(pcm->read_skews);
+    pcm->read_skews = NULL;
+    kfree(pcm->conceal_buf);
+    pcm->conceal_buf = NULL;
+    pcm->num_slots = 0;
+    pcm->slot_msgs = 0;
+
+    mutex_unlock(&pcm->lock);
+}
+
+static int cco_pcm_capture_alloc_slots(struct cco_pcm *pcm, unsigned count)
+{
+    int err;
+
+    cco_pcm_capture_free_slots(pcm);
+
+    // Power of two so that a seqnum maps onto a slot with a mask
+    count = roundup_pow_of_two(count + CCO_CAPTURE_REORDER_DEPTH +
+                               capture_jitter_max);
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    unsigned msgs = layout->msgs_per_period;
+
+    struct sk_buff **slots;
+    slots = kcalloc(count * msgs, sizeof(*slots), GFP_KERNEL);
+    if (!slots) {
+        err = -ENOMEM;
+        goto exit_error;
+    }
+
+    // Note: channel 0 is never more than the ALSA buffer ahead of the others,
+    // so read_skews can be indexed like slots
+    int *read_skews = kcalloc(count, sizeof(*read_skews), GFP_KERNEL);
+    if (!read_skews) {
+        err = -ENOMEM;
+        goto undo_alloc_slots;
+    }
+
+    char *conceal_buf = kmalloc_array(layout->channels,
+                                      layout->frames *
+                                      pcm_sample_size(layout->format),
+                                      GFP_KERNEL);
+    if (!conceal_buf) {
+        err = -ENOMEM;
+        goto undo_alloc_read_skews;
+    }
+
+    mutex_lock(&pcm->lock);
+    pcm->slots = slots;
+    pcm->read_skews = read_skews;
+    pcm->conceal_buf = conceal_buf;
+    pcm->num_slots = count;
+    pcm->slot_msgs = msgs;
+    mutex_unlock(&pcm->lock);
+
+    return 0;
+
+undo_alloc_read_skews:
+    kfree(read_skews);
+undo_alloc_slots:
+    kfree(slots);
+exit_error:
+    CCO_LOG_FUNCTION_FAILURE(err);
+    return err;
+}
+
+// Seqnum of the oldest period some channel has yet to finish reading
+static uint32_t cco_pcm_capture_tail(struct cco_pcm *pcm)
+{
+    uint32_t tail = pcm->read_seqnums[0];
+    for (int i = 1; i < cco_pcm_layout(pcm)->channels; ++i) {
+        if ((int32_t)(pcm->read_seqnums[i] - tail) < 0)
+            tail = pcm->read_seqnums[i];
     }
 
-    // Remove period and present sk_buff to user
-    list_del(pos);
-    *result = period->skb;
-    kfree(period);
+    return tail;
+}
+
+// Periods the reader should be held back by to ride out the jitter measured
+static unsigned cco_pcm_capture_target(struct cco_pcm *pcm)
+{
+    if (!pcm->period_ns)
+        return 0;
+
+    uint64_t jitter = READ_ONCE(pcm->jitter_ns_16) >> 4;
+    uint64_t target = div64_u64(4 * jitter + pcm->period_ns - 1,
+                                pcm->period_ns);
+    return min_t(uint64_t, target, capture_jitter_max);
+}
+
+// Decides how many periods beyond the next channel 0 skips as it crosses a
+// period boundary, -1 to read the same one again.  Caller must hold pcm->lock
+static int cco_pcm_capture_adjust(struct cco_pcm *pcm)
+{
+    uint32_t next = pcm->read_seqnums[0] + 1;
+    int32_t depth = pcm->head_seqnum - next;
+    depth = max(depth, 0);
+    pcm->jitter_depth = depth;
+    pcm->jitter_min_depth = min_t(unsigned, pcm->jitter_min_depth, depth);
+
+    // Wait a period longer for a period that's late
+    unsigned target = cco_pcm_capture_target(pcm);
+    if (!*cco_pcm_capture_slot(pcm, next, 0) && pcm->jitter_lag < target) {
+        pcm->jitter_lag++;
+        pcm->stats.jitter_grows++;
+        pcm->jitter_min_depth = UINT_MAX;
+        pcm->jitter_window = 0;
+        return -1;
+    }
+
+    if (++pcm->jitter_window < CCO_CAPTURE_JITTER_WINDOW)
+        return 0;
+
+    // Catch up by a period if we were needlessly far behind the whole window
+    unsigned min_depth = pcm->jitter_min_depth;
+    pcm->jitter_min_depth = UINT_MAX;
+    pcm->jitter_window = 0;
+    if (min_depth > target && pcm->jitter_lag > 0) {
+        pcm->jitter_lag--;
+        pcm->stats.jitter_shrinks++;
+        return 1;
+    }
 
     return 0;
 }
 
+// Reads & writes a sample in the wire format, whose 24 bits are big-endian and
+// right aligned in size bytes
+static int32_t cco_pcm_wire_sample(const char *p, unsigned size)
+{
+    const uint8_t *b = (const uint8_t *)p + size - PACKED_SAMPLE_SIZE;
+    return sign_extend32((b[0] << 16) | (b[1] << 8) | b[2], 23);
+}
+
+static void cco_pcm_set_wire_sample(char *p, unsigned size, int32_t sample)
+{
+    uint8_t *b = (uint8_t *)p;
+    if (size == SAMPLE_SIZE)
+        *b++ = 0;
+    b[0] = sample >> 16;
+    b[1] = sample >> 8;
+    b[2] = sample;
+}
+
+// Synthesizes the missing period seqnum of channel into conceal_buf, returns
+// false if it is to be read out as silence.  Caller must hold pcm->lock
+static bool cco_pcm_capture_conceal(struct cco_pcm *pcm, int channel,
+                                    uint32_t seqnum)
+{
+    struct sk_buff *prev = pcm->last_skbs[channel];
+    if (pcm->conceal == CCO_PCM_CONCEAL_SILENCE || !prev)
+        return false;
+
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    unsigned frames = layout->frames;
+    unsigned size = pcm_sample_size(layout->format);
+    const char *from = pcm_layout_channel(layout, get_cco_msg(prev)->payload,
+                                          channel);
+    char *to = pcm->conceal_buf + channel * frames * size;
+
+    if (pcm->conceal == CCO_PCM_CONCEAL_REPEAT) {
+        memcpy(to, from, frames * size);
+        return true;
+    }
+
+    // Fade into the period after, if it has arrived
+    //
+    // Note: its slot may still hold a period from a lap ago
+    const char *next = NULL;
+    struct sk_buff *next_skb;
+    next_skb = *cco_pcm_capture_slot(pcm, seqnum + 1,
+                                     pcm_layout_msg(layout, channel));
+    if (pcm->conceal == CCO_PCM_CONCEAL_CROSSFADE && next_skb) {
+        PcmDataMsg_t *msg = (PcmDataMsg_t *)get_cco_msg(next_skb)->payload;
+        if (ntohl(msg->seqnum) == seqnum + 1)
+            next = pcm_layout_channel(layout, msg, channel);
+    }
+
+    for (unsigned i = 0; i < frames; ++i) {
+        s64 sample = (s64)cco_pcm_wire_sample(from + i * size, size) *
+                     (frames - i);
+        if (next)
+            sample += (s64)cco_pcm_wire_sample(next + i * size, size) * i;
+        cco_pcm_set_wire_sample(to + i * size, size, div_s64(sample, frames));
+    }
+
+    return true;
+}
+
+// Moves periods out of the softirq ring and into their slots.  Caller must
+// hold pcm->lock
+static void cco_pcm_capture_drain(struct cco_pcm *pcm)
+{
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+
+    struct sk_buff *skb;
+    while (kfifo_get(&pcm->ring, &skb)) {
+        // Note: the msg's layout was validated in cco_pcm_put_period()
+        PcmDataMsg_t *msg = (PcmDataMsg_t *)get_cco_msg(skb)->payload;
+        uint32_t seqnum = ntohl(msg->seqnum);
+        unsigned index = pcm_layout_msg(layout,
+                                        pcm_layout_first_channel(layout, msg));
+        if (index == 0)
+            pcm->stats.periods_received++;
+
+        // Start reading from the first period received on this stream, held
+        // back by the target depth of the jitter buffer
+        if (!pcm->synced) {
+            unsigned target = cco_pcm_capture_target(pcm);
+            for (int i = 0; i < ARRAY_SIZE(pcm->read_seqnums); ++i) {
+                pcm->read_seqnums[i] = seqnum - target;
+                pcm->read_offsets[i] = 0;
+                pcm->read_indexes[i] = 0;
+            }
+            pcm->head_seqnum = seqnum;
+            pcm->sync_seqnum = seqnum;
+            pcm->jitter_lag = target;
+            pcm->jitter_min_depth = UINT_MAX;
+            pcm->jitter_window = 0;
+            pcm->synced = true;
+        }
+
+        int32_t ahead = seqnum - cco_pcm_capture_tail(pcm);
+        if (ahead < 0) {
+            // Every channel has already read past this period
+            pcm->stats.late++;
+            kfree_skb(skb);
+            continue;
+        }
+        if (ahead >= pcm->num_slots) {
+            // Reader has fallen further behind than we can buffer
+            pcm->stats.overruns++;
+            kfree_skb(skb);
+            continue;
+        }
+
+        struct sk_buff **slot = cco_pcm_capture_slot(pcm, seqnum, index);
+        if (*slot) {
+            pcm->stats.duplicates++;
+            kfree_skb(skb);
+            continue;
+        }
+
+        // Note: the other msgs of the newest period are not out of order
+        if ((int32_t)(seqnum - pcm->head_seqnum) >= 0)
+            pcm->head_seqnum = seqnum + 1;
+        else if (seqnum + 1 != pcm->head_seqnum)
+            pcm->stats.reordered++;
+
+        *slot = skb;
+    }
+}
+
+// Frees periods between old_tail and the current tail.  Caller must hold
+// pcm->lock
+static void cco_pcm_capture_release(struct cco_pcm *pcm, uint32_t old_tail)
+{
+    uint32_t tail = cco_pcm_capture_tail(pcm);
+    for (uint32_t seqnum = old_tail; seqnum != tail; ++seqnum) {
+        for (unsigned i = 0; i < pcm->slot_msgs; ++i) {
+            struct sk_buff **slot = cco_pcm_capture_slot(pcm, seqnum, i);
+            if (*slot) {
+                kfree_skb(*slot);
+                *slot = NULL;
+            }
+        }
+    }
+}
+/*--------------------------------------------------------------------------*/
+
+// Takes the oldest period off the ring if it is complete.  Caller must hold
+// pcm->lock, and must be done with period before releasing it, as its slot is
+// then free to be reused
+static int cco_pcm_get_period(struct cco_pcm *pcm,
+                              struct cco_pcm_period **result)
+{
+    if (pcm->tail_seqnum == pcm->seqnum)
+        return -ENODATA;
+
+    struct cco_pcm_period *period = cco_pcm_period(pcm, pcm->tail_seqnum);
+    if (!cco_pcm_period_complete(pcm, period))
+        return -ENODATA;
+
+    pcm->tail_seqnum++;
+    atomic_dec(&pcm->periods_ready);
+    *result = period;
+
+    cco_pcm_check_periods(pcm);
+
+    return 0;
+}
+
+// Note:
+//
+// Samples that need converting between ALSA's format and the wire format go
+// through a small bounce buffer on the stack, so that they are still only
+// touched once on their way between userspace and the sk_buff.  Samples that
+// ALSA presents already in the wire format are copied directly.
+#define CCO_PCM_BOUNCE_SAMPLES 64
+
+// Converts samples from iter into dst, returns the number of bytes of iter
+// consumed
+static size_t cco_pcm_convert_from_iter(const struct cco_conversion *conv,
+                                        char *dst, size_t bytes,
+                                        struct iov_iter *iter)
+{
+    char bounce[CCO_PCM_BOUNCE_SAMPLES * 4];
+
+    size_t done = 0;
+    while (done < bytes) {
+        size_t len = min_t(size_t, bytes - done,
+                           CCO_PCM_BOUNCE_SAMPLES * conv->src_size);
+        size_t copied = copy_from_iter(bounce, len, iter);
+
+        unsigned samples = copied / conv->src_size;
+        cco_convert(conv, dst, bounce, samples);
+        dst += samples * conv->dst_size;
+        done += copied;
+
+        if (copied != len)
+            break;
+    }
+
+    return done;
+}
+
+// Converts samples from src into iter, returns the number of bytes of iter
+// produced
+static size_t cco_pcm_convert_to_iter(const struct cco_conversion *conv,
+                                      const char *src, size_t bytes,
+                                      struct iov_iter *iter)
+{
+    char bounce[CCO_PCM_BOUNCE_SAMPLES * 4];
+
+    size_t done = 0;
+    while (done < bytes) {
+        size_t len = min_t(size_t, bytes - done,
+                           CCO_PCM_BOUNCE_SAMPLES * conv->dst_size);
+
+        unsigned samples = len / conv->dst_size;
+        cco_convert(conv, bounce, src, samples);
+        src += samples * conv->src_size;
+
+        size_t copied = copy_to_iter(bounce, len, iter);
+        done += copied;
+
+        if (copied != len)
+            break;
+    }
+
+    return done;
+}
+
+// De-interleaves frames of channels samples from iter into dsts, converting
+// them for the wire, returns the number of bytes of iter consumed
+static size_t cco_pcm_deinterleave_from_iter(const struct cco_conversion *conv,
+                                             char *dsts[], unsigned channels,
+                                             size_t bytes,
+                                             struct iov_iter *iter)
+{
+    char bounce[CCO_PCM_BOUNCE_SAMPLES * 4];
+    const unsigned frame_bytes = channels * conv->src_size;
+    const size_t chunk = (CCO_PCM_BOUNCE_SAMPLES / channels) * frame_bytes;
+
+    void *outs[CCO_MAX_CHANNELS];
+    for (unsigned c = 0; c < channels; ++c) {
+        outs[c] = dsts[c];
+    }
+
+    size_t done = 0;
+    while (done < bytes) {
+        size_t len = min_t(size_t, bytes - done, chunk);
+        size_t copied = copy_from_iter(bounce, len, iter);
+
+        unsigned frames = copied / frame_bytes;
+        cco_convert_deinterleave(conv, outs, bounce, channels, frames);
+        for (unsigned c = 0; c < channels; ++c) {
+            outs[c] += frames * conv->dst_size;
+        }
+        done += copied;
+
+        if (copied != len)
+            break;
+    }
+
+    return done;
+}
+
 static int cco_pcm_put_samples(struct cco_pcm *pcm, int channel,
                                struct iov_iter *iter, unsigned long bytes)
 {
     int err;
 
-    struct list_head **cursor = &pcm->cursors[channel];
-    struct cco_pcm_period *period = list_entry(*cursor, struct cco_pcm_period, list);
+    mutex_lock(&pcm->lock);
 
-    if (list_is_head(*cursor, &pcm->periods) ||
-        period->sizes[channel] >= sizeof(ChannelPcmData_t))
-    {
-        err = cco_pcm_advance_cursor(pcm, channel);
-        if (err < 0)
-            goto exit_error;
-    }
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    uint32_t *fill_seqnum = &pcm->fill_seqnums[channel];
 
     while (bytes > 0) {
-        period = list_entry(*cursor, struct cco_pcm_period, list);
+        // This channel is first to reach the next period, start it
+        if (*fill_seqnum == pcm->seqnum) {
+            err = cco_pcm_push_period(pcm);
+            if (err < 0)
+                goto exit_error;
+        }
+
+        struct cco_pcm_period *period = cco_pcm_period(pcm, *fill_seqnum);
         unsigned *size = &period->sizes[channel];
 
         // Note:
         //
         // get_cco_msg() in protocol.h would normally be used to fetch a pointer
-        // to a CCO header.  However, the current logic for building sk_buff's
-        // mutates the data pointer and breaks it for packets that we build
-        // ourselves.
+        // to a CCO header.  However, the data pointer of sk_buff's we build
+        // ourselves points at the link headers, so get_built_cco_msg() strides
+        // over them instead
+        struct sk_buff *skb = period->skbs[pcm_layout_msg(layout, channel)];
+        Msg_t *msg = get_built_cco_msg(skb);
+        char *channel_data = pcm_layout_channel(layout, msg->payload, channel);
+        char *start = channel_data + *size * pcm_sample_size(layout->format);
+
+        // Convert sample data into appropriate place in skb
         //
-        // For now, we hack around this by manually striding over the eth header
-        Msg_t *msg = (Msg_t *)(period->skb->data + ETH_HLEN);
-        PcmDataMsg_t *pcm_data_msg = (PcmDataMsg_t *)msg->payload;
-        char *channel_data = pcm_data_msg->channels[channel].data;
-        char *start = channel_data + *size;
-
-        // Copy sample data into appropriate place in skb
-        size_t remaining = min(bytes, sizeof(ChannelPcmData_t) - *size);
-        size_t copied = 0;
-        while (remaining > 0) {
-            copied += copy_from_iter(start + copied, remaining, iter);
-            remaining -= copied;
-        }
-        *size += copied;
+        // Note: *size counts samples, as their size differs between ALSA's
+        // format and the wire format
+        size_t remaining = min_t(size_t, bytes,
+                                 (layout->frames - *size) * pcm->sample_bytes);
+        size_t copied;
+        if (pcm->conversion)
+            copied = cco_pcm_convert_from_iter(pcm->conversion, start,
+                                               remaining, iter);
+        else
+            copied = copy_from_iter(start, remaining, iter);
+        if (copied != remaining) {
+            err = -EFAULT;
+            goto exit_error;
+        }
+        *size += copied / pcm->sample_bytes;
         bytes -= copied;
+        trace_cco_pcm_copy(pcm, channel, period->seqnum, copied);
+
+        if (*size < layout->frames)
+            continue;
+        (*fill_seqnum)++;
+
+        // If this channel was the last one outstanding, wake the pcm manager
+        if (cco_pcm_period_complete(pcm, period)) {
+            period->ts_complete = ktime_get();
+            pcm->stats.periods_queued++;
+            trace_cco_period_complete(pcm, period->seqnum, 0);
+            atomic_inc(&pcm->periods_ready);
+            wake_up(&pcm->dev->pcm_manager_wq);
+        }
+    }
+
+    cco_pcm_check_periods(pcm);
+
+    mutex_unlock(&pcm->lock);
+
+    return 0;
+
+exit_error:
+    mutex_unlock(&pcm->lock);
+    CCO_LOG_FUNCTION_FAILURE(err);
+    return err;
+}
+
+// Puts interleaved frames into every channel of the periods at once, so that
+// the channels fill each period in step
+static int cco_pcm_put_frames(struct cco_pcm *pcm, struct iov_iter *iter,
+                              unsigned long bytes)
+{
+    int err;
+
+    mutex_lock(&pcm->lock);
+
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    const unsigned frame_bytes = layout->channels * pcm->sample_bytes;
 
-        // Advance cursor if we've exhausted the space in this skb for a given channel
-        if (period->sizes[channel] >= sizeof(ChannelPcmData_t)) {
-            err = cco_pcm_advance_cursor(pcm, channel);
+    while (bytes > 0) {
+        if (pcm->fill_seqnums[0] == pcm->seqnum) {
+            err = cco_pcm_push_period(pcm);
             if (err < 0)
                 goto exit_error;
         }
+
+        // Locate every channel's place in the period's sk_buff's, see note in
+        // cco_pcm_put_samples()
+        struct cco_pcm_period *period = cco_pcm_period(pcm,
+                                                       pcm->fill_seqnums[0]);
+        unsigned size = period->sizes[0];
+        char *dsts[CCO_MAX_CHANNELS];
+        for (unsigned c = 0; c < layout->channels; ++c) {
+            struct sk_buff *skb = period->skbs[pcm_layout_msg(layout, c)];
+            Msg_t *msg = get_built_cco_msg(skb);
+            dsts[c] = pcm_layout_channel(layout, msg->payload, c) +
+                      size * pcm_sample_size(layout->format);
+        }
+
+        size_t remaining = min_t(size_t, bytes,
+                                 (layout->frames - size) * frame_bytes);
+        size_t copied = cco_pcm_deinterleave_from_iter(pcm->conversion, dsts,
+                                                       layout->channels,
+                                                       remaining, iter);
+        if (copied != remaining) {
+            err = -EFAULT;
+            goto exit_error;
+        }
+        size += copied / frame_bytes;
+        for (unsigned c = 0; c < layout->channels; ++c) {
+            period->sizes[c] = size;
+        }
+        bytes -= copied;
+        trace_cco_pcm_copy(pcm, -1, period->seqnum, copied);
+
+        if (size < layout->frames)
+            continue;
+        for (unsigned c = 0; c < layout->channels; ++c) {
+            pcm->fill_seqnums[c]++;
+        }
+
+        // Every channel was filled at once, so the period is complete
+        period->ts_complete = ktime_get();
+        pcm->stats.periods_queued++;
+        trace_cco_period_complete(pcm, period->seqnum, 0);
+        atomic_inc(&pcm->periods_ready);
+        wake_up(&pcm->dev->pcm_manager_wq);
     }
 
+    cco_pcm_check_periods(pcm);
+
+    mutex_unlock(&pcm->lock);
+
     return 0;
 
 exit_error:
+    mutex_unlock(&pcm->lock);
     CCO_LOG_FUNCTION_FAILURE(err);
     return err;
 }
@@ -317,8 +1263,103 @@ exit_error:
 static int cco_pcm_get_samples(struct cco_pcm *pcm, int channel,
                                struct iov_iter *iter, unsigned long bytes)
 {
-    // TODO
+    int err;
+
+    mutex_lock(&pcm->lock);
+
+    cco_pcm_capture_drain(pcm);
+
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    while (bytes > 0) {
+        uint32_t seqnum = pcm->read_seqnums[channel];
+        unsigned *offset = &pcm->read_offsets[channel];
+        size_t len = min_t(size_t, bytes,
+                           (layout->frames - *offset) * pcm->sample_bytes);
+
+        struct sk_buff *skb = NULL;
+        if (pcm->synced)
+            skb = *cco_pcm_capture_slot(pcm, seqnum,
+                                        pcm_layout_msg(layout, channel));
+
+        // Conceal the msg if it is missing as the period is started
+        //
+        // Note: periods preceding the first received are the jitter buffer
+        // filling up
+        if (!skb && pcm->synced && *offset == 0 &&
+            (int32_t)(seqnum - pcm->sync_seqnum) >= 0)
+        {
+            bool concealed = cco_pcm_capture_conceal(pcm, channel, seqnum);
+            pcm->concealing[channel] = concealed;
+            if (channel == 0) {
+                pcm->stats.gaps++;
+                if (concealed)
+                    pcm->stats.concealed++;
+            }
+        }
+
+        // Copy sample data out of skb or its concealment, or silence if
+        // neither exists
+        char *channel_data = NULL;
+        if (pcm->concealing[channel])
+            channel_data = pcm->conceal_buf +
+                           channel * layout->frames *
+                           pcm_sample_size(layout->format);
+        else if (skb)
+            channel_data = pcm_layout_channel(layout,
+                                              get_cco_msg(skb)->payload,
+                                              channel);
+
+        size_t copied;
+        if (channel_data) {
+            char *start = channel_data +
+                          *offset * pcm_sample_size(layout->format);
+            if (pcm->conversion)
+                copied = cco_pcm_convert_to_iter(pcm->conversion, start, len,
+                                                 iter);
+            else
+                copied = copy_to_iter(start, len, iter);
+        } else {
+            copied = iov_iter_zero(len, iter);
+        }
+        if (copied != len) {
+            err = -EFAULT;
+            goto exit_error;
+        }
+        *offset += copied / pcm->sample_bytes;
+        bytes -= copied;
+
+        // Move on to next period once this channel has read all of it, making
+        // the same adjustment as channel 0 did at this boundary
+        if (*offset >= layout->frames) {
+            // Hold on to the period just read, to conceal the next one from
+            if (pcm->conceal != CCO_PCM_CONCEAL_SILENCE) {
+                kfree_skb(pcm->last_skbs[channel]);
+                pcm->last_skbs[channel] = NULL;
+                if (skb && !pcm->concealing[channel])
+                    pcm->last_skbs[channel] = skb_get(skb);
+            }
+            pcm->concealing[channel] = false;
+
+            uint32_t tail = cco_pcm_capture_tail(pcm);
+            int *skew = &pcm->read_skews[pcm->read_indexes[channel]++ &
+                                         (pcm->num_slots - 1)];
+            if (channel == 0)
+                *skew = pcm->synced ? cco_pcm_capture_adjust(pcm) : 0;
+            pcm->read_seqnums[channel] += 1 + *skew;
+            *offset = 0;
+            if (pcm->synced)
+                cco_pcm_capture_release(pcm, tail);
+        }
+    }
+
+    mutex_unlock(&pcm->lock);
+
     return 0;
+
+exit_error:
+    mutex_unlock(&pcm->lock);
+    CCO_LOG_FUNCTION_FAILURE(err);
+    return err;
 }
 /*============================================================================*/
 
@@ -326,19 +1367,38 @@ static int cco_pcm_get_samples(struct cco_pcm *pcm, int channel,
 /*================================PCM interface===============================*/
 static const struct snd_pcm_hardware cco_pcm_hardware = {
     // General info
-    .info             = SNDRV_PCM_INFO_NONINTERLEAVED,
+    //
+    // Note: interleaved frames are de-interleaved as they are copied into the
+    // wire format, see cco_pcm_put_frames()
+    .info             = SNDRV_PCM_INFO_INTERLEAVED |
+                        SNDRV_PCM_INFO_NONINTERLEAVED,
 
     // Sample format
-    .formats          = SNDRV_PCM_FMTBIT_S24_BE,
+    //
+    // Note: the wire format is always 24-bit big-endian, see convert.c for how
+    // the others are converted
+    .formats          = SNDRV_PCM_FMTBIT_S24_BE |
+                        SNDRV_PCM_FMTBIT_S32_LE |
+                        SNDRV_PCM_FMTBIT_S24_3LE |
+                        SNDRV_PCM_FMTBIT_S16_LE,
 
     // Sampling rate
-    .rates            = SNDRV_PCM_RATE_48000,
-    .rate_min         = 48000,
-    .rate_max         = 48000,
+    //
+    // Note: narrowed to the rates supported by the session in open()
+    .rates            = SNDRV_PCM_RATE_44100 |
+                        SNDRV_PCM_RATE_48000 |
+                        SNDRV_PCM_RATE_88200 |
+                        SNDRV_PCM_RATE_96000 |
+                        SNDRV_PCM_RATE_176400 |
+                        SNDRV_PCM_RATE_192000,
+    .rate_min         = 44100,
+    .rate_max         = 192000,
 
     // Channels
-    .channels_min     = 2,
-    .channels_max     = 2,
+    //
+    // Note: narrowed to the channel count of the session in open()
+    .channels_min     = 1,
+    .channels_max     = CCO_MAX_CHANNELS,
 
     // Buffer params
     .buffer_bytes_max = 64*1024,
@@ -349,11 +1409,55 @@ static const struct snd_pcm_hardware cco_pcm_hardware = {
     .fifo_size        = 0,
 };
 
+// Source of the clock that paces the ALSA hardware pointer
+enum cco_pcm_clock {
+    CCO_PCM_CLOCK_FPGA,
+    CCO_PCM_CLOCK_HRTIMER,
+    CCO_PCM_CLOCK_JIFFIES,
+};
+
+// Parsed when written, as it's read without kernel_param_lock()
+static int clock_source = CCO_PCM_CLOCK_FPGA;
+
+static const char *const cco_pcm_clock_names[] = {
+    [CCO_PCM_CLOCK_FPGA]    = "fpga",
+    [CCO_PCM_CLOCK_HRTIMER] = "hrtimer",
+    [CCO_PCM_CLOCK_JIFFIES] = "jiffies",
+};
+
+static int set_clock_source(const char *val, const struct kernel_param *kp)
+{
+    int clock = sysfs_match_string(cco_pcm_clock_names, val);
+    if (clock < 0)
+        return clock;
+
+    WRITE_ONCE(clock_source, clock);
+    return 0;
+}
+
+static int get_clock_source(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%s\n",
+                   cco_pcm_clock_names[READ_ONCE(clock_source)]);
+}
+
+static const struct kernel_param_ops clock_source_ops = {
+    .set = set_clock_source,
+    .get = get_clock_source,
+};
+module_param_cb(clock_source, &clock_source_ops, NULL, 0644);
+MODULE_PARM_DESC(clock_source,
+                 "Clock pacing the PCM pointer: \"fpga\" (default, periods "
+                 "acknowledged by the card), \"hrtimer\" or \"jiffies\" "
+                 "(fallback, quantized to the tick)");
+
 // State to be allocated per-substream
 struct cco_pcm_impl {
     // Misc state
     spinlock_t lock;
+    enum cco_pcm_clock clock;
     struct timer_list timer;
+    struct hrtimer hrtimer;
     struct snd_pcm_substream *substream;
 
     // Buffer state
@@ -364,12 +1468,39 @@ struct cco_pcm_impl {
     unsigned int frac_period_size; /* period_size * HZ */
     unsigned int rate;
     int elapsed;
+
+    // High resolution timer state
+    bool hr_running;
+    ktime_t hr_base_time;          /* when the stream was started */
+    uint64_t hr_periods;           /* periods elapsed since hr_base_time */
+    snd_pcm_uframes_t buffer_size;
+    snd_pcm_uframes_t period_size;
+
+    // FPGA clock state
+    bool fpga_running;
+    uint64_t fpga_frames;          /* frames played out by the card */
+    uint64_t fpga_periods;         /* ALSA periods reported as elapsed */
 };
 
 // Defined in "Timer handling" section
 static void cco_pcm_timer_callback(struct timer_list *t);
 static void cco_pcm_timer_rearm(struct cco_pcm_impl *impl);
 static void cco_pcm_timer_update(struct cco_pcm_impl *impl);
+static enum hrtimer_restart cco_pcm_hrtimer_callback(struct hrtimer *t);
+static void cco_pcm_hrtimer_start(struct cco_pcm_impl *impl);
+static void cco_pcm_hrtimer_stop(struct cco_pcm_impl *impl);
+static snd_pcm_uframes_t cco_pcm_hrtimer_pointer(struct cco_pcm_impl *impl);
+
+// Defined in "FPGA clock" section
+static void cco_pcm_fpga_start(struct cco_pcm_impl *impl);
+static void cco_pcm_fpga_stop(struct cco_pcm_impl *impl);
+static snd_pcm_uframes_t cco_pcm_fpga_pointer(struct cco_pcm_impl *impl);
+
+// Defined in "Zero-copy playback" section
+static void cco_pcm_zero_copy_attach(struct cco_pcm *pcm,
+                                     struct snd_pcm_runtime *runtime,
+                                     bool paged);
+static void cco_pcm_zero_copy_detach(struct cco_pcm *pcm);
 
 static int cco_pcm_open(struct snd_pcm_substream *substream)
 {
@@ -386,7 +1517,10 @@ static int cco_pcm_open(struct snd_pcm_substream *substream)
     }
     impl->substream = substream;
     spin_lock_init(&impl->lock);
+    impl->clock = READ_ONCE(clock_source);
     timer_setup(&impl->timer, cco_pcm_timer_callback, 0);
+    hrtimer_init(&impl->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_HARD);
+    impl->hrtimer.function = cco_pcm_hrtimer_callback;
 
     struct snd_pcm_runtime *runtime = substream->runtime;
     runtime->private_data = impl;
@@ -398,8 +1532,78 @@ static int cco_pcm_open(struct snd_pcm_substream *substream)
     if (substream->pcm->device & 2)
         runtime->hw.info &= ~(SNDRV_PCM_INFO_MMAP | SNDRV_PCM_INFO_MMAP_VALID);
 
+    // Make substream visible to PCM ctl msgs arriving from the FPGA
+    struct cco_device *dev = snd_pcm_substream_chip(substream);
+    struct cco_pcm *pcm;
+    if (substream->pcm == dev->playback.pcm) {
+        pcm = &dev->playback;
+    } else if (substream->pcm == dev->capture.pcm) {
+        pcm = &dev->capture;
+    } else {
+        err = -ENODEV;
+        goto undo_alloc_impl;
+    }
+
+    // Capture is only read out channel by channel
+    if (pcm == &dev->capture)
+        runtime->hw.info &= ~SNDRV_PCM_INFO_INTERLEAVED;
+
+    // Every channel carried on the wire must be written or read, so that
+    // periods are complete
+    const struct cco_pcm_layout *layout = cco_pcm_layout(pcm);
+    runtime->hw.channels_min = layout->channels;
+    runtime->hw.channels_max = layout->channels;
+
+    // Only offer the rates the FPGA can clock its S/PDIF transmitter at, and
+    // as playback & capture share that clock, only the rate the other stream
+    // is already configured for
+    struct cco_pcm *other = pcm == &dev->playback ? &dev->capture
+                                                  : &dev->playback;
+    uint8_t rates = dev->session->pcm_rates ?: PCM_RATE_CAP(CCO_DEFAULT_RATE);
+    unsigned other_rate = READ_ONCE(other->rate);
+    runtime->hw.rates = 0;
+    for (uint8_t rate = 0; rate < PCM_RATE_COUNT; ++rate) {
+        if (!(rates & PCM_RATE_CAP(rate)))
+            continue;
+        if (other_rate && pcm_rate_hz(rate) != other_rate)
+            continue;
+        runtime->hw.rates |= snd_pcm_rate_to_rate_bit(pcm_rate_hz(rate));
+    }
+    if (!runtime->hw.rates) {
+        err = -EBUSY;
+        goto undo_alloc_impl;
+    }
+    snd_pcm_limit_hw_rates(runtime);
+
+    // ALSA periods must line up with the periods negotiated for the wire, so
+    // that period boundaries reported by the FPGA fall on ALSA's and zero-copy
+    // playback can send every period from a whole run of frames
+    err = snd_pcm_hw_constraint_step(runtime, 0,
+                                     SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+                                     layout->frames);
+    if (err < 0)
+        goto undo_alloc_impl;
+
+    err = snd_pcm_hw_constraint_step(runtime, 0,
+                                     SNDRV_PCM_HW_PARAM_BUFFER_SIZE,
+                                     layout->frames);
+    if (err < 0)
+        goto undo_alloc_impl;
+
+    if (pcm->zero_copy) {
+        runtime->hw.info |= SNDRV_PCM_INFO_MMAP |
+                            SNDRV_PCM_INFO_MMAP_VALID |
+                            SNDRV_PCM_INFO_SYNC_APPLPTR;
+    }
+
+    spin_lock_irq(&pcm->substream_lock);
+    pcm->substream = substream;
+    spin_unlock_irq(&pcm->substream_lock);
+
     return 0;
 
+undo_alloc_impl:
+    kfree(impl);
 exit_error:
     CCO_LOG_FUNCTION_FAILURE(err);
     return err;
@@ -423,9 +1627,23 @@ static int cco_pcm_close(struct snd_pcm_substream *substream)
         goto exit_error;
     }
 
-    cco_pcm_reset(pcm);
+    spin_lock_irq(&pcm->substream_lock);
+    pcm->substream = NULL;
+    spin_unlock_irq(&pcm->substream_lock);
+
+    mutex_lock(&pcm->lock);
+    if (pcm == &dev->playback)
+        cco_pcm_reset(pcm);
+    else
+        cco_pcm_capture_reset(pcm);
+    mutex_unlock(&pcm->lock);
 
-    kfree(substream->runtime->private_data);
+    // Make sure no timer callback outlives the substream state
+    struct cco_pcm_impl *impl = substream->runtime->private_data;
+    hrtimer_cancel(&impl->hrtimer);
+    del_timer_sync(&impl->timer);
+
+    kfree(impl);
 
     return 0;
 
@@ -440,9 +1658,83 @@ static int cco_pcm_hw_params(struct snd_pcm_substream *substream,
     //printk(KERN_INFO "cco_pcm_hw_params(0x%px, 0x%px)\n",
     //       substream, hw_params);
 
+    int err;
+
+    struct cco_device *dev = snd_pcm_substream_chip(substream);
+    unsigned periods = DIV_ROUND_UP(params_buffer_size(hw_params),
+                                    dev->session->pcm_layout.frames);
+
+    // Note: the FPGA is told the rate in the PCM ctl msg sent on start
+    struct cco_pcm *pcm = substream->pcm == dev->playback.pcm ? &dev->playback
+                                                              : &dev->capture;
+    WRITE_ONCE(pcm->rate, params_rate(hw_params));
+
+    if (dev->playback.zero_copy && substream->pcm == dev->playback.pcm) {
+        // Samples are sent from the ALSA buffer, nothing to preallocate
+        err = 0;
+    } else if (substream->pcm == dev->playback.pcm) {
+        // Size ring to cover the whole ALSA buffer, plus one period being
+        // filled
+        err = cco_pcm_alloc_periods(&dev->playback, periods + 1);
+    } else {
+        // Capture holds on to received periods until every channel is read
+        err = cco_pcm_capture_alloc_slots(&dev->capture, periods);
+    }
+    if (err < 0)
+        goto exit_error;
+
+    return 0;
+
+exit_error:
+    CCO_LOG_FUNCTION_FAILURE(err);
+    return err;
+}
+
+static int cco_pcm_hw_free(struct snd_pcm_substream *substream)
+{
+    //printk(KERN_INFO "cco_pcm_hw_free(0x%px)\n", substream);
+
+    struct cco_device *dev = snd_pcm_substream_chip(substream);
+    if (substream->pcm == dev->playback.pcm)
+        WRITE_ONCE(dev->playback.rate, 0);
+    else
+        WRITE_ONCE(dev->capture.rate, 0);
+
+    if (dev->playback.zero_copy && substream->pcm == dev->playback.pcm)
+        cco_pcm_zero_copy_detach(&dev->playback);
+    else if (substream->pcm == dev->playback.pcm)
+        cco_pcm_free_periods(&dev->playback);
+    else
+        cco_pcm_capture_free_slots(&dev->capture);
+
     return 0;
 }
 
+// Selects how samples are converted between format and the wire format.
+// Caller must hold pcm->lock
+static void cco_pcm_set_format(struct cco_pcm *pcm, snd_pcm_format_t format,
+                               bool is_playback, bool interleaved)
+{
+    uint8_t wire_format = pcm->dev->session->pcm_format;
+
+    pcm->sample_bytes = snd_pcm_format_physical_width(format) / 8;
+    pcm->interleaved = interleaved;
+
+    // S24_BE is laid out exactly as the padded wire format, copy it directly
+    // unless it needs de-interleaving
+    if (format == SNDRV_PCM_FORMAT_S24_BE &&
+        wire_format == PCM_FORMAT_S24_PADDED && !interleaved)
+    {
+        pcm->conversion = NULL;
+        return;
+    }
+
+    if (is_playback)
+        pcm->conversion = cco_conversion_to_wire(format, wire_format);
+    else
+        pcm->conversion = cco_conversion_from_wire(format, wire_format);
+}
+
 static int cco_pcm_prepare(struct snd_pcm_substream *substream)
 {
     //printk(KERN_INFO "cco_pcm_prepare(0x%px)\n", substream);
@@ -457,6 +1749,56 @@ static int cco_pcm_prepare(struct snd_pcm_substream *substream)
     impl->frac_period_rest = impl->frac_period_size;
     impl->elapsed = 0;
 
+    impl->buffer_size = runtime->buffer_size;
+    impl->period_size = runtime->period_size;
+
+    // FPGA acknowledgements are counted from the first period of this stream
+    struct cco_device *dev = snd_pcm_substream_chip(substream);
+    if (substream->pcm == dev->playback.pcm) {
+        mutex_lock(&dev->playback.lock);
+        dev->playback.start_seqnum = dev->playback.seqnum;
+        WRITE_ONCE(dev->playback.xmit_seqnum, dev->playback.seqnum);
+        cco_pcm_set_format(&dev->playback, runtime->format, true,
+                           runtime->access == SNDRV_PCM_ACCESS_RW_INTERLEAVED ||
+                           runtime->access ==
+                           SNDRV_PCM_ACCESS_MMAP_INTERLEAVED);
+        if (dev->playback.zero_copy)
+            cco_pcm_zero_copy_attach(&dev->playback, runtime,
+                                     impl->clock == CCO_PCM_CLOCK_FPGA);
+        mutex_unlock(&dev->playback.lock);
+    } else {
+        dev->capture.start_seqnum = READ_ONCE(dev->capture.acked_seqnum);
+        dev->capture.period_ns = div_u64(
+            (uint64_t)cco_pcm_layout(&dev->capture)->frames * NSEC_PER_SEC,
+            runtime->rate
+        );
+
+        // Drop anything left over from a previous run of the stream
+        mutex_lock(&dev->capture.lock);
+        cco_pcm_capture_reset(&dev->capture);
+        cco_pcm_set_format(&dev->capture, runtime->format, false, false);
+        dev->capture.conceal = READ_ONCE(capture_conceal);
+        mutex_unlock(&dev->capture.lock);
+    }
+
+    return 0;
+}
+
+static int cco_pcm_sync_stop(struct snd_pcm_substream *substream)
+{
+    //printk(KERN_INFO "cco_pcm_sync_stop(0x%px)\n", substream);
+
+    struct cco_pcm_impl *impl = substream->runtime->private_data;
+
+    // Wait out any timer callback that raced with SNDRV_PCM_TRIGGER_STOP
+    //
+    // Note: the FPGA clock needs no handling here, cco_pcm_handle_ctl() runs
+    // entirely under pcm->substream_lock
+    if (impl->clock == CCO_PCM_CLOCK_HRTIMER)
+        hrtimer_cancel(&impl->hrtimer);
+    else if (impl->clock == CCO_PCM_CLOCK_JIFFIES)
+        del_timer_sync(&impl->timer);
+
     return 0;
 }
 
@@ -489,8 +1831,14 @@ static int cco_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
             send_pcm_ctl(session);
 
             spin_lock(&impl->lock);
-            impl->base_time = jiffies;
-            cco_pcm_timer_rearm(impl);
+            if (impl->clock == CCO_PCM_CLOCK_FPGA) {
+                cco_pcm_fpga_start(impl);
+            } else if (impl->clock == CCO_PCM_CLOCK_HRTIMER) {
+                cco_pcm_hrtimer_start(impl);
+            } else {
+                impl->base_time = jiffies;
+                cco_pcm_timer_rearm(impl);
+            }
             spin_unlock(&impl->lock);
             break;
 
@@ -502,7 +1850,12 @@ static int cco_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
             send_pcm_ctl(session);
 
             spin_lock(&impl->lock);
-            del_timer(&impl->timer);
+            if (impl->clock == CCO_PCM_CLOCK_FPGA)
+                cco_pcm_fpga_stop(impl);
+            else if (impl->clock == CCO_PCM_CLOCK_HRTIMER)
+                cco_pcm_hrtimer_stop(impl);
+            else
+                del_timer(&impl->timer);
             spin_unlock(&impl->lock);
             break;
 
@@ -526,10 +1879,22 @@ static snd_pcm_uframes_t cco_pcm_pointer(struct snd_pcm_substream *substream)
     struct cco_pcm_impl *impl = substream->runtime->private_data;
 
     spin_lock(&impl->lock);
-    cco_pcm_timer_update(impl);
-    pos = impl->frac_pos / HZ;
+    if (impl->clock == CCO_PCM_CLOCK_FPGA) {
+        pos = cco_pcm_fpga_pointer(impl);
+    } else if (impl->clock == CCO_PCM_CLOCK_HRTIMER) {
+        pos = cco_pcm_hrtimer_pointer(impl);
+    } else {
+        cco_pcm_timer_update(impl);
+        pos = impl->frac_pos / HZ;
+    }
     spin_unlock(&impl->lock);
 
+    // Periods waiting in the jitter buffer have yet to reach the application
+    struct cco_device *dev = snd_pcm_substream_chip(substream);
+    if (substream->pcm == dev->capture.pcm)
+        substream->runtime->delay = READ_ONCE(dev->capture.jitter_depth) *
+                                    cco_pcm_layout(&dev->capture)->frames;
+
     return pos;
 }
 
@@ -554,7 +1919,10 @@ static int cco_pcm_copy(struct snd_pcm_substream *substream,
 
     struct cco_device *dev = snd_pcm_substream_chip(substream);
 
-    if (iov_iter_rw(iter) == WRITE) {
+    // Note: ALSA passes channel 0 for interleaved frames
+    if (iov_iter_rw(iter) == WRITE && dev->playback.interleaved) {
+        err = cco_pcm_put_frames(&dev->playback, iter, bytes);
+    } else if (iov_iter_rw(iter) == WRITE) {
         err = cco_pcm_put_samples(&dev->playback, channel, iter, bytes);
     } else {
         err = cco_pcm_get_samples(&dev->capture, channel, iter, bytes);
@@ -574,7 +1942,9 @@ static const struct snd_pcm_ops cco_pcm_ops = {
     .open         = cco_pcm_open,
     .close        = cco_pcm_close,
     .hw_params    = cco_pcm_hw_params,
+    .hw_free      = cco_pcm_hw_free,
     .prepare      = cco_pcm_prepare,
+    .sync_stop    = cco_pcm_sync_stop,
     .trigger      = cco_pcm_trigger,
     .pointer      = cco_pcm_pointer,
     .fill_silence = cco_pcm_silence,
@@ -630,6 +2000,417 @@ static void cco_pcm_timer_update(struct cco_pcm_impl *impl)
 
     impl->frac_period_rest -= delta;
 }
+
+// Note:
+//
+// The jiffies-based timer above can only fire on tick boundaries (4ms with
+// HZ=250), which is coarser than a 128 frame period at 48kHz.  The hrtimer
+// below fires on exact period boundaries instead.
+//
+// Each boundary is computed from the absolute start time rather than by adding
+// a fixed interval to the previous expiry, because a period is generally not a
+// whole number of nanoseconds and the rounding error would otherwise build up.
+static ktime_t cco_pcm_hrtimer_boundary(struct cco_pcm_impl *impl,
+                                        uint64_t period)
+{
+    uint64_t ns = mul_u64_u32_div(period * impl->period_size, NSEC_PER_SEC,
+                                  impl->rate);
+    return ktime_add_ns(impl->hr_base_time, ns);
+}
+
+static enum hrtimer_restart cco_pcm_hrtimer_callback(struct hrtimer *t)
+{
+    struct cco_pcm_impl *impl = container_of(t, struct cco_pcm_impl, hrtimer);
+
+    if (!READ_ONCE(impl->hr_running))
+        return HRTIMER_NORESTART;
+
+    snd_pcm_period_elapsed(impl->substream);
+
+    // snd_pcm_period_elapsed() may have stopped the stream (e.g. on xrun)
+    if (!READ_ONCE(impl->hr_running))
+        return HRTIMER_NORESTART;
+
+    spin_lock(&impl->lock);
+    impl->hr_periods++;
+    hrtimer_set_expires(t, cco_pcm_hrtimer_boundary(impl, impl->hr_periods + 1));
+    spin_unlock(&impl->lock);
+
+    return HRTIMER_RESTART;
+}
+
+// Caller must hold impl->lock
+static void cco_pcm_hrtimer_start(struct cco_pcm_impl *impl)
+{
+    impl->hr_base_time = ktime_get();
+    impl->hr_periods = 0;
+    WRITE_ONCE(impl->hr_running, true);
+
+    hrtimer_start(&impl->hrtimer, cco_pcm_hrtimer_boundary(impl, 1),
+                  HRTIMER_MODE_ABS_HARD);
+}
+
+// Caller must hold impl->lock
+//
+// Note: runs in atomic context from trigger(), so this cannot wait for a
+// running callback.  That is left to cco_pcm_sync_stop()
+static void cco_pcm_hrtimer_stop(struct cco_pcm_impl *impl)
+{
+    WRITE_ONCE(impl->hr_running, false);
+    hrtimer_try_to_cancel(&impl->hrtimer);
+}
+
+// Caller must hold impl->lock
+static snd_pcm_uframes_t cco_pcm_hrtimer_pointer(struct cco_pcm_impl *impl)
+{
+    uint64_t delta = ktime_to_ns(ktime_sub(ktime_get(), impl->hr_base_time));
+    uint64_t frames = mul_u64_u32_div(delta, impl->rate, NSEC_PER_SEC);
+
+    uint32_t pos;
+    div_u64_rem(frames, impl->buffer_size, &pos);
+
+    return pos;
+}
+/*============================================================================*/
+
+
+/*=================================FPGA clock=================================*/
+// Note:
+//
+// Both host timers above run off the host's crystal, while the card plays out
+// samples at the rate of its own S/PDIF clock.  Over a long enough stream the
+// two drift apart and the buffer eventually over/underruns.
+//
+// With the FPGA clock, the hardware pointer only advances when the card reports
+// (via PCM ctl msgs) that it has played out another period, which makes the
+// card the clock master.  Capture is clocked by the same reports, which the
+// card sends while either stream is active.
+
+// Caller must hold impl->lock
+static void cco_pcm_fpga_start(struct cco_pcm_impl *impl)
+{
+    impl->fpga_frames = 0;
+    impl->fpga_periods = 0;
+    impl->fpga_running = true;
+}
+
+// Caller must hold impl->lock
+static void cco_pcm_fpga_stop(struct cco_pcm_impl *impl)
+{
+    impl->fpga_running = false;
+}
+
+// Caller must hold impl->lock
+static snd_pcm_uframes_t cco_pcm_fpga_pointer(struct cco_pcm_impl *impl)
+{
+    uint32_t pos;
+    div_u64_rem(impl->fpga_frames, impl->buffer_size, &pos);
+
+    return pos;
+}
+
+static void cco_pcm_fpga_ack(struct cco_pcm *pcm, uint32_t seqnum)
+{
+    WRITE_ONCE(pcm->acked_seqnum, seqnum);
+
+    if (pcm == &pcm->dev->playback)
+        cco_pcm_account_ack(pcm, seqnum);
+
+    unsigned long flags;
+    spin_lock_irqsave(&pcm->substream_lock, flags);
+
+    struct snd_pcm_substream *substream = pcm->substream;
+    if (!substream)
+        goto exit;
+
+    struct cco_pcm_impl *impl = substream->runtime->private_data;
+    if (impl->clock != CCO_PCM_CLOCK_FPGA)
+        goto exit;
+
+    bool elapsed = false;
+    spin_lock(&impl->lock);
+    if (impl->fpga_running) {
+        // Acks still in flight from a previous stream precede start_seqnum
+        //
+        // Note: for capture, "played" counts periods produced by the card
+        int32_t played = seqnum - pcm->start_seqnum;
+        if (played >= 0) {
+            impl->fpga_frames = (uint64_t)played * cco_pcm_layout(pcm)->frames;
+
+            uint64_t periods = div_u64(impl->fpga_frames, impl->period_size);
+            if (periods > impl->fpga_periods) {
+                impl->fpga_periods = periods;
+                elapsed = true;
+            }
+        }
+    }
+    spin_unlock(&impl->lock);
+
+    // Note: substream_lock is held so that close() cannot free the substream
+    // out from under us
+    if (elapsed)
+        snd_pcm_period_elapsed(substream);
+
+exit:
+    spin_unlock_irqrestore(&pcm->substream_lock, flags);
+}
+
+void cco_pcm_handle_ctl(struct cco_device *cco, PcmCtlMsg_t *msg)
+{
+    cco_pcm_fpga_ack(&cco->playback, ntohl(msg->playback_seqnum));
+    cco_pcm_fpga_ack(&cco->capture, ntohl(msg->capture_seqnum));
+}
+/*============================================================================*/
+
+
+/*=============================Zero-copy playback=============================*/
+
+// Note:
+//
+// In zero-copy mode, the playback buffer is allocated by the sound core and can
+// be mmap'd, so samples written by userspace (or by the sound core itself for
+// write()) land directly in it.  Every period's worth of frames committed is
+// sent as PCM data msgs whose sample data is made up of page fragments pointing
+// into the buffer, one per channel, so the CPU never copies samples.
+//
+// The layout is non-interleaved, so each channel occupies a contiguous region
+// of the buffer.  Period and buffer sizes are constrained to multiples of the
+// negotiated (power of two) frames per period in open(), which together with
+// the buffer being page aligned means that a channel's data never straddles a
+// page boundary.
+//
+// Userspace can overwrite a region once the hardware pointer has moved past it.
+// With the FPGA clock, that only happens once the FPGA has acknowledged playing
+// it, by which time the NIC is done with its page fragments.  The host clocks
+// move the pointer on regardless of the NIC, so with those every period is
+// copied out of the buffer into the sk_buff instead.
+//
+// When the wire format doesn't match the format userspace writes in, as with
+// PCM_FORMAT_S24_PACKED or any format other than S24_BE, each period is
+// converted straight out of the buffer into the sk_buff instead.
+//
+// Page fragments are thus only used for non-interleaved S24_BE samples on
+// sessions using PCM_FORMAT_S24_PADDED, which packed_format (see device.c)
+// turns down by default.  Otherwise each period is converted in a single pass,
+// as the copy path does in copy(), but into an sk_buff allocated on the spot
+// rather than one from the ring of preallocated periods (see "Buffer
+// Management" section).  What zero-copy mode does buy is mmap access to the
+// buffer, which dmix and some sound servers require.  It is off by default.
+static bool zero_copy = false;
+module_param(zero_copy, bool, 0444);
+MODULE_PARM_DESC(zero_copy,
+                 "Send playback samples straight out of the mmap'able ALSA "
+                 "buffer instead of copying them into sk_buff's, see note in "
+                 "pcm.c (default N)");
+
+// Caller must hold pcm->lock
+static void cco_pcm_zero_copy_attach(struct cco_pcm *pcm,
+                                     struct snd_pcm_runtime *runtime,
+                                     bool paged)
+{
+    pcm->paged = paged;
+    pcm->dma_area = runtime->dma_area;
+    pcm->dma_channel_bytes = runtime->dma_bytes / runtime->channels;
+    pcm->buffer_size = runtime->buffer_size;
+    pcm->boundary = runtime->boundary;
+
+    // Sound core resets appl_ptr to zero once prepare() returns
+    WRITE_ONCE(pcm->appl_ptr, 0);
+    WRITE_ONCE(pcm->xmit_ptr, 0);
+}
+
+static void cco_pcm_zero_copy_detach(struct cco_pcm *pcm)
+{
+    mutex_lock(&pcm->lock);
+
+    // Pages already attached to sk_buff's stay alive until they are sent
+    pcm->dma_area = NULL;
+    WRITE_ONCE(pcm->appl_ptr, 0);
+    WRITE_ONCE(pcm->xmit_ptr, 0);
+
+    mutex_unlock(&pcm->lock);
+}
+
+// Frames committed by userspace that have yet to be sent
+static unsigned long cco_pcm_zero_copy_avail(struct cco_pcm *pcm)
+{
+    long avail = READ_ONCE(pcm->appl_ptr) - READ_ONCE(pcm->xmit_ptr);
+    if (avail < 0)
+        avail += pcm->boundary;
+
+    return avail;
+}
+
+static bool cco_pcm_zero_copy_ready(struct cco_pcm *pcm)
+{
+    return pcm->zero_copy &&
+           cco_pcm_zero_copy_avail(pcm) >= cco_pcm_layout(pcm)->frames;
+}
+
+// Queues the period of non-interleaved frames starting at frame onto batch
+static int cco_pcm_zero_copy_queue(struct cco_pcm *pcm,
+                                   struct cco_session *session,
+                                   unsigned long frame,
+                                   struct sk_buff_head *batch)
+{
+    int err;
+
+    const struct cco_pcm_layout *layout = &session->pcm_layout;
+
+    // A period may be split across several msgs, see note in protocol.h
+    for (unsigned msg = 0; msg < layout->msgs_per_period; ++msg) {
+        unsigned first_channel = msg * layout->channels_per_msg;
+        unsigned channels = pcm_layout_msg_channels(layout, msg);
+
+        struct sk_buff *skb;
+        if (pcm->conversion || !pcm->paged) {
+            // Samples must be converted for the wire, which takes the place
+            // of the copy into the sk_buff, or copied as the pages can't be
+            // referenced safely
+            err = build_pcm_data(session, pcm->seqnum, msg, &skb);
+            if (err < 0)
+                return err;
+
+            Msg_t *cco_msg = get_built_cco_msg(skb);
+            for (unsigned i = first_channel; i < first_channel + channels;
+                 ++i)
+            {
+                unsigned char *start = pcm->dma_area +
+                                       i * pcm->dma_channel_bytes +
+                                       frame * pcm->sample_bytes;
+                char *dst = pcm_layout_channel(layout, cco_msg->payload, i);
+                if (pcm->conversion)
+                    cco_convert(pcm->conversion, dst, start, layout->frames);
+                else
+                    memcpy(dst, start, layout->frames * SAMPLE_SIZE);
+            }
+        } else {
+            // Locate the pages backing each channel's share of the msg
+            struct page *pages[CCO_MAX_CHANNELS];
+            unsigned offsets[CCO_MAX_CHANNELS];
+            for (unsigned i = 0; i < channels; ++i) {
+                unsigned char *start = pcm->dma_area +
+                                       (first_channel + i) *
+                                       pcm->dma_channel_bytes +
+                                       frame * SAMPLE_SIZE;
+                pages[i] = vmalloc_to_page(start);
+                offsets[i] = offset_in_page(start);
+            }
+
+            err = build_pcm_data_paged(session, pcm->seqnum, msg, pages,
+                                       offsets, &skb);
+            if (err < 0)
+                return err;
+        }
+
+        __skb_queue_tail(batch, skb);
+    }
+
+    return 0;
+}
+
+// Queues the period of interleaved frames starting at frame onto batch
+static int cco_pcm_zero_copy_deinterleave(struct cco_pcm *pcm,
+                                          struct cco_session *session,
+                                          unsigned long frame,
+                                          struct sk_buff_head *batch)
+{
+    int err;
+
+    const struct cco_pcm_layout *layout = &session->pcm_layout;
+    struct sk_buff *skbs[PCM_DATA_MAX_MSGS_PER_PERIOD] = { };
+    void *dsts[CCO_MAX_CHANNELS];
+    for (unsigned msg = 0; msg < layout->msgs_per_period; ++msg) {
+        err = build_pcm_data(session, pcm->seqnum, msg, &skbs[msg]);
+        if (err < 0)
+            goto undo_build;
+    }
+    for (unsigned c = 0; c < layout->channels; ++c) {
+        Msg_t *msg = get_built_cco_msg(skbs[pcm_layout_msg(layout, c)]);
+        dsts[c] = pcm_layout_channel(layout, msg->payload, c);
+    }
+
+    // Note: periods line up with the buffer's end, see open()
+    unsigned char *start = pcm->dma_area +
+                           frame * layout->channels * pcm->sample_bytes;
+    cco_convert_deinterleave(pcm->conversion, dsts, start, layout->channels,
+                             layout->frames);
+
+    for (unsigned msg = 0; msg < layout->msgs_per_period; ++msg) {
+        __skb_queue_tail(batch, skbs[msg]);
+    }
+
+    return 0;
+
+undo_build:
+    for (unsigned msg = 0; msg < layout->msgs_per_period; ++msg) {
+        kfree_skb(skbs[msg]);
+    }
+    CCO_LOG_FUNCTION_FAILURE(err);
+    return err;
+}
+
+// Queues every complete run of frames committed so far onto batch for sending.
+// Caller must hold pcm->lock
+static void cco_pcm_zero_copy_send(struct cco_pcm *pcm,
+                                   struct cco_session *session,
+                                   struct sk_buff_head *batch)
+{
+    int err;
+
+    const struct cco_pcm_layout *layout = &session->pcm_layout;
+    while (pcm->dma_area && cco_pcm_zero_copy_ready(pcm)) {
+        unsigned long frame = pcm->xmit_ptr % pcm->buffer_size;
+
+        // Interleaved frames are converted as they're de-interleaved, into
+        // every msg of the period at once
+        if (pcm->interleaved)
+            err = cco_pcm_zero_copy_deinterleave(pcm, session, frame, batch);
+        else
+            err = cco_pcm_zero_copy_queue(pcm, session, frame, batch);
+        if (err < 0)
+            goto exit_error;
+
+        pcm->stats.periods_queued++;
+        cco_pcm_account_xmit(pcm, pcm->seqnum++, READ_ONCE(pcm->ts_appl));
+
+        unsigned long xmit_ptr = pcm->xmit_ptr + layout->frames;
+        if (xmit_ptr >= pcm->boundary)
+            xmit_ptr -= pcm->boundary;
+        WRITE_ONCE(pcm->xmit_ptr, xmit_ptr);
+    }
+
+    return;
+
+exit_error:
+    CCO_LOG_FUNCTION_FAILURE(err);
+}
+
+// Called by the sound core whenever appl_ptr moves, including from write()
+static int cco_pcm_zero_copy_ack(struct snd_pcm_substream *substream)
+{
+    struct cco_device *dev = snd_pcm_substream_chip(substream);
+    struct cco_pcm *pcm = &dev->playback;
+
+    WRITE_ONCE(pcm->ts_appl, ktime_get());
+    WRITE_ONCE(pcm->appl_ptr, substream->runtime->control->appl_ptr);
+    wake_up(&dev->pcm_manager_wq);
+
+    return 0;
+}
+
+// Sound core handles copy & silence itself using the managed buffer
+static const struct snd_pcm_ops cco_pcm_zero_copy_ops = {
+    .open         = cco_pcm_open,
+    .close        = cco_pcm_close,
+    .hw_params    = cco_pcm_hw_params,
+    .hw_free      = cco_pcm_hw_free,
+    .prepare      = cco_pcm_prepare,
+    .sync_stop    = cco_pcm_sync_stop,
+    .trigger      = cco_pcm_trigger,
+    .pointer      = cco_pcm_pointer,
+    .ack          = cco_pcm_zero_copy_ack,
+};
 /*============================================================================*/
 
 
@@ -641,27 +2422,199 @@ static int pcm_manager(void * data)
     struct cco_device *dev = (struct cco_device *)data;
     struct cco_session *session = dev->session;
 
+    struct cco_pcm *pcm = &dev->playback;
+    struct sk_buff_head batch;
+    __skb_queue_head_init(&batch);
     while (!kthread_should_stop()) {
 
-        struct sk_buff *skb;
+        // Sleep until the copy path completes a period, or userspace commits
+        // one to the mmap'd buffer
+        wait_event_interruptible(dev->pcm_manager_wq,
+                                 atomic_read(&pcm->periods_ready) > 0 ||
+                                 cco_pcm_zero_copy_ready(pcm) ||
+                                 kthread_should_stop());
+
+        // Gather every period ready by now, so that they are sent as one batch
+        struct cco_pcm_period *period;
+        mutex_lock(&pcm->lock);
         while (true) {
-            err = cco_pcm_get_period(&dev->playback, &skb);
+            err = cco_pcm_get_period(pcm, &period);
             if (err == 0) {
-                packet_send(session, skb);
+                cco_pcm_account_xmit(pcm, period->seqnum, period->ts_complete);
+
+                // Keep our references so the sk_buff's can be recycled once
+                // the NIC is done with them, where it allows for that
+                bool recycle = can_recycle_pcm_data(session);
+                for (unsigned i = 0; i < cco_pcm_layout(pcm)->msgs_per_period;
+                     ++i)
+                {
+                    if (recycle) {
+                        __skb_queue_tail(&batch, skb_get(period->skbs[i]));
+                    } else {
+                        __skb_queue_tail(&batch, period->skbs[i]);
+                        period->skbs[i] = NULL;
+                    }
+                }
             } else if (err < 0 && err != -ENODATA) {
+                mutex_unlock(&pcm->lock);
                 goto exit_error;
             } else {
                 break;
             }
         }
+        if (pcm->zero_copy)
+            cco_pcm_zero_copy_send(pcm, session, &batch);
+
+        unsigned msgs = skb_queue_len(&batch);
+        if (msgs) {
+            pcm->stats.xmit_batches++;
+            pcm->stats.xmit_msgs += msgs;
+        }
+        mutex_unlock(&pcm->lock);
 
-        msleep(1);
+        packet_send_batch(session, &batch);
     }
 
     return 0;
 
 exit_error:
+    __skb_queue_purge(&batch);
     CCO_LOG_FUNCTION_FAILURE(err);
     return err;
 }
 /*============================================================================*/
+
+
+/*=================================Statistics=================================*/
+// Accounts for a playback period about to be handed to the NIC, caller must
+// hold pcm->lock
+static void cco_pcm_account_xmit(struct cco_pcm *pcm, uint32_t seqnum,
+                                 ktime_t ts_complete)
+{
+    // Account for time spent waiting to be transmitted
+    uint64_t latency = ktime_to_ns(ktime_sub(ktime_get(), ts_complete));
+    pcm->stats.periods_sent++;
+    pcm->stats.xmit_latency_total_ns += latency;
+    pcm->stats.xmit_latency_max_ns = max(pcm->stats.xmit_latency_max_ns,
+                                         latency);
+    trace_cco_period_dequeue(pcm, seqnum, latency);
+
+    // The FPGA has already played past this period
+    uint32_t acked = READ_ONCE(pcm->acked_seqnum);
+    if ((int32_t)(acked - pcm->start_seqnum) >= 0 &&
+        (int32_t)(seqnum - acked) <= 0)
+        pcm->stats.late_sent++;
+
+    WRITE_ONCE(pcm->ts_completed[seqnum % CCO_PCM_LATENCY_SLOTS], ts_complete);
+    WRITE_ONCE(pcm->xmit_seqnum, seqnum + 1);
+}
+
+// Accounts for a playback period the FPGA reported playing, called from softirq
+static void cco_pcm_account_ack(struct cco_pcm *pcm, uint32_t seqnum)
+{
+    if (!READ_ONCE(pcm->active) || (int32_t)(seqnum - pcm->start_seqnum) < 0)
+        return;
+
+    // The FPGA played a period we hadn't sent yet
+    if ((int32_t)(seqnum - READ_ONCE(pcm->xmit_seqnum)) >= 0) {
+        WRITE_ONCE(pcm->stats.underruns, pcm->stats.underruns + 1);
+        trace_cco_period_ack(pcm, seqnum, 0);
+        return;
+    }
+
+    // Each slot is cleared once accounted for, as the FPGA may report a seqnum
+    // more than once
+    ktime_t *slot = &pcm->ts_completed[seqnum % CCO_PCM_LATENCY_SLOTS];
+    ktime_t ts_complete = READ_ONCE(*slot);
+    if (!ts_complete)
+        return;
+    WRITE_ONCE(*slot, 0);
+
+    ktime_t latency = ktime_sub(ktime_get(), ts_complete);
+    unsigned us = clamp_t(s64, ktime_to_us(latency), 1, UINT_MAX);
+    unsigned bucket = min_t(unsigned, ilog2(us), CCO_PCM_LATENCY_BUCKETS - 1);
+    WRITE_ONCE(pcm->stats.latency_hist[bucket],
+               pcm->stats.latency_hist[bucket] + 1);
+    trace_cco_period_ack(pcm, seqnum, ktime_to_ns(latency));
+}
+
+static void cco_pcm_stats_show_pcm(struct seq_file *m, struct cco_pcm *pcm)
+{
+    struct cco_pcm_stats stats;
+    mutex_lock(&pcm->lock);
+    stats = pcm->stats;
+    mutex_unlock(&pcm->lock);
+
+    seq_printf(m, "  periods_queued:         %llu\n", stats.periods_queued);
+    seq_printf(m, "  periods_sent:           %llu\n", stats.periods_sent);
+    seq_printf(m, "  late_sent:              %llu\n", stats.late_sent);
+    seq_printf(m, "  underruns:              %llu\n", stats.underruns);
+    seq_printf(m, "  ring_overflows:         %llu\n", stats.ring_overflows);
+    seq_printf(m, "  periods_received:       %llu\n", stats.periods_received);
+    seq_printf(m, "  rx_drops:               %llu\n", stats.rx_drops);
+    seq_printf(m, "  late:                   %llu\n", stats.late);
+    seq_printf(m, "  overruns:               %llu\n", stats.overruns);
+    seq_printf(m, "  gaps:                   %llu\n", stats.gaps);
+    seq_printf(m, "  concealed:              %llu\n", stats.concealed);
+
+    if (pcm != &pcm->dev->playback) {
+        seq_printf(m, "  ring_depth:             %u/%u\n",
+                   kfifo_len(&pcm->ring), kfifo_size(&pcm->ring));
+        seq_printf(m, "  ring_max_depth:         %llu\n",
+                   stats.rx_ring_max_depth);
+        seq_printf(m, "  duplicates:             %llu\n", stats.duplicates);
+        seq_printf(m, "  reordered:              %llu\n", stats.reordered);
+        seq_printf(m, "  jitter_us:              %llu\n",
+                   div_u64(READ_ONCE(pcm->jitter_ns_16) >> 4, NSEC_PER_USEC));
+        seq_printf(m, "  jitter_depth:           %u\n",
+                   READ_ONCE(pcm->jitter_depth));
+        seq_printf(m, "  jitter_grows:           %llu\n", stats.jitter_grows);
+        seq_printf(m, "  jitter_shrinks:         %llu\n",
+                   stats.jitter_shrinks);
+        return;
+    }
+
+    uint64_t avg = 0;
+    if (stats.periods_sent)
+        avg = div64_u64(stats.xmit_latency_total_ns, stats.periods_sent);
+
+    seq_printf(m, "  xmit_latency_avg_ns:    %llu\n", avg);
+    seq_printf(m, "  xmit_latency_max_ns:    %llu\n",
+               stats.xmit_latency_max_ns);
+    seq_printf(m, "  xmit_msgs:              %llu\n", stats.xmit_msgs);
+    seq_printf(m, "  xmit_batches:           %llu\n", stats.xmit_batches);
+
+    seq_printf(m, "  latency_hist_us:\n");
+    for (unsigned i = 0; i < CCO_PCM_LATENCY_BUCKETS; ++i) {
+        if (i < CCO_PCM_LATENCY_BUCKETS - 1)
+            seq_printf(m, "    [%6u, %6u): %llu\n", 1u << i, 2u << i,
+                       stats.latency_hist[i]);
+        else
+            seq_printf(m, "    [%6u,    inf): %llu\n", 1u << i,
+                       stats.latency_hist[i]);
+    }
+}
+
+// Shown in the debugfs dir of the device's session, see note in device.c
+void cco_pcm_stats_show(struct seq_file *m, struct cco_device *cco)
+{
+    seq_printf(m, "playback:\n");
+    cco_pcm_stats_show_pcm(m, &cco->playback);
+    seq_printf(m, "capture:\n");
+    cco_pcm_stats_show_pcm(m, &cco->capture);
+}
+
+// Note: the stats live in debugfs alone, this only points ALSA users there
+static void cco_pcm_proc_read(struct snd_info_entry *entry,
+                              struct snd_info_buffer *buffer)
+{
+    struct cco_device *dev = entry->private_data;
+    snd_iprintf(buffer, "see /sys/kernel/debug/cco/session%d/stats\n",
+                dev->pdev.id);
+}
+/*============================================================================*/
+
+
+#if IS_ENABLED(CONFIG_SND_CCO_KUNIT_TEST)
+#include "pcm_kunit.c"
+#endif
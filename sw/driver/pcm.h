@@ -1,19 +1,168 @@
 #ifndef CCO_PCM_H
 #define CCO_PCM_H
 
-#include <linux/list.h>
+#include <linux/atomic.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
 
 #include "protocol.h"
 
+struct cco_conversion;
 struct cco_device;
+struct cco_pcm_period;
+struct seq_file;
+
+// Buckets of the end-to-end latency histogram, bucket n counting periods
+// played by the FPGA [2^n, 2^(n+1)) us after being completed, and the last
+// bucket counting every period beyond
+#define CCO_PCM_LATENCY_BUCKETS 16
+
+// Completion times kept for periods in flight, indexed by seqnum
+#define CCO_PCM_LATENCY_SLOTS 64
+
+struct cco_pcm_stats {
+    // Playback periods completed by the copy path, or committed to the mmap'd
+    // buffer
+    uint64_t periods_queued;
+
+    // Time from a period being completed by the copy path to it being batched
+    // for transmission
+    uint64_t periods_sent;
+    uint64_t xmit_latency_total_ns;
+    uint64_t xmit_latency_max_ns;
+
+    // PCM data msgs sent, and the number of batches they were sent in
+    uint64_t xmit_msgs;
+    uint64_t xmit_batches;
+
+    // Playback periods sent after the FPGA already reported playing them, and
+    // periods the FPGA played before they were sent
+    uint64_t late_sent;
+    uint64_t underruns;
+
+    // Playback periods dropped unsent to make room in the ring, see note in
+    // pcm.c
+    uint64_t ring_overflows;
+
+    // Time from a period being completed to the FPGA reporting it played
+    uint64_t latency_hist[CCO_PCM_LATENCY_BUCKETS];
+
+    // Capture periods, from reception in softirq to being read by copy()
+    uint64_t periods_received;
+    uint64_t rx_drops;          /* ring was full in softirq */
+    uint64_t rx_ring_max_depth;
+    uint64_t late;              /* arrived after every channel read past it */
+    uint64_t overruns;          /* arrived too far ahead of the reader */
+    uint64_t duplicates;
+    uint64_t reordered;
+    uint64_t gaps;              /* never arrived */
+    uint64_t concealed;         /* gap filled in from the periods around it */
+    uint64_t jitter_grows;      /* period read again to deepen jitter buffer */
+    uint64_t jitter_shrinks;    /* period skipped to shallow jitter buffer */
+};
+
+// Concealment of capture periods that never arrived, see note in pcm.c
+enum cco_pcm_conceal {
+    CCO_PCM_CONCEAL_SILENCE,
+    CCO_PCM_CONCEAL_REPEAT,
+    CCO_PCM_CONCEAL_FADE,
+    CCO_PCM_CONCEAL_CROSSFADE,
+};
 
 struct cco_pcm {
     struct snd_pcm *pcm;
-    struct list_head periods;
-    struct list_head *cursors[CHANNELS_PER_PACKET];
+    struct mutex lock;
     uint32_t seqnum;
+    uint32_t start_seqnum;
     bool active;
 
+    // Rate set by hw_params() in Hz, 0 while the substream isn't configured
+    unsigned rate;
+
+    // Substream currently open on this device, used by the FPGA clock
+    spinlock_t substream_lock;
+    struct snd_pcm_substream *substream;
+
+    // Most recent seqnum reported by the FPGA in a PCM ctl msg
+    uint32_t acked_seqnum;
+
+    // Seqnum of the next playback period to be handed to the NIC, and when
+    // each period in flight was completed, for the stats
+    uint32_t xmit_seqnum;
+    ktime_t ts_completed[CCO_PCM_LATENCY_SLOTS];
+
+    // Number of periods filled on every channel but not yet sent
+    atomic_t periods_ready;
+    struct cco_pcm_stats stats;
+
+    // Playback periods being filled or waiting to be sent, a ring allocated
+    // in hw_params() and indexed by seqnum, see note in pcm.c
+    struct cco_pcm_period *periods;
+    unsigned num_periods;                    /* a power of two */
+    uint32_t tail_seqnum;                    /* oldest period in the ring */
+    uint32_t fill_seqnums[CCO_MAX_CHANNELS]; /* period each channel fills */
+
+    // Capture periods received in softirq, single producer/single consumer
+    DECLARE_KFIFO_PTR(ring, struct sk_buff *);
+
+    // Capture periods drained from ring, indexed by seqnum for reordering
+    //
+    // Note: each slot holds one sk_buff per PCM data msg making up a period
+    struct sk_buff **slots;
+    unsigned num_slots;
+    unsigned slot_msgs;
+    bool synced;
+    uint32_t head_seqnum;
+    uint32_t read_seqnums[CCO_MAX_CHANNELS];
+    unsigned read_offsets[CCO_MAX_CHANNELS]; /* in samples */
+
+    // Capture jitter buffer, see note in pcm.c
+    //
+    // Note: arrivals are measured in softirq, which alone writes their state
+    // (reset at its request through arrival_reset), the rest is guarded by lock
+    uint64_t period_ns;
+    atomic_t arrival_reset;
+    uint32_t arrival_seqnum;
+    ktime_t arrival_ts;
+    uint64_t jitter_ns_16;         /* interarrival jitter, scaled by 16 */
+    uint32_t sync_seqnum;
+    unsigned jitter_lag;           /* periods the reader is held back by */
+    unsigned jitter_depth;         /* periods received ahead of the reader */
+    unsigned jitter_min_depth;
+    unsigned jitter_window;
+    int *read_skews;               /* adjustment at each period boundary */
+    uint32_t read_indexes[CCO_MAX_CHANNELS];
+
+    // Capture loss concealment, see note in pcm.c
+    enum cco_pcm_conceal conceal;
+    struct sk_buff *last_skbs[CCO_MAX_CHANNELS]; /* last period read */
+    bool concealing[CCO_MAX_CHANNELS];
+    char *conceal_buf;             /* one period per channel, wire format */
+
+    // Conversion between the runtime's format and the wire format, NULL when
+    // samples can be copied as is
+    const struct cco_conversion *conversion;
+    unsigned sample_bytes;
+
+    // Whether playback is written as interleaved frames, which are always
+    // converted as they are de-interleaved
+    bool interleaved;
+
+    // Zero-copy playback, periods are sent straight out of the ALSA buffer,
+    // referencing its pages only when paged, see note in pcm.c
+    bool zero_copy;
+    bool paged;
+    unsigned char *dma_area;
+    unsigned long dma_channel_bytes; /* size of each channel's region, when
+                                        not interleaved */
+    unsigned long buffer_size;       /* in frames */
+    unsigned long boundary;
+    unsigned long appl_ptr;          /* as last reported by ack() */
+    unsigned long xmit_ptr;          /* first frame not yet sent */
+    ktime_t ts_appl;
+
     struct cco_device *dev;
 };
 
@@ -21,4 +170,13 @@ struct cco_pcm {
 int cco_pcm_init(struct cco_device *cco);
 void cco_pcm_exit(struct cco_device *cco);
 
+// Capture
+int cco_pcm_put_period(struct cco_pcm *pcm, struct sk_buff *skb);
+
+// FPGA clock
+void cco_pcm_handle_ctl(struct cco_device *cco, PcmCtlMsg_t *msg);
+
+// Statistics
+void cco_pcm_stats_show(struct seq_file *m, struct cco_device *cco);
+
 #endif
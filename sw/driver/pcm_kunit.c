@@ -0,0 +1,334 @@
+// KUnit tests of the playback ring, which pcm.c includes w/
+// CONFIG_SND_CCO_KUNIT_TEST so that its statics can be reached, see Kconfig
+//
+// Samples are put through cco_pcm_put_samples() one channel at a time, as
+// ALSA's copy() does for non-interleaved buffers, and taken back out of the
+// periods' sk_buff's through cco_pcm_get_period().  The device is set up
+// through cco_pcm_init() and its ring through cco_pcm_alloc_periods(), as a
+// handshake & hw_params() would.  Its session is bound to an ethernet netdev
+// that is never registered, so nothing is sent.
+#include <kunit/test.h>
+#include <linux/device.h>
+#include <linux/etherdevice.h>
+#include <linux/prandom.h>
+#include <linux/uio.h>
+
+#define CCO_PCM_TEST_SEED 0xcc0
+
+struct cco_pcm_test {
+    struct cco_device dev;
+    struct cco_session session;
+    struct device *parent; /* of the card */
+    struct rnd_state rnd;
+};
+
+static int cco_pcm_test_init(struct kunit *test)
+{
+    int err;
+
+    struct cco_pcm_test *t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+    if (!t)
+        return -ENOMEM;
+    test->priv = t;
+
+    t->session.netdev = alloc_etherdev(0);
+    if (!t->session.netdev)
+        return -ENOMEM;
+    eth_hw_addr_random(t->session.netdev);
+    eth_random_addr(t->session.mac);
+    t->session.pcm_format = PCM_FORMAT_S24_PADDED;
+    t->session.dev = &t->dev;
+    t->dev.session = &t->session;
+
+    // The device is set up as cco_probe() does, on a card of its own
+    t->parent = root_device_register("cco_pcm_test");
+    if (IS_ERR(t->parent)) {
+        err = PTR_ERR(t->parent);
+        t->parent = NULL;
+        return err;
+    }
+
+    err = snd_card_new(t->parent, -1, NULL, THIS_MODULE, 0, &t->dev.card);
+    if (err < 0)
+        return err;
+
+    err = cco_pcm_init(&t->dev);
+    if (err < 0)
+        return err;
+
+    // The tests take periods in place of the pcm manager
+    kthread_stop(t->dev.pcm_manager_task);
+    t->dev.pcm_manager_task = NULL;
+
+    prandom_seed_state(&t->rnd, CCO_PCM_TEST_SEED);
+
+    return 0;
+}
+
+static void cco_pcm_test_exit(struct kunit *test)
+{
+    struct cco_pcm_test *t = test->priv;
+    if (!t)
+        return;
+
+    // As hw_free() would
+    cco_pcm_free_periods(&t->dev.playback);
+
+    if (t->dev.playback.pcm)
+        cco_pcm_exit(&t->dev);
+    if (t->dev.card)
+        snd_card_free(t->dev.card);
+    if (t->parent)
+        root_device_unregister(t->parent);
+    if (t->session.netdev)
+        free_netdev(t->session.netdev);
+}
+
+// Lays out periods of channels as the handshake would, in a ring of
+// num_periods
+static void cco_pcm_test_start(struct kunit *test, unsigned channels,
+                               unsigned num_periods)
+{
+    struct cco_pcm_test *t = test->priv;
+
+    pcm_layout_init(&t->session.pcm_layout, PCM_FORMAT_S24_PADDED, channels,
+                    CCO_DEFAULT_PERIOD_FRAMES);
+    KUNIT_ASSERT_EQ(test, cco_pcm_alloc_periods(&t->dev.playback, num_periods),
+                    0);
+}
+
+// Sample n of channel's stream
+static int32_t cco_pcm_test_sample(unsigned channel, unsigned n)
+{
+    return channel << 20 | (n & 0xfffff);
+}
+
+// Puts samples [first, first + count) of channel
+static int cco_pcm_test_put(struct kunit *test, unsigned channel,
+                            unsigned first, unsigned count)
+{
+    struct cco_pcm_test *t = test->priv;
+
+    char *samples = kunit_kmalloc_array(test, count, SAMPLE_SIZE, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, samples);
+    for (unsigned i = 0; i < count; ++i) {
+        cco_pcm_set_wire_sample(samples + i * SAMPLE_SIZE, SAMPLE_SIZE,
+                                cco_pcm_test_sample(channel, first + i));
+    }
+
+    struct kvec kvec = {
+        .iov_base = samples,
+        .iov_len = count * SAMPLE_SIZE,
+    };
+    struct iov_iter iter;
+    iov_iter_kvec(&iter, ITER_SOURCE, &kvec, 1, kvec.iov_len);
+    int err = cco_pcm_put_samples(&t->dev.playback, channel, &iter,
+                                  kvec.iov_len);
+
+    kunit_kfree(test, samples);
+
+    return err;
+}
+
+// Checks that period seqnum holds every channel's samples from first on
+//
+// Note: only expectations are used, as the caller holds pcm->lock
+static void cco_pcm_test_check_period(struct kunit *test,
+                                      struct cco_pcm_period *period,
+                                      uint32_t seqnum, unsigned first)
+{
+    struct cco_pcm_test *t = test->priv;
+    const struct cco_pcm_layout *layout = &t->session.pcm_layout;
+
+    KUNIT_EXPECT_EQ(test, period->seqnum, seqnum);
+
+    for (unsigned i = 0; i < layout->msgs_per_period; ++i) {
+        KUNIT_EXPECT_NOT_NULL(test, period->skbs[i]);
+        if (!period->skbs[i])
+            return;
+        Msg_t *msg = get_built_cco_msg(period->skbs[i]);
+        PcmDataMsg_t *data = (PcmDataMsg_t *)msg->payload;
+        KUNIT_EXPECT_EQ(test, ntohl(data->seqnum), seqnum);
+        if (pcm_layout_is_split(layout))
+            KUNIT_EXPECT_EQ(test, pcm_layout_first_channel(layout, data),
+                            i * layout->channels_per_msg);
+    }
+
+    for (unsigned c = 0; c < layout->channels; ++c) {
+        struct sk_buff *skb = period->skbs[pcm_layout_msg(layout, c)];
+        Msg_t *msg = get_built_cco_msg(skb);
+        const char *samples = pcm_layout_channel(layout, msg->payload, c);
+
+        unsigned n = 0;
+        while (n < layout->frames &&
+               cco_pcm_wire_sample(samples + n * SAMPLE_SIZE, SAMPLE_SIZE) ==
+               cco_pcm_test_sample(c, first + n))
+            n++;
+        KUNIT_EXPECT_EQ_MSG(test, n, layout->frames,
+                            "channel %u of period %u differs at frame %u", c,
+                            seqnum, n);
+    }
+}
+
+// Takes the oldest period off the ring, which must be seqnum if there is one
+static int cco_pcm_test_get(struct kunit *test, uint32_t seqnum,
+                            unsigned first)
+{
+    struct cco_pcm_test *t = test->priv;
+    struct cco_pcm *pcm = &t->dev.playback;
+
+    mutex_lock(&pcm->lock);
+    struct cco_pcm_period *period;
+    int err = cco_pcm_get_period(pcm, &period);
+    if (err == 0)
+        cco_pcm_test_check_period(test, period, seqnum, first);
+    mutex_unlock(&pcm->lock);
+
+    return err;
+}
+
+static unsigned cco_pcm_test_ready(struct kunit *test)
+{
+    struct cco_pcm_test *t = test->priv;
+
+    return atomic_read(&t->dev.playback.periods_ready);
+}
+
+// Channels put random amounts in random turns, and complete periods are taken
+// at random points, each one holding what was put into it
+static void cco_pcm_test_random_puts(struct kunit *test)
+{
+    struct cco_pcm_test *t = test->priv;
+    const unsigned channels = CCO_MAX_CHANNELS;
+    const unsigned num_periods = 8;
+    const unsigned periods = 4 * num_periods;
+
+    cco_pcm_test_start(test, channels, num_periods);
+    const unsigned frames = t->session.pcm_layout.frames;
+
+    unsigned put[CCO_MAX_CHANNELS] = { 0 };
+    unsigned taken = 0;
+    while (taken < periods) {
+        // A channel may fill the whole ring ahead of the oldest period, any
+        // further would overflow it
+        unsigned c = prandom_u32_state(&t->rnd) % channels;
+        unsigned limit = min(periods, taken + num_periods) * frames;
+        unsigned count = 1 + prandom_u32_state(&t->rnd) % (2 * frames);
+        count = min(count, limit - put[c]);
+        if (count) {
+            KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, c, put[c], count),
+                            0);
+            put[c] += count;
+        }
+
+        unsigned complete = put[0];
+        for (unsigned i = 1; i < channels; ++i) {
+            complete = min(complete, put[i]);
+        }
+        complete /= frames;
+        KUNIT_ASSERT_EQ(test, cco_pcm_test_ready(test), complete - taken);
+
+        if (prandom_u32_state(&t->rnd) % 4)
+            continue;
+        for (; taken < complete; ++taken) {
+            KUNIT_ASSERT_EQ(test, cco_pcm_test_get(test, taken, taken * frames),
+                            0);
+        }
+        KUNIT_ASSERT_EQ(test, cco_pcm_test_get(test, taken, 0), -ENODATA);
+    }
+
+    KUNIT_EXPECT_EQ(test, t->dev.playback.stats.periods_queued, periods);
+    KUNIT_EXPECT_EQ(test, t->dev.playback.stats.ring_overflows, 0);
+}
+
+// A period completes only once its last channel is filled, whichever channel
+// that is, and periods are taken in seqnum order
+static void cco_pcm_test_completion_order(struct kunit *test)
+{
+    struct cco_pcm_test *t = test->priv;
+    const unsigned channels = CCO_MAX_CHANNELS;
+    const unsigned last = channels - 1;
+
+    cco_pcm_test_start(test, channels, 8);
+    const unsigned frames = t->session.pcm_layout.frames;
+
+    // Every channel but the last fills three periods
+    for (unsigned c = 0; c < last; ++c) {
+        KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, c, 0, 3 * frames), 0);
+    }
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_ready(test), 0);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, 0, 0), -ENODATA);
+
+    // The last completes them one by one, each on its very last sample
+    for (unsigned p = 0; p < 3; ++p) {
+        KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, last, p * frames,
+                                               frames - 1), 0);
+        KUNIT_EXPECT_EQ(test, cco_pcm_test_ready(test), p);
+        KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, last,
+                                               (p + 1) * frames - 1, 1), 0);
+        KUNIT_EXPECT_EQ(test, cco_pcm_test_ready(test), p + 1);
+    }
+    for (unsigned p = 0; p < 3; ++p) {
+        KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, p, p * frames), 0);
+    }
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, 3, 0), -ENODATA);
+
+    // Channels fill the next period in reverse order, the first completing it
+    for (int c = last; c >= 0; --c) {
+        KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, c, 3 * frames, frames),
+                        0);
+        KUNIT_EXPECT_EQ(test, cco_pcm_test_ready(test), c == 0);
+    }
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, 3, 3 * frames), 0);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, 4, 0), -ENODATA);
+}
+
+// A reset mid-stream discards every period, complete or not, and the stream
+// carries on from the next seqnum
+static void cco_pcm_test_reset(struct kunit *test)
+{
+    struct cco_pcm_test *t = test->priv;
+    struct cco_pcm *pcm = &t->dev.playback;
+
+    cco_pcm_test_start(test, 2, 4);
+    const unsigned frames = t->session.pcm_layout.frames;
+
+    // Leave one period complete, another half so & a third started
+    KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, 0, 0, 5 * frames / 2), 0);
+    KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, 1, 0, 3 * frames / 2), 0);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_ready(test), 1);
+
+    mutex_lock(&pcm->lock);
+    cco_pcm_reset(pcm);
+    uint32_t seqnum = pcm->seqnum;
+    mutex_unlock(&pcm->lock);
+
+    KUNIT_EXPECT_EQ(test, seqnum, 3);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_ready(test), 0);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, seqnum, 0), -ENODATA);
+
+    // Periods are filled from their first frame again, the second in the slot
+    // that held the first period
+    for (unsigned c = 0; c < 2; ++c) {
+        KUNIT_ASSERT_EQ(test, cco_pcm_test_put(test, c, 0, 2 * frames), 0);
+    }
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_ready(test), 2);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, seqnum, 0), 0);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, seqnum + 1, frames), 0);
+    KUNIT_EXPECT_EQ(test, cco_pcm_test_get(test, seqnum + 2, 0), -ENODATA);
+}
+
+static struct kunit_case cco_pcm_test_cases[] = {
+    KUNIT_CASE(cco_pcm_test_random_puts),
+    KUNIT_CASE(cco_pcm_test_completion_order),
+    KUNIT_CASE(cco_pcm_test_reset),
+    {}
+};
+
+static struct kunit_suite cco_pcm_test_suite = {
+    .name = "cco_pcm",
+    .init = cco_pcm_test_init,
+    .exit = cco_pcm_test_exit,
+    .test_cases = cco_pcm_test_cases,
+};
+kunit_test_suites(&cco_pcm_test_suite);
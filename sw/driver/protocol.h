@@ -2,12 +2,27 @@
 #define CCO_PROTOCOL_H
 
 #include <linux/if_ether.h>
+#include <linux/kernel.h>
 #include <linux/skbuff.h>
 
+#include "log.h"
+
 #define NS_PER_SEC             ((ktime_t)1000000000)
 #define CCO_HEARTBEAT_INTERVAL ((ktime_t)1 * NS_PER_SEC)
 #define CCO_TIMEOUT_INTERVAL   ((ktime_t)3 * CCO_HEARTBEAT_INTERVAL)
 
+/*==================================Framing===================================*/
+// IEEE 802 local experimental EtherType 1
+//
+// Note: an EtherType doesn't say how much of a short frame is padding, so cco
+// msgs sent with one are preceded by a 16-bit big-endian length of their own:
+//
+//   [dest MAC][src MAC][EtherType][length][cco msg][padding]
+#define CCO_ETHERTYPE   0x88B5
+#define CCO_LENGTH_SIZE 2
+/*============================================================================*/
+
+
 /*===================================Header===================================*/
 // First 32 bits of the MD5 hash of the string "cuoc cho am"
 #define CCO_MAGIC 0x83f8ddef
@@ -45,6 +60,92 @@ typedef struct
     uint8_t msg_type;
 } __attribute__((packed)) SessionCtlMsg_t;
 
+// Note:
+//
+// Bitstreams that support more than the original PCM data format append a
+// byte to their announce msgs holding a bitmask of PCM_FORMAT_CAP()'s.  Only
+// when that is present does the host reply with an extended handshake request,
+// whose extra byte holds the PcmFormat_t selected, and the FPGA echoes back the
+// format it settled on in an extended handshake response.
+//
+// Older bitstreams only ever see the original 1-byte msgs, and keep using
+// PCM_FORMAT_S24_PADDED.
+typedef struct
+{
+    uint8_t msg_type;
+    uint8_t pcm_formats;
+} __attribute__((packed)) SessionCtlCapsMsg_t;
+
+// Note:
+//
+// Bitstreams that carry other than CCO_DEFAULT_CHANNELS channels append a
+// further byte to their announce msgs holding their channel count.  The host
+// adopts it, and both sides then exchange the 3-byte form of the handshake
+// request & response, which repeats the channel count.
+//
+// Bitstreams sending either of the shorter forms carry CCO_DEFAULT_CHANNELS.
+typedef struct
+{
+    uint8_t msg_type;
+    uint8_t pcm_formats;
+    uint8_t channels;
+} __attribute__((packed)) SessionCtlChannelsMsg_t;
+
+// Note:
+//
+// Bitstreams able to run other than CCO_DEFAULT_PERIOD_FRAMES frames per
+// period append a fourth byte to their announce msgs, holding a bitmask of
+// PCM_PERIOD_FRAMES_CAP()'s.  The host then sends the 4-byte form of the
+// handshake request, whose last byte holds the index n of the
+// PCM_PERIOD_FRAMES(n) selected, and the FPGA echoes it back in the 4-byte form
+// of the handshake response.
+//
+// Bitstreams sending any of the shorter forms run CCO_DEFAULT_PERIOD_FRAMES.
+//
+// Note: the bitstream in hw/ only announces CCO_DEFAULT_PERIOD_FRAMES for now,
+// as its period FIFOs & S/PDIF transmitter are sized for it at synthesis (see
+// audio.vhdl).  Other sizes are only run by the emulator in sw/emulator.
+typedef struct
+{
+    uint8_t msg_type;
+    uint8_t pcm_formats;
+    uint8_t channels;
+    uint8_t period_frames;
+} __attribute__((packed)) SessionCtlPeriodMsg_t;
+
+// Note:
+//
+// Bitstreams able to run at other than CCO_DEFAULT_RATE append a fifth byte to
+// their announce msgs, holding a bitmask of PCM_RATE_CAP()'s.  Unlike the other
+// fields the rate may change from one stream to the next, so it isn't settled
+// by the handshake (which stays at the 4-byte form) but selected in each PCM
+// control msg, see below.
+//
+// Bitstreams sending any of the shorter forms only run at CCO_DEFAULT_RATE.
+typedef struct
+{
+    uint8_t msg_type;
+    uint8_t pcm_formats;
+    uint8_t channels;
+    uint8_t period_frames;
+    uint8_t rates;
+} __attribute__((packed)) SessionCtlRatesMsg_t;
+
+// Note:
+//
+// Heartbeats may instead carry a count of the PCM data msgs their sender has
+// found missing, i.e. the periods skipped over by the seqnums it received: we
+// count capture periods, the FPGA counts playback periods.  The FPGA replies in
+// this form to hosts whose heartbeats are, and with the 1-byte form otherwise.
+//
+// It is the same length as SessionCtlRatesMsg_t, so it is only sent to
+// bitstreams that announced their rates, older ones would reject it.
+typedef struct
+{
+    uint8_t msg_type;
+    uint32_t lost_periods;
+} __attribute__((packed)) SessionCtlLossMsg_t;
+
 /*============================================================================*/
 
 
@@ -52,16 +153,94 @@ typedef struct
 #define PCM_CTL_PLAYBACK 0x1
 #define PCM_CTL_CAPTURE  0x2
 
+// Note:
+//
+// PCM control msgs flow in both directions.
+//
+// Host -> FPGA: announces which streams are active.  playback_seqnum holds the
+// seqnum of the first playback period of the stream being started.
+//
+// FPGA -> host: sent each time the S/PDIF transmitter crosses a period
+// boundary while either stream is active.  playback_seqnum is the seqnum
+// announced by the host plus the number of periods the FPGA has played out
+// since, and capture_seqnum is the seqnum of the next capture period the FPGA
+// will produce.  Because these are clocked by the card, the driver uses them to
+// drive the ALSA hardware pointer of either stream.
 typedef struct
 {
     uint8_t streams;
+    uint32_t playback_seqnum;
+    uint32_t capture_seqnum;
 } __attribute__((packed)) PcmCtlMsg_t;
+
+enum PcmRate_t
+{
+    PCM_RATE_44100  = 0,
+    PCM_RATE_48000  = 1,
+    PCM_RATE_88200  = 2,
+    PCM_RATE_96000  = 3,
+    PCM_RATE_176400 = 4,
+    PCM_RATE_192000 = 5
+};
+#define PCM_RATE_COUNT   6
+#define PCM_RATE_CAP(r)  (1 << (r))
+#define CCO_DEFAULT_RATE PCM_RATE_48000
+
+static inline unsigned pcm_rate_hz(uint8_t rate)
+{
+    static const unsigned hz[PCM_RATE_COUNT] = {
+        44100, 48000, 88200, 96000, 176400, 192000
+    };
+
+    return rate < PCM_RATE_COUNT ? hz[rate] : 0;
+}
+
+// Returns the PcmRate_t running at hz, or CCO_DEFAULT_RATE if there's none
+static inline uint8_t pcm_rate_from_hz(unsigned hz)
+{
+    for (uint8_t rate = 0; rate < PCM_RATE_COUNT; ++rate) {
+        if (pcm_rate_hz(rate) == hz)
+            return rate;
+    }
+
+    return CCO_DEFAULT_RATE;
+}
+
+// Note:
+//
+// With bitstreams that announced their rates, PCM control msgs in both
+// directions carry a trailing byte holding the PcmRate_t the streams run at.
+// The FPGA clocks its S/PDIF transmitter from it, so playback & capture always
+// share a rate.  Msgs without it imply CCO_DEFAULT_RATE.
+typedef struct
+{
+    uint8_t streams;
+    uint32_t playback_seqnum;
+    uint32_t capture_seqnum;
+    uint8_t rate;
+} __attribute__((packed)) PcmCtlRateMsg_t;
 /*============================================================================*/
 
 
 /*==================================PCM data==================================*/
-#define CHANNELS_PER_PACKET 2
-#define SAMPLES_PER_CHANNEL 128
+#define CCO_DEFAULT_CHANNELS 2
+#define CCO_MAX_CHANNELS     8
+
+// Frames of each channel carried per period, see note in session control
+#define PCM_PERIOD_FRAMES(n)      (16 << (n))
+#define PCM_PERIOD_FRAMES_CAP(n)  (1 << (n))
+#define PCM_PERIOD_FRAMES_COUNT   5 /* 16, 32, 64, 128 & 256 */
+#define CCO_DEFAULT_PERIOD_FRAMES_INDEX 3
+#define CCO_DEFAULT_PERIOD_FRAMES PCM_PERIOD_FRAMES(CCO_DEFAULT_PERIOD_FRAMES_INDEX)
+#define CCO_MAX_PERIOD_FRAMES     PCM_PERIOD_FRAMES(PCM_PERIOD_FRAMES_COUNT - 1)
+
+enum PcmFormat_t
+{
+    PCM_FORMAT_S24_PADDED = 0,
+    PCM_FORMAT_S24_PACKED = 1
+};
+
+#define PCM_FORMAT_CAP(format) (1 << (format))
 
 // Note:
 //
@@ -79,48 +258,175 @@ typedef struct
 //
 // This might be changed later if I discover a way to request a truly contiguous
 // 24-bit sample format from ALSA.
+//
+// Update: the padding is now only kept on the wire with older bitstreams.  When
+// PCM_FORMAT_S24_PACKED is negotiated, samples take 3 bytes on the wire and are
+// packed & unpacked by the driver (see convert.c), cutting the size of PCM data
+// msgs by a quarter.
+//
+// The driver also accepts other common sample formats from ALSA, which are
+// converted to & from the wire format in the copy path (see convert.c).
 #define SAMPLE_SIZE 4
+#define PACKED_SAMPLE_SIZE 3
 
-typedef struct
+static inline unsigned pcm_sample_size(uint8_t format)
 {
-    char data[SAMPLES_PER_CHANNEL * SAMPLE_SIZE];
-} __attribute__((packed)) ChannelPcmData_t;
+    if (format == PCM_FORMAT_S24_PACKED)
+        return PACKED_SAMPLE_SIZE;
+
+    return SAMPLE_SIZE;
+}
+
+// Note:
+//
+// A period holds the negotiated number of frames, stored channel after
+// channel.  As many whole channels as fit in PCM_DATA_MAX_SAMPLE_BYTES
+// are carried per PCM data msg, so a period with more channels than that is
+// split across several msgs sharing its seqnum.  At 128 frames per period:
+//
+//   padded: 2 channels per msg, so 8 channels take 4 msgs
+//   packed: 3 channels per msg, so 8 channels take 3 msgs (3 + 3 + 2)
+//
+// A period that fits in a single msg is sent as a PcmDataMsg_t, exactly as it
+// was before channel counts were negotiated.  Every msg of a split period is
+// sent as a SplitPcmDataMsg_t instead, whose first_channel says which of the
+// period's channels it holds.
+#define PCM_DATA_MAX_SAMPLE_BYTES 1400
+#define PCM_DATA_MAX_MSGS_PER_PERIOD \
+    DIV_ROUND_UP(CCO_MAX_CHANNELS, \
+                 PCM_DATA_MAX_SAMPLE_BYTES / (CCO_MAX_PERIOD_FRAMES * SAMPLE_SIZE))
 
 typedef struct
 {
     uint32_t seqnum;
-    ChannelPcmData_t channels[CHANNELS_PER_PACKET];
+    char data[];
 } __attribute__((packed)) PcmDataMsg_t;
+
+typedef struct
+{
+    uint32_t seqnum;
+    uint8_t first_channel;
+    char data[];
+} __attribute__((packed)) SplitPcmDataMsg_t;
+
+// Describes how a session's periods are laid out across PCM data msgs
+struct cco_pcm_layout {
+    uint8_t format;
+    uint8_t channels;
+    uint16_t frames;
+    uint8_t channels_per_msg;
+    uint8_t msgs_per_period;
+};
+
+static inline void pcm_layout_init(struct cco_pcm_layout *layout,
+                                   uint8_t format, uint8_t channels,
+                                   unsigned frames)
+{
+    unsigned channel_bytes = frames * pcm_sample_size(format);
+    unsigned channels_per_msg = PCM_DATA_MAX_SAMPLE_BYTES / channel_bytes;
+
+    layout->format = format;
+    layout->channels = channels;
+    layout->frames = frames;
+    layout->channels_per_msg = min(channels_per_msg, (unsigned)channels);
+    layout->msgs_per_period = DIV_ROUND_UP(channels, layout->channels_per_msg);
+}
+
+static inline bool pcm_layout_is_split(const struct cco_pcm_layout *layout)
+{
+    return layout->msgs_per_period > 1;
+}
+
+// Index of the msg within a period that carries channel
+static inline unsigned pcm_layout_msg(const struct cco_pcm_layout *layout,
+                                      unsigned channel)
+{
+    return channel / layout->channels_per_msg;
+}
+
+static inline unsigned pcm_layout_msg_channels(const struct cco_pcm_layout *layout,
+                                               unsigned msg)
+{
+    unsigned first_channel = msg * layout->channels_per_msg;
+    return min((unsigned)layout->channels_per_msg,
+               layout->channels - first_channel);
+}
+
+// First channel carried by a msg, as found in its header
+static inline unsigned pcm_layout_first_channel(const struct cco_pcm_layout *layout,
+                                                void *msg)
+{
+    if (pcm_layout_is_split(layout))
+        return ((SplitPcmDataMsg_t *)msg)->first_channel;
+
+    return 0;
+}
+
+// Size of the fields preceding sample data in each msg
+static inline unsigned pcm_layout_header_size(const struct cco_pcm_layout *layout)
+{
+    if (pcm_layout_is_split(layout))
+        return sizeof(SplitPcmDataMsg_t);
+
+    return sizeof(PcmDataMsg_t);
+}
+
+static inline unsigned pcm_layout_msg_size(const struct cco_pcm_layout *layout,
+                                           unsigned msg)
+{
+    return pcm_layout_header_size(layout) +
+           pcm_layout_msg_channels(layout, msg) * layout->frames *
+           pcm_sample_size(layout->format);
+}
+
+// Locates a channel's sample data within the msg that carries it
+static inline char *pcm_layout_channel(const struct cco_pcm_layout *layout,
+                                       void *msg, unsigned channel)
+{
+    unsigned index = channel % layout->channels_per_msg;
+    return (char *)msg + pcm_layout_header_size(layout) +
+           index * layout->frames * pcm_sample_size(layout->format);
+}
 /*============================================================================*/
 
 
 /*===================================Helpers==================================*/
+// Assumes that the framing has already been stripped by packet_recv(), so that
+// skb->len is the length of the cco msg
 static inline int is_valid_cco_packet(struct sk_buff *skb)
 {
-    struct ethhdr *hdr = eth_hdr(skb);
-    uint16_t len = ntohs(hdr->h_proto);
+    unsigned len = skb->len;
     if (skb_headlen(skb) < len) {
-        printk(KERN_DEBUG "cco: rejecting packet due to paged data\n");
+        CCO_LOG_DROP(CCO_DROP_PAGED,
+                     "cco: rejecting packet due to paged data\n");
         return false;
     }
 
     if (len < sizeof(Msg_t)) {
-        printk(KERN_DEBUG "cco: rejecting packet due to header size\n");
+        CCO_LOG_DROP(CCO_DROP_HEADER,
+                     "cco: rejecting packet due to header size\n");
         return false;
     }
     Msg_t *msg = (Msg_t *)skb->data;
     len -= sizeof(Msg_t);
 
     if (ntohl(msg->magic) != CCO_MAGIC) {
-        printk(KERN_DEBUG "cco: rejecting packet due to incorrect magic\n");
+        CCO_LOG_DROP(CCO_DROP_MAGIC,
+                     "cco: rejecting packet due to incorrect magic\n");
         return false;
     }
 
     switch (msg->msg_type) {
     case SESSION_CTL:
         // Validate session ctl msg length
-        if (len != sizeof(SessionCtlMsg_t)) {
-            printk(KERN_ERR "cco: session ctl msg has incorrect size %d\n", len);
+        if (len != sizeof(SessionCtlMsg_t) &&
+            len != sizeof(SessionCtlCapsMsg_t) &&
+            len != sizeof(SessionCtlChannelsMsg_t) &&
+            len != sizeof(SessionCtlPeriodMsg_t) &&
+            len != sizeof(SessionCtlRatesMsg_t))
+        {
+            CCO_LOG_DROP(CCO_DROP_MSG_SIZE,
+                         "cco: session ctl msg has incorrect size %d\n", len);
             return false;
         }
 
@@ -129,22 +435,36 @@ static inline int is_valid_cco_packet(struct sk_buff *skb)
         if (session_msg->msg_type < SESSION_CTL_ANNOUNCE ||
             session_msg->msg_type > SESSION_CTL_CLOSE)
         {
-            printk(KERN_ERR "cco: invalid session ctl msg_type \"%d\"\n",
-                   session_msg->msg_type);
+            CCO_LOG_DROP(CCO_DROP_MSG_TYPE,
+                         "cco: invalid session ctl msg_type \"%d\"\n",
+                         session_msg->msg_type);
+            return false;
+        }
+        break;
+
+    case PCM_CTL:
+        // Validate PCM ctl msg length
+        if (len != sizeof(PcmCtlMsg_t) && len != sizeof(PcmCtlRateMsg_t)) {
+            CCO_LOG_DROP(CCO_DROP_MSG_SIZE,
+                         "cco: PCM ctl msg has incorrect size %d\n", len);
             return false;
         }
         break;
 
     case PCM_DATA:
-        // Validate session ctl msg length
-        if (len != sizeof(PcmDataMsg_t)) {
-            printk(KERN_ERR "cco: PCM data msg has incorrect size %d\n", len);
+        // Validate PCM data msg length, layout is checked against session's
+        if (len < sizeof(PcmDataMsg_t) ||
+            len > sizeof(SplitPcmDataMsg_t) + PCM_DATA_MAX_SAMPLE_BYTES)
+        {
+            CCO_LOG_DROP(CCO_DROP_MSG_SIZE,
+                         "cco: PCM data msg has incorrect size %d\n", len);
             return false;
         }
         break;
 
     default:
-        printk(KERN_ERR "cco: invalid base msg_type \"%d\"\n", msg->msg_type);
+        CCO_LOG_DROP(CCO_DROP_MSG_TYPE,
+                     "cco: invalid base msg_type \"%d\"\n", msg->msg_type);
         return false;
     }
 
@@ -156,6 +476,13 @@ static inline Msg_t *get_cco_msg(struct sk_buff *skb)
 {
     return (Msg_t *)skb->data;
 }
+
+// Length of the msg following the cco header, assumes that
+// is_valid_cco_packet has already been called
+static inline unsigned get_cco_payload_len(struct sk_buff *skb)
+{
+    return skb->len - sizeof(Msg_t);
+}
 /*============================================================================*/
 
 #endif
@@ -0,0 +1,148 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cco
+
+#if !defined(CCO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define CCO_TRACE_H
+
+#include <linux/ktime.h>
+#include <linux/netdevice.h>
+#include <linux/tracepoint.h>
+
+#include "device.h"
+#include "pcm.h"
+
+// Note:
+//
+// Each period of playback is traced through every stage of the pipeline, all
+// keyed by seqnum so that a period can be followed from one to the next:
+//
+//   - cco_pcm_copy: samples were copied into the period by copy(), of every
+//     channel at once where channel is -1
+//   - cco_period_complete: every channel of the period has been filled
+//   - cco_period_dequeue: the pcm manager picked the period up
+//   - cco_xmit, cco_xmit_batch: its PCM data msgs were handed to the NIC
+//   - cco_period_ack: the FPGA reported having played it
+//
+// Capture periods are traced by cco_period_recv as they arrive.  Every event
+// carries ktime_get() as ts_ns, latency_ns is measured from the period being
+// completed where known and 0 otherwise.
+TRACE_EVENT(cco_pcm_copy,
+    TP_PROTO(struct cco_pcm *pcm, int channel, uint32_t seqnum, size_t bytes),
+    TP_ARGS(pcm, channel, seqnum, bytes),
+
+    TP_STRUCT__entry(
+        __field(int,      card)
+        __field(int,      channel)
+        __field(uint32_t, seqnum)
+        __field(size_t,   bytes)
+        __field(s64,      ts_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->card    = pcm->dev->card->number;
+        __entry->channel = channel;
+        __entry->seqnum  = seqnum;
+        __entry->bytes   = bytes;
+        __entry->ts_ns   = ktime_to_ns(ktime_get());
+    ),
+
+    TP_printk("card=%d channel=%d seqnum=%u bytes=%zu ts_ns=%lld",
+              __entry->card, __entry->channel, __entry->seqnum, __entry->bytes,
+              __entry->ts_ns)
+);
+
+DECLARE_EVENT_CLASS(cco_period,
+    TP_PROTO(struct cco_pcm *pcm, uint32_t seqnum, s64 latency_ns),
+    TP_ARGS(pcm, seqnum, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(int,      card)
+        __field(bool,     playback)
+        __field(uint32_t, seqnum)
+        __field(s64,      latency_ns)
+        __field(s64,      ts_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->card       = pcm->dev->card->number;
+        __entry->playback   = pcm == &pcm->dev->playback;
+        __entry->seqnum     = seqnum;
+        __entry->latency_ns = latency_ns;
+        __entry->ts_ns      = ktime_to_ns(ktime_get());
+    ),
+
+    TP_printk("card=%d %s seqnum=%u latency_ns=%lld ts_ns=%lld",
+              __entry->card, __entry->playback ? "playback" : "capture",
+              __entry->seqnum, __entry->latency_ns, __entry->ts_ns)
+);
+
+DEFINE_EVENT(cco_period, cco_period_complete,
+    TP_PROTO(struct cco_pcm *pcm, uint32_t seqnum, s64 latency_ns),
+    TP_ARGS(pcm, seqnum, latency_ns)
+);
+
+DEFINE_EVENT(cco_period, cco_period_dequeue,
+    TP_PROTO(struct cco_pcm *pcm, uint32_t seqnum, s64 latency_ns),
+    TP_ARGS(pcm, seqnum, latency_ns)
+);
+
+DEFINE_EVENT(cco_period, cco_period_ack,
+    TP_PROTO(struct cco_pcm *pcm, uint32_t seqnum, s64 latency_ns),
+    TP_ARGS(pcm, seqnum, latency_ns)
+);
+
+DEFINE_EVENT(cco_period, cco_period_recv,
+    TP_PROTO(struct cco_pcm *pcm, uint32_t seqnum, s64 latency_ns),
+    TP_ARGS(pcm, seqnum, latency_ns)
+);
+
+// A single msg passed through the qdisc, ret is the NET_XMIT_* result
+TRACE_EVENT(cco_xmit,
+    TP_PROTO(struct cco_session *session, int ret),
+    TP_ARGS(session, ret),
+
+    TP_STRUCT__entry(
+        __field(int, session)
+        __field(int, ret)
+        __field(s64, ts_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->session = session->id;
+        __entry->ret     = ret;
+        __entry->ts_ns   = ktime_to_ns(ktime_get());
+    ),
+
+    TP_printk("session=%d ret=%d ts_ns=%lld",
+              __entry->session, __entry->ret, __entry->ts_ns)
+);
+
+// A batch of msgs handed straight to the driver, of which sent were accepted
+TRACE_EVENT(cco_xmit_batch,
+    TP_PROTO(struct cco_session *session, unsigned msgs, int sent),
+    TP_ARGS(session, msgs, sent),
+
+    TP_STRUCT__entry(
+        __field(int,      session)
+        __field(unsigned, msgs)
+        __field(int,      sent)
+        __field(s64,      ts_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->session = session->id;
+        __entry->msgs    = msgs;
+        __entry->sent    = sent;
+        __entry->ts_ns   = ktime_to_ns(ktime_get());
+    ),
+
+    TP_printk("session=%d msgs=%u sent=%d ts_ns=%lld",
+              __entry->session, __entry->msgs, __entry->sent, __entry->ts_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
@@ -0,0 +1,1056 @@
+// Note:
+//
+// Emulates any number of cco cards in userspace, so that the driver can be
+// exercised & benchmarked without an Arty board, e.g. over a veth pair:
+//
+//   ip link add cco0 type veth peer name cco1
+//   ip link set cco0 up && ip link set cco1 up
+//   modprobe cco intfs=cco0
+//   cco_emulator -i cco1 -n 4
+//
+// Each card behaves as the bitstream does (see ethernet_trx.vhdl): it
+// announces itself until a host sends it a handshake request, answers
+// heartbeats, and while streams are active runs a simulated S/PDIF clock at the
+// rate the host selected.  On each period of that clock it plays a period out
+// of its playback FIFO & acknowledges it, and sends a period of capture data (a
+// triangle wave).
+//
+// Frames go through PACKET_MMAP rings on a single AF_PACKET socket, which every
+// card shares.  Each card reports how the playback periods it received were
+// spread in time (RFC 3550 interarrival jitter), how many were lost, late or
+// missing when due, and the throughput in each direction.
+//
+// With -z, a share of the msgs sent are mangled on their way out (truncated,
+// bits flipped, or given a false length) to fuzz the host's validation of the
+// frames it receives.  Its /sys/kernel/debug/cco/drops should count them,
+// while the sessions carry on.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "protocol.h"
+
+/*===============================Configuration================================*/
+struct options {
+    const char *intf;
+    unsigned cards;
+    uint8_t channels;
+    uint8_t pcm_formats;       /* PCM_FORMAT_CAP()'s announced */
+    uint8_t period_frames;     /* PCM_PERIOD_FRAMES_CAP()'s announced */
+    bool legacy;               /* 802.3 framing instead of CCO_ETHERTYPE */
+    unsigned fifo_periods;     /* depth of each card's playback FIFO */
+    unsigned duration;         /* in seconds, 0 to run until interrupted */
+    unsigned report;           /* in seconds, 0 to report only on exit */
+    unsigned mangle;           /* percentage of msgs sent mangled */
+    unsigned seed;             /* of the mangling */
+};
+
+static struct options opts = {
+    .intf          = NULL,
+    .cards         = 1,
+    .channels      = CCO_DEFAULT_CHANNELS,
+    .pcm_formats   = PCM_FORMAT_CAP(PCM_FORMAT_S24_PADDED) |
+                     PCM_FORMAT_CAP(PCM_FORMAT_S24_PACKED),
+    .period_frames = PCM_PERIOD_FRAMES_CAP(CCO_DEFAULT_PERIOD_FRAMES_INDEX),
+    .legacy        = false,
+    .fifo_periods  = 8,
+    .duration      = 0,
+    .report        = 1,
+    .mangle        = 0,
+    .seed          = 1,
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s -i intf [options]\n"
+            "  -i intf      interface to emulate cards on\n"
+            "  -n cards     number of cards (default 1)\n"
+            "  -c channels  channels per card, 1-%d (default %d)\n"
+            "  -f frames    frames per period, 16-256 (default %d)\n"
+            "  -P           announce the padded PCM data format only\n"
+            "  -l           802.3 framing, as bitstreams predating the "
+            "EtherType\n"
+            "  -q periods   depth of the playback FIFO (default %u)\n"
+            "  -t seconds   run for this long (default until interrupted)\n"
+            "  -r seconds   report interval, 0 for only on exit "
+            "(default %u)\n"
+            "  -z percent   of msgs sent to mangle (default 0)\n"
+            "  -s seed      of the mangling (default %u)\n",
+            prog, CCO_MAX_CHANNELS, CCO_DEFAULT_CHANNELS,
+            PCM_PERIOD_FRAMES(CCO_DEFAULT_PERIOD_FRAMES_INDEX),
+            opts.fifo_periods, opts.report, opts.seed);
+}
+
+static int parse_options(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:c:f:Plq:t:r:z:s:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            opts.intf = optarg;
+            break;
+        case 'n':
+            opts.cards = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            opts.channels = strtoul(optarg, NULL, 0);
+            break;
+        case 'f': {
+            unsigned frames = strtoul(optarg, NULL, 0);
+            opts.period_frames = 0;
+            for (unsigned n = 0; n < PCM_PERIOD_FRAMES_COUNT; ++n) {
+                if ((unsigned)PCM_PERIOD_FRAMES(n) == frames)
+                    opts.period_frames = PCM_PERIOD_FRAMES_CAP(n);
+            }
+            break;
+        }
+        case 'P':
+            opts.pcm_formats = PCM_FORMAT_CAP(PCM_FORMAT_S24_PADDED);
+            break;
+        case 'l':
+            opts.legacy = true;
+            break;
+        case 'q':
+            opts.fifo_periods = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            opts.duration = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            opts.report = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            opts.mangle = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            opts.seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (!opts.intf || opts.cards == 0 || opts.cards > 0xffff ||
+        opts.channels == 0 || opts.channels > CCO_MAX_CHANNELS ||
+        !opts.period_frames || opts.fifo_periods == 0 || opts.mangle > 100)
+        return -1;
+
+    return 0;
+}
+/*============================================================================*/
+
+
+/*================================Packet rings================================*/
+// Note:
+//
+// TPACKET_V2 rings of 2KB frames, which fit any cco frame.  Frames we send are
+// queued in the tx ring as they're built, and handed to the kernel together by
+// link_flush() once per pass of the main loop.
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_SIZE (RING_FRAME_SIZE * 8)
+#define RING_BLOCKS     64
+#define RING_FRAMES     (RING_BLOCKS * RING_BLOCK_SIZE / RING_FRAME_SIZE)
+
+struct ring {
+    char *base;
+    unsigned next;
+};
+
+struct link {
+    int fd;
+    char *map;
+    size_t map_size;
+    struct ring rx;
+    struct ring tx;
+    unsigned tx_queued;
+    uint64_t tx_ring_full;
+};
+
+static struct link net_link = { .fd = -1 };
+
+static struct tpacket2_hdr *ring_frame(struct ring *ring, unsigned index)
+{
+    return (struct tpacket2_hdr *)(ring->base + index * RING_FRAME_SIZE);
+}
+
+static int link_open(const char *intf)
+{
+    int err;
+
+    net_link.fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (net_link.fd < 0) {
+        err = -errno;
+        perror("socket");
+        goto exit_error;
+    }
+
+    int version = TPACKET_V2;
+    if (setsockopt(net_link.fd, SOL_PACKET, PACKET_VERSION, &version,
+                   sizeof(version)) < 0)
+    {
+        err = -errno;
+        perror("PACKET_VERSION");
+        goto undo_socket;
+    }
+
+    // Frames we send would otherwise be received straight back
+    int one = 1;
+    setsockopt(net_link.fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one,
+               sizeof(one));
+    setsockopt(net_link.fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one,
+               sizeof(one));
+
+    struct tpacket_req req = {
+        .tp_block_size = RING_BLOCK_SIZE,
+        .tp_block_nr   = RING_BLOCKS,
+        .tp_frame_size = RING_FRAME_SIZE,
+        .tp_frame_nr   = RING_FRAMES,
+    };
+    if (setsockopt(net_link.fd, SOL_PACKET, PACKET_RX_RING, &req,
+                   sizeof(req)) < 0 ||
+        setsockopt(net_link.fd, SOL_PACKET, PACKET_TX_RING, &req,
+                   sizeof(req)) < 0)
+    {
+        err = -errno;
+        perror("PACKET_RX_RING/PACKET_TX_RING");
+        goto undo_socket;
+    }
+
+    // The tx ring is mapped right after the rx ring
+    net_link.map_size = 2 * (size_t)RING_BLOCKS * RING_BLOCK_SIZE;
+    net_link.map = mmap(NULL, net_link.map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, net_link.fd, 0);
+    if (net_link.map == MAP_FAILED) {
+        err = -errno;
+        perror("mmap");
+        goto undo_socket;
+    }
+    net_link.rx.base = net_link.map;
+    net_link.tx.base = net_link.map + (size_t)RING_BLOCKS * RING_BLOCK_SIZE;
+
+    struct sockaddr_ll addr = {
+        .sll_family   = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex  = if_nametoindex(intf),
+    };
+    if (!addr.sll_ifindex) {
+        err = -errno;
+        fprintf(stderr, "cco_emulator: unable to find intf \"%s\"\n", intf);
+        goto undo_mmap;
+    }
+    if (bind(net_link.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        err = -errno;
+        perror("bind");
+        goto undo_mmap;
+    }
+
+    return 0;
+
+undo_mmap:
+    munmap(net_link.map, net_link.map_size);
+undo_socket:
+    close(net_link.fd);
+    net_link.fd = -1;
+exit_error:
+    return err;
+}
+
+static void link_close(void)
+{
+    if (net_link.fd < 0)
+        return;
+
+    munmap(net_link.map, net_link.map_size);
+    close(net_link.fd);
+    net_link.fd = -1;
+}
+
+// Returns where to build the next frame to send, NULL if the tx ring is full
+static char *link_tx_frame(void)
+{
+    struct tpacket2_hdr *hdr = ring_frame(&net_link.tx, net_link.tx.next);
+    if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+        net_link.tx_ring_full++;
+        return NULL;
+    }
+
+    return (char *)hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+}
+
+static void link_tx_commit(unsigned len)
+{
+    struct tpacket2_hdr *hdr = ring_frame(&net_link.tx, net_link.tx.next);
+    hdr->tp_len = len;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    net_link.tx.next = (net_link.tx.next + 1) % RING_FRAMES;
+    net_link.tx_queued++;
+}
+
+static void link_flush(void)
+{
+    if (!net_link.tx_queued)
+        return;
+
+    send(net_link.fd, NULL, 0, MSG_DONTWAIT);
+    net_link.tx_queued = 0;
+}
+
+// Hands every frame waiting in the rx ring to handle, then back to the kernel
+static void link_recv(void (*handle)(const uint8_t *frame, unsigned len,
+                                     uint64_t now))
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+
+    for (;;) {
+        struct tpacket2_hdr *hdr = ring_frame(&net_link.rx, net_link.rx.next);
+        if (!(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) &
+              TP_STATUS_USER))
+            break;
+
+        // Note: kernels lacking PACKET_IGNORE_OUTGOING still loop our frames
+        // back
+        struct sockaddr_ll *addr =
+            (struct sockaddr_ll *)((char *)hdr +
+                                   TPACKET_ALIGN(sizeof(struct tpacket2_hdr)));
+        if (addr->sll_pkttype != PACKET_OUTGOING)
+            handle((uint8_t *)hdr + hdr->tp_mac, hdr->tp_snaplen, now);
+
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        net_link.rx.next = (net_link.rx.next + 1) % RING_FRAMES;
+    }
+}
+/*============================================================================*/
+
+
+/*===================================Cards====================================*/
+enum card_state {
+    WAIT_FOR_HANDSHAKE_REQUEST,
+    SESSION_OPEN,
+};
+
+struct card_stats {
+    // Every msg, in both directions
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t tx_drops;            /* tx ring was full */
+    uint64_t tx_mangled;          /* see -z */
+
+    // Playback periods received, and their seqnums skipped over or repeated
+    uint64_t periods_received;
+    uint64_t lost;
+    uint64_t late;
+
+    // Periods of the S/PDIF clock that found the playback FIFO empty, and
+    // periods received while it was full
+    uint64_t underruns;
+    uint64_t overruns;
+
+    uint64_t periods_sent;        /* capture */
+};
+
+struct card {
+    unsigned id;
+    uint8_t mac[ETH_ALEN];
+    uint8_t host_mac[ETH_ALEN];
+    enum card_state state;
+    uint8_t generation_id;
+
+    // Forms of the host's last msgs, which ours are sent in
+    unsigned handshake_len;
+    unsigned pcm_ctl_len;
+    unsigned heartbeat_len;
+
+    // Settled by the handshake
+    struct cco_pcm_layout layout;
+    uint8_t period_frames;        /* index n of PCM_PERIOD_FRAMES(n) */
+
+    // Streams selected by the host, and the S/PDIF clock running them
+    uint8_t streams;
+    uint8_t rate;
+    uint64_t period_ns;
+    uint64_t next_period;
+    uint32_t playback_seqnum;     /* as acknowledged to the host */
+    uint32_t capture_seqnum;
+    uint64_t capture_frames;
+
+    // Playback FIFO, and the seqnum expected next in it
+    unsigned fifo_depth;
+    bool synced;
+    uint32_t next_seqnum;
+
+    // Interarrival jitter of playback periods, see note in pcm.c
+    uint64_t arrival_ts;
+    uint32_t arrival_seqnum;
+    uint64_t jitter_ns_16;
+
+    uint64_t next_announce;
+    uint64_t next_heartbeat;
+    uint64_t last_recv;
+
+    struct card_stats stats;
+    struct card_stats reported;
+};
+
+static struct card *cards;
+
+static const uint8_t mac_broadcast[ETH_ALEN] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+// Locally administered, with the card's id in the last two bytes
+static const uint8_t mac_prefix[ETH_ALEN - 2] = { 0x02, 0xcc, 0x0a, 0x00 };
+
+static struct card *card_from_mac(const uint8_t *mac)
+{
+    if (memcmp(mac, mac_prefix, sizeof(mac_prefix)) != 0)
+        return NULL;
+
+    unsigned id = (mac[4] << 8) | mac[5];
+    return id < opts.cards ? &cards[id] : NULL;
+}
+
+static void card_init(struct card *card, unsigned id, uint64_t now)
+{
+    memset(card, 0, sizeof(*card));
+    card->id = id;
+    memcpy(card->mac, mac_prefix, sizeof(mac_prefix));
+    card->mac[4] = id >> 8;
+    card->mac[5] = id;
+    memcpy(card->host_mac, mac_broadcast, ETH_ALEN);
+    card->state = WAIT_FOR_HANDSHAKE_REQUEST;
+
+    // Spread announces out rather than sending every card's at once
+    card->next_announce = now + id * (CCO_ANNOUNCE_INTERVAL / opts.cards);
+}
+
+/*----------------------------------Sending-----------------------------------*/
+// Frame being built by card_msg_begin(), until card_msg_end()
+static char *tx_frame;
+
+// Starts a msg of msg_type to the card's host in the tx ring, returns where its
+// payload goes or NULL if the ring is full
+static void *card_msg_begin(struct card *card, uint8_t msg_type)
+{
+    tx_frame = link_tx_frame();
+    if (!tx_frame) {
+        card->stats.tx_drops++;
+        return NULL;
+    }
+
+    struct ethhdr *hdr = (struct ethhdr *)tx_frame;
+    memcpy(hdr->h_dest, card->host_mac, ETH_ALEN);
+    memcpy(hdr->h_source, card->mac, ETH_ALEN);
+
+    unsigned hlen = ETH_HLEN + (opts.legacy ? 0 : CCO_LENGTH_SIZE);
+    Msg_t *msg = (Msg_t *)(tx_frame + hlen);
+    msg->magic = htonl(CCO_MAGIC);
+    msg->generation_id = card->generation_id;
+    msg->msg_type = msg_type;
+
+    return msg->payload;
+}
+
+enum mangling {
+    MANGLE_TRUNCATE,
+    MANGLE_FLIP_HEADER,
+    MANGLE_FLIP_ANY,
+    MANGLE_LENGTH,
+    MANGLE_COUNT
+};
+
+// Mangles the msg of msg_len bytes built at msg, see -z.  Returns the length
+// it's framed as, while *msg_len is updated to the number of bytes sent
+static unsigned card_msg_mangle(struct card *card, uint8_t *msg,
+                                unsigned *msg_len)
+{
+    unsigned length = *msg_len;
+    if ((unsigned)(rand() % 100) >= opts.mangle)
+        return length;
+
+    switch (rand() % MANGLE_COUNT) {
+    case MANGLE_TRUNCATE:
+        *msg_len = rand() % *msg_len;
+        length = *msg_len;
+        break;
+    case MANGLE_FLIP_HEADER:
+        msg[rand() % sizeof(Msg_t)] ^= 1 << (rand() % 8);
+        break;
+    case MANGLE_FLIP_ANY:
+        msg[rand() % *msg_len] ^= 1 << (rand() % 8);
+        break;
+    case MANGLE_LENGTH:
+        length = rand() % (ETH_DATA_LEN + 1);
+        break;
+    }
+
+    card->stats.tx_mangled++;
+    return length;
+}
+
+// Completes the msg with a payload of len bytes, see protocol.h for framing
+static void card_msg_end(struct card *card, unsigned len)
+{
+    struct ethhdr *hdr = (struct ethhdr *)tx_frame;
+    unsigned hlen = ETH_HLEN + (opts.legacy ? 0 : CCO_LENGTH_SIZE);
+    unsigned msg_len = sizeof(Msg_t) + len;
+    unsigned length = card_msg_mangle(card, (uint8_t *)tx_frame + hlen,
+                                      &msg_len);
+    unsigned frame_len = hlen + msg_len;
+    if (opts.legacy) {
+        hdr->h_proto = htons(length);
+    } else {
+        hdr->h_proto = htons(CCO_ETHERTYPE);
+        uint16_t length_field = htons(length);
+        memcpy(tx_frame + ETH_HLEN, &length_field, sizeof(length_field));
+    }
+
+    if (frame_len < ETH_ZLEN) {
+        memset(tx_frame + frame_len, 0, ETH_ZLEN - frame_len);
+        frame_len = ETH_ZLEN;
+    }
+
+    link_tx_commit(frame_len);
+    card->stats.tx_bytes += msg_len;
+    tx_frame = NULL;
+}
+
+static void card_send_announce(struct card *card)
+{
+    SessionCtlRatesMsg_t *msg = card_msg_begin(card, SESSION_CTL);
+    if (!msg)
+        return;
+
+    msg->msg_type = SESSION_CTL_ANNOUNCE;
+    msg->pcm_formats = opts.pcm_formats;
+    msg->channels = opts.channels;
+    msg->period_frames = opts.period_frames;
+    msg->rates = (1 << PCM_RATE_COUNT) - 1;
+    card_msg_end(card, sizeof(*msg));
+}
+
+// Answers in the form of the handshake request, see protocol.h
+static void card_send_handshake_response(struct card *card)
+{
+    SessionCtlPeriodMsg_t *msg = card_msg_begin(card, SESSION_CTL);
+    if (!msg)
+        return;
+
+    msg->msg_type = SESSION_CTL_HANDSHAKE_RESPONSE;
+    msg->pcm_formats = card->layout.format;
+    msg->channels = card->layout.channels;
+    msg->period_frames = card->period_frames;
+    card_msg_end(card, card->handshake_len);
+}
+
+static void card_send_session_ctl(struct card *card, uint8_t msg_type)
+{
+    SessionCtlMsg_t *msg = card_msg_begin(card, SESSION_CTL);
+    if (!msg)
+        return;
+
+    msg->msg_type = msg_type;
+    card_msg_end(card, sizeof(*msg));
+}
+
+// Carries our count of lost playback periods to hosts that send theirs
+static void card_send_heartbeat(struct card *card)
+{
+    SessionCtlLossMsg_t *msg = card_msg_begin(card, SESSION_CTL);
+    if (!msg)
+        return;
+
+    msg->msg_type = SESSION_CTL_HEARTBEAT;
+    if (card->heartbeat_len == sizeof(SessionCtlLossMsg_t)) {
+        msg->lost_periods = htonl(card->stats.lost);
+        card_msg_end(card, sizeof(SessionCtlLossMsg_t));
+    } else {
+        card_msg_end(card, sizeof(SessionCtlMsg_t));
+    }
+}
+
+static void card_send_pcm_ctl(struct card *card)
+{
+    PcmCtlRateMsg_t *msg = card_msg_begin(card, PCM_CTL);
+    if (!msg)
+        return;
+
+    msg->streams = card->streams;
+    msg->playback_seqnum = htonl(card->playback_seqnum);
+    msg->capture_seqnum = htonl(card->capture_seqnum);
+    msg->rate = card->rate;
+    card_msg_end(card, card->pcm_ctl_len == sizeof(PcmCtlRateMsg_t) ?
+                       sizeof(PcmCtlRateMsg_t) : sizeof(PcmCtlMsg_t));
+}
+
+// Triangle wave peaking at +/-2^22 every 256 frames, channels a quarter of a
+// wave apart
+static int32_t card_capture_sample(uint64_t frame, unsigned channel)
+{
+    unsigned phase = (frame + channel * 64) % 256;
+    int32_t level = phase < 128 ? phase : 256 - phase;
+    return (level - 64) << 16;
+}
+
+static void card_send_capture(struct card *card)
+{
+    const struct cco_pcm_layout *layout = &card->layout;
+    unsigned size = pcm_sample_size(layout->format);
+
+    for (unsigned i = 0; i < layout->msgs_per_period; ++i) {
+        char *payload = card_msg_begin(card, PCM_DATA);
+        if (!payload)
+            continue;
+
+        unsigned first_channel = i * layout->channels_per_msg;
+        PcmDataMsg_t *msg = (PcmDataMsg_t *)payload;
+        msg->seqnum = htonl(card->capture_seqnum);
+        if (pcm_layout_is_split(layout))
+            ((SplitPcmDataMsg_t *)payload)->first_channel = first_channel;
+
+        // Channel after channel, 24-bit big-endian right aligned in each
+        // sample
+        uint8_t *data = (uint8_t *)payload + pcm_layout_header_size(layout);
+        for (unsigned c = 0; c < pcm_layout_msg_channels(layout, i); ++c) {
+            for (unsigned f = 0; f < layout->frames; ++f) {
+                int32_t sample = card_capture_sample(card->capture_frames + f,
+                                                     first_channel + c);
+                if (size == SAMPLE_SIZE)
+                    *data++ = 0;
+                *data++ = sample >> 16;
+                *data++ = sample >> 8;
+                *data++ = sample;
+            }
+        }
+
+        card_msg_end(card, pcm_layout_msg_size(layout, i));
+    }
+
+    card->stats.periods_sent++;
+    card->capture_seqnum++;
+    card->capture_frames += layout->frames;
+}
+/*----------------------------------------------------------------------------*/
+
+/*---------------------------------Receiving----------------------------------*/
+static void card_handle_handshake_request(struct card *card,
+                                          const uint8_t *src_mac,
+                                          const Msg_t *msg, unsigned len,
+                                          uint64_t now)
+{
+    // Fields past msg_type are only present in the longer forms, see
+    // protocol.h
+    SessionCtlPeriodMsg_t request = {
+        .pcm_formats   = PCM_FORMAT_S24_PADDED,
+        .channels      = CCO_DEFAULT_CHANNELS,
+        .period_frames = CCO_DEFAULT_PERIOD_FRAMES_INDEX,
+    };
+    memcpy(&request, msg->payload, len);
+
+    uint8_t format = request.pcm_formats;
+    if (len < 2 || !(opts.pcm_formats & PCM_FORMAT_CAP(format)))
+        format = PCM_FORMAT_S24_PADDED;
+
+    uint8_t channels = len >= 3 ? opts.channels : CCO_DEFAULT_CHANNELS;
+
+    uint8_t frames_index = request.period_frames;
+    if (len < 4 || frames_index >= PCM_PERIOD_FRAMES_COUNT ||
+        !(opts.period_frames & PCM_PERIOD_FRAMES_CAP(frames_index)))
+        frames_index = CCO_DEFAULT_PERIOD_FRAMES_INDEX;
+
+    memcpy(card->host_mac, src_mac, ETH_ALEN);
+    card->handshake_len = len;
+    card->pcm_ctl_len = sizeof(PcmCtlMsg_t);
+    card->heartbeat_len = sizeof(SessionCtlMsg_t);
+    card->period_frames = frames_index;
+    pcm_layout_init(&card->layout, format, channels,
+                    PCM_PERIOD_FRAMES(frames_index));
+
+    card->streams = 0;
+    card->synced = false;
+    card->fifo_depth = 0;
+    card->state = SESSION_OPEN;
+    card->next_heartbeat = now + CCO_HEARTBEAT_INTERVAL;
+    card->last_recv = now;
+
+    card_send_handshake_response(card);
+}
+
+static void card_handle_pcm_ctl(struct card *card, const Msg_t *msg,
+                                unsigned len, uint64_t now)
+{
+    PcmCtlRateMsg_t ctl = { .rate = CCO_DEFAULT_RATE };
+    memcpy(&ctl, msg->payload, len);
+    if (pcm_rate_hz(ctl.rate) == 0)
+        ctl.rate = CCO_DEFAULT_RATE;
+
+    // Count played periods from the host's starting seqnum
+    if (!(card->streams & PCM_CTL_PLAYBACK) &&
+        (ctl.streams & PCM_CTL_PLAYBACK))
+    {
+        card->playback_seqnum = ntohl(ctl.playback_seqnum);
+        card->synced = false;
+        card->fifo_depth = 0;
+    }
+
+    // Start the S/PDIF clock with the first stream
+    if (!card->streams && ctl.streams)
+        card->next_period = now;
+
+    card->streams = ctl.streams;
+    card->rate = ctl.rate;
+    card->pcm_ctl_len = len;
+    card->period_ns = card->layout.frames * NS_PER_SEC /
+                      pcm_rate_hz(card->rate);
+}
+
+static void card_handle_pcm_data(struct card *card, const Msg_t *msg,
+                                 unsigned len, uint64_t now)
+{
+    const struct cco_pcm_layout *layout = &card->layout;
+
+    // Only the first msg of a period stands for it
+    const SplitPcmDataMsg_t *data = (const SplitPcmDataMsg_t *)msg->payload;
+    if (len < pcm_layout_header_size(layout) ||
+        (pcm_layout_is_split(layout) && data->first_channel != 0))
+        return;
+
+    uint32_t seqnum = ntohl(data->seqnum);
+    card->stats.periods_received++;
+
+    if (card->arrival_ts) {
+        int32_t periods = seqnum - card->arrival_seqnum;
+        if (periods > 0 && periods < 64) {
+            int64_t late = (int64_t)(now - card->arrival_ts) -
+                           (int64_t)periods * card->period_ns;
+            card->jitter_ns_16 += llabs(late) - (card->jitter_ns_16 >> 4);
+        }
+    }
+    if (!card->arrival_ts || (int32_t)(seqnum - card->arrival_seqnum) > 0) {
+        card->arrival_seqnum = seqnum;
+        card->arrival_ts = now;
+    }
+
+    if (card->synced) {
+        int32_t gap = seqnum - card->next_seqnum;
+        if (gap < 0) {
+            card->stats.late++;
+            return;
+        }
+        card->stats.lost += gap;
+    }
+    card->synced = true;
+    card->next_seqnum = seqnum + 1;
+
+    if (card->fifo_depth < opts.fifo_periods)
+        card->fifo_depth++;
+    else
+        card->stats.overruns++;
+}
+
+static void handle_frame(const uint8_t *frame, unsigned len, uint64_t now)
+{
+    if (len < ETH_HLEN)
+        return;
+
+    const struct ethhdr *hdr = (const struct ethhdr *)frame;
+    struct card *card = card_from_mac(hdr->h_dest);
+    if (!card)
+        return;
+
+    // Strip the framing, see protocol.h
+    unsigned offset = ETH_HLEN;
+    uint16_t proto = ntohs(hdr->h_proto);
+    if (proto == ETH_P_8021Q && len >= offset + 4) {
+        memcpy(&proto, frame + offset + 2, sizeof(proto));
+        proto = ntohs(proto);
+        offset += 4;
+    }
+
+    unsigned msg_len;
+    if (proto == CCO_ETHERTYPE) {
+        if (len < offset + CCO_LENGTH_SIZE)
+            return;
+        uint16_t length;
+        memcpy(&length, frame + offset, sizeof(length));
+        msg_len = ntohs(length);
+        offset += CCO_LENGTH_SIZE;
+    } else if (proto <= ETH_DATA_LEN) {
+        msg_len = proto;
+    } else {
+        return;
+    }
+    if (msg_len < sizeof(Msg_t) || offset + msg_len > len)
+        return;
+
+    const Msg_t *msg = (const Msg_t *)(frame + offset);
+    if (ntohl(msg->magic) != CCO_MAGIC ||
+        msg->generation_id != card->generation_id)
+        return;
+    unsigned payload_len = msg_len - sizeof(Msg_t);
+
+    if (card->state == WAIT_FOR_HANDSHAKE_REQUEST) {
+        if (msg->msg_type == SESSION_CTL && payload_len >= 1 &&
+            payload_len <= sizeof(SessionCtlPeriodMsg_t) &&
+            msg->payload[0] == SESSION_CTL_HANDSHAKE_REQUEST)
+            card_handle_handshake_request(card, hdr->h_source, msg,
+                                          payload_len, now);
+        return;
+    }
+
+    if (memcmp(hdr->h_source, card->host_mac, ETH_ALEN) != 0)
+        return;
+
+    card->last_recv = now;
+    card->stats.rx_bytes += msg_len;
+
+    switch (msg->msg_type) {
+    case SESSION_CTL:
+        if (payload_len >= 1 && msg->payload[0] == SESSION_CTL_HEARTBEAT)
+            card->heartbeat_len = payload_len;
+        break;
+
+    case PCM_CTL:
+        if (payload_len == sizeof(PcmCtlMsg_t) ||
+            payload_len == sizeof(PcmCtlRateMsg_t))
+            card_handle_pcm_ctl(card, msg, payload_len, now);
+        break;
+
+    case PCM_DATA:
+        card_handle_pcm_data(card, msg, payload_len, now);
+        break;
+    }
+}
+/*----------------------------------------------------------------------------*/
+
+// Plays a period out of the playback FIFO, sends a period of capture, and
+// acknowledges the period boundary the S/PDIF clock crossed
+static void card_period(struct card *card)
+{
+    if (card->streams & PCM_CTL_CAPTURE)
+        card_send_capture(card);
+
+    if (card->streams & PCM_CTL_PLAYBACK) {
+        if (card->fifo_depth > 0)
+            card->fifo_depth--;
+        else if (card->synced)
+            card->stats.underruns++;
+
+        card->playback_seqnum++;
+    }
+
+    // Capture is clocked by the acks too, so they're sent whichever stream is
+    // active
+    if (card->streams)
+        card_send_pcm_ctl(card);
+}
+
+// Runs the card's timers, returns when they next need running
+static uint64_t card_poll(struct card *card, uint64_t now)
+{
+    if (card->state == WAIT_FOR_HANDSHAKE_REQUEST) {
+        if (now >= card->next_announce) {
+            card_send_announce(card);
+            card->next_announce = now + CCO_ANNOUNCE_INTERVAL;
+        }
+        return card->next_announce;
+    }
+
+    // Close the session if the host has gone quiet
+    if (now - card->last_recv > CCO_TIMEOUT_INTERVAL) {
+        card_send_session_ctl(card, SESSION_CTL_CLOSE);
+        memcpy(card->host_mac, mac_broadcast, ETH_ALEN);
+        card->generation_id++;
+        card->streams = 0;
+        card->state = WAIT_FOR_HANDSHAKE_REQUEST;
+        card->next_announce = now + CCO_ANNOUNCE_INTERVAL;
+        return card->next_announce;
+    }
+
+    if (now >= card->next_heartbeat) {
+        card_send_heartbeat(card);
+        card->next_heartbeat = now + CCO_HEARTBEAT_INTERVAL;
+    }
+
+    uint64_t next = card->next_heartbeat;
+    if (!card->streams)
+        return next;
+
+    // Catch up on periods we were late for, unless we fell so far behind that
+    // the clock is better restarted
+    unsigned periods = 0;
+    while (now >= card->next_period) {
+        if (++periods > opts.fifo_periods) {
+            card->next_period = now;
+            break;
+        }
+        card_period(card);
+        card->next_period += card->period_ns;
+    }
+
+    return CCO_MIN(next, card->next_period);
+}
+/*============================================================================*/
+
+
+/*=================================Reporting==================================*/
+static void report(uint64_t elapsed_ns)
+{
+    printf("%4s %7s %9s %9s %9s %7s %7s %9s %9s %9s %9s\n",
+           "card", "state", "rx_kbps", "tx_kbps", "played", "lost", "late",
+           "underruns", "overruns", "jitter_us", "captured");
+
+    for (unsigned i = 0; i < opts.cards; ++i) {
+        struct card *card = &cards[i];
+        struct card_stats *stats = &card->stats;
+        struct card_stats *last = &card->reported;
+
+        uint64_t rx_kbps = 0, tx_kbps = 0;
+        if (elapsed_ns) {
+            rx_kbps = (stats->rx_bytes - last->rx_bytes) * 8 * 1000000 /
+                      elapsed_ns;
+            tx_kbps = (stats->tx_bytes - last->tx_bytes) * 8 * 1000000 /
+                      elapsed_ns;
+        }
+
+        printf("%4u %7s %9llu %9llu %9llu %7llu %7llu %9llu %9llu %9llu "
+               "%9llu\n",
+               card->id, card->state == SESSION_OPEN ? "open" : "waiting",
+               (unsigned long long)rx_kbps, (unsigned long long)tx_kbps,
+               (unsigned long long)stats->periods_received,
+               (unsigned long long)stats->lost,
+               (unsigned long long)stats->late,
+               (unsigned long long)stats->underruns,
+               (unsigned long long)stats->overruns,
+               (unsigned long long)(card->jitter_ns_16 >> 4) / 1000,
+               (unsigned long long)stats->periods_sent);
+
+        *last = *stats;
+    }
+
+    if (net_link.tx_ring_full)
+        printf("tx ring full: %llu\n",
+               (unsigned long long)net_link.tx_ring_full);
+    if (opts.mangle) {
+        uint64_t mangled = 0;
+        for (unsigned i = 0; i < opts.cards; ++i)
+            mangled += cards[i].stats.tx_mangled;
+        printf("mangled: %llu\n", (unsigned long long)mangled);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+/*============================================================================*/
+
+
+/*====================================Main====================================*/
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig)
+{
+    running = 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    int err;
+
+    if (parse_options(argc, argv) < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    cards = calloc(opts.cards, sizeof(*cards));
+    if (!cards) {
+        perror("calloc");
+        return 1;
+    }
+
+    err = link_open(opts.intf);
+    if (err < 0)
+        goto undo_alloc;
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    srand(opts.seed);
+
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < opts.cards; ++i)
+        card_init(&cards[i], i, start);
+
+    uint64_t end = opts.duration ? start + opts.duration * NS_PER_SEC : 0;
+    uint64_t last_report = start;
+    while (running) {
+        uint64_t now = now_ns();
+        if (end && now >= end)
+            break;
+
+        uint64_t next = now + NS_PER_SEC;
+        for (unsigned i = 0; i < opts.cards; ++i)
+            next = CCO_MIN(next, card_poll(&cards[i], now));
+        link_flush();
+
+        if (opts.report && now - last_report >= opts.report * NS_PER_SEC) {
+            report(now - last_report);
+            last_report = now;
+        }
+
+        // Sleep until a card's timer is due or a frame arrives
+        struct pollfd pfd = { .fd = net_link.fd, .events = POLLIN };
+        uint64_t timeout = next > now ? next - now : 0;
+        struct timespec ts = {
+            .tv_sec  = timeout / NS_PER_SEC,
+            .tv_nsec = timeout % NS_PER_SEC,
+        };
+        if (ppoll(&pfd, 1, &ts, NULL) < 0 && errno != EINTR) {
+            err = -errno;
+            perror("ppoll");
+            break;
+        }
+
+        link_recv(handle_frame);
+        link_flush();
+    }
+
+    // Let hosts know we're gone rather than have them time out
+    for (unsigned i = 0; i < opts.cards; ++i) {
+        if (cards[i].state == SESSION_OPEN)
+            card_send_session_ctl(&cards[i], SESSION_CTL_CLOSE);
+    }
+    link_flush();
+
+    report(now_ns() - last_report);
+
+    link_close();
+undo_alloc:
+    free(cards);
+    return err < 0 ? 1 : 0;
+}
+/*============================================================================*/
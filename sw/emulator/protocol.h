@@ -0,0 +1,228 @@
+#ifndef CCO_EMULATOR_PROTOCOL_H
+#define CCO_EMULATOR_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Note:
+//
+// This is the subset of ../driver/protocol.h that the emulator needs, which
+// can't be included outside of the kernel.  The notes there describe the
+// msgs in full, and both must be kept in sync (as must protocol.vhdl).
+
+#define NS_PER_SEC             1000000000ULL
+#define CCO_ANNOUNCE_INTERVAL  (1 * NS_PER_SEC)
+#define CCO_HEARTBEAT_INTERVAL (1 * NS_PER_SEC)
+#define CCO_TIMEOUT_INTERVAL   (3 * CCO_HEARTBEAT_INTERVAL)
+
+#define CCO_DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define CCO_MIN(a, b)          ((a) < (b) ? (a) : (b))
+
+/*==================================Framing===================================*/
+#define CCO_ETHERTYPE   0x88B5
+#define CCO_LENGTH_SIZE 2
+/*============================================================================*/
+
+
+/*===================================Header===================================*/
+#define CCO_MAGIC 0x83f8ddef
+
+enum MsgType_t
+{
+    SESSION_CTL = 0,
+    PCM_CTL     = 1,
+    PCM_DATA    = 2
+};
+
+typedef struct
+{
+    uint32_t magic;
+    uint8_t generation_id;
+    uint8_t msg_type;
+    char payload[];
+} __attribute__((packed)) Msg_t;
+/*============================================================================*/
+
+
+/*===============================Session control==============================*/
+enum SessionCtlMsgType_t
+{
+    SESSION_CTL_ANNOUNCE           = 0,
+    SESSION_CTL_HANDSHAKE_REQUEST  = 1,
+    SESSION_CTL_HANDSHAKE_RESPONSE = 2,
+    SESSION_CTL_HEARTBEAT          = 3,
+    SESSION_CTL_CLOSE              = 4
+};
+
+// The 1 to 4-byte forms of the handshake are prefixes of SessionCtlPeriodMsg_t,
+// and announces always take the 5-byte SessionCtlRatesMsg_t form
+typedef struct
+{
+    uint8_t msg_type;
+} __attribute__((packed)) SessionCtlMsg_t;
+
+typedef struct
+{
+    uint8_t msg_type;
+    uint8_t pcm_formats;
+    uint8_t channels;
+    uint8_t period_frames;
+} __attribute__((packed)) SessionCtlPeriodMsg_t;
+
+typedef struct
+{
+    uint8_t msg_type;
+    uint8_t pcm_formats;
+    uint8_t channels;
+    uint8_t period_frames;
+    uint8_t rates;
+} __attribute__((packed)) SessionCtlRatesMsg_t;
+
+typedef struct
+{
+    uint8_t msg_type;
+    uint32_t lost_periods;
+} __attribute__((packed)) SessionCtlLossMsg_t;
+/*============================================================================*/
+
+
+/*=================================PCM control================================*/
+#define PCM_CTL_PLAYBACK 0x1
+#define PCM_CTL_CAPTURE  0x2
+
+typedef struct
+{
+    uint8_t streams;
+    uint32_t playback_seqnum;
+    uint32_t capture_seqnum;
+} __attribute__((packed)) PcmCtlMsg_t;
+
+typedef struct
+{
+    uint8_t streams;
+    uint32_t playback_seqnum;
+    uint32_t capture_seqnum;
+    uint8_t rate;
+} __attribute__((packed)) PcmCtlRateMsg_t;
+
+enum PcmRate_t
+{
+    PCM_RATE_44100  = 0,
+    PCM_RATE_48000  = 1,
+    PCM_RATE_88200  = 2,
+    PCM_RATE_96000  = 3,
+    PCM_RATE_176400 = 4,
+    PCM_RATE_192000 = 5
+};
+#define PCM_RATE_COUNT   6
+#define PCM_RATE_CAP(r)  (1 << (r))
+#define CCO_DEFAULT_RATE PCM_RATE_48000
+
+static inline unsigned pcm_rate_hz(uint8_t rate)
+{
+    static const unsigned hz[PCM_RATE_COUNT] = {
+        44100, 48000, 88200, 96000, 176400, 192000
+    };
+
+    return rate < PCM_RATE_COUNT ? hz[rate] : 0;
+}
+/*============================================================================*/
+
+
+/*==================================PCM data==================================*/
+enum PcmFormat_t
+{
+    PCM_FORMAT_S24_PADDED = 0,
+    PCM_FORMAT_S24_PACKED = 1
+};
+
+#define PCM_FORMAT_CAP(format) (1 << (format))
+
+#define CCO_DEFAULT_CHANNELS 2
+#define CCO_MAX_CHANNELS     8
+
+#define PCM_PERIOD_FRAMES(n)            (16 << (n))
+#define PCM_PERIOD_FRAMES_CAP(n)        (1 << (n))
+#define PCM_PERIOD_FRAMES_COUNT         5
+#define CCO_DEFAULT_PERIOD_FRAMES_INDEX 3
+
+#define SAMPLE_SIZE 4
+#define PACKED_SAMPLE_SIZE 3
+
+static inline unsigned pcm_sample_size(uint8_t format)
+{
+    if (format == PCM_FORMAT_S24_PACKED)
+        return PACKED_SAMPLE_SIZE;
+
+    return SAMPLE_SIZE;
+}
+
+#define PCM_DATA_MAX_SAMPLE_BYTES 1400
+
+typedef struct
+{
+    uint32_t seqnum;
+    char data[];
+} __attribute__((packed)) PcmDataMsg_t;
+
+typedef struct
+{
+    uint32_t seqnum;
+    uint8_t first_channel;
+    char data[];
+} __attribute__((packed)) SplitPcmDataMsg_t;
+
+struct cco_pcm_layout {
+    uint8_t format;
+    uint8_t channels;
+    uint16_t frames;
+    uint8_t channels_per_msg;
+    uint8_t msgs_per_period;
+};
+
+static inline void pcm_layout_init(struct cco_pcm_layout *layout,
+                                   uint8_t format, uint8_t channels,
+                                   unsigned frames)
+{
+    unsigned channel_bytes = frames * pcm_sample_size(format);
+    unsigned channels_per_msg = PCM_DATA_MAX_SAMPLE_BYTES / channel_bytes;
+
+    layout->format = format;
+    layout->channels = channels;
+    layout->frames = frames;
+    layout->channels_per_msg = CCO_MIN(channels_per_msg, (unsigned)channels);
+    layout->msgs_per_period = CCO_DIV_ROUND_UP(channels,
+                                               layout->channels_per_msg);
+}
+
+static inline bool pcm_layout_is_split(const struct cco_pcm_layout *layout)
+{
+    return layout->msgs_per_period > 1;
+}
+
+static inline unsigned pcm_layout_msg_channels(const struct cco_pcm_layout *layout,
+                                               unsigned msg)
+{
+    unsigned first_channel = msg * layout->channels_per_msg;
+    return CCO_MIN((unsigned)layout->channels_per_msg,
+                   layout->channels - first_channel);
+}
+
+static inline unsigned pcm_layout_header_size(const struct cco_pcm_layout *layout)
+{
+    if (pcm_layout_is_split(layout))
+        return sizeof(SplitPcmDataMsg_t);
+
+    return sizeof(PcmDataMsg_t);
+}
+
+static inline unsigned pcm_layout_msg_size(const struct cco_pcm_layout *layout,
+                                           unsigned msg)
+{
+    return pcm_layout_header_size(layout) +
+           pcm_layout_msg_channels(layout, msg) * layout->frames *
+           pcm_sample_size(layout->format);
+}
+/*============================================================================*/
+
+#endif
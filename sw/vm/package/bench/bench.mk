@@ -0,0 +1,9 @@
+# Note: BENCH_VERSION is specified as environment variable from cmake
+
+BENCH_SITE          = $(realpath $(BR2_EXTERNAL_VM_PATH)/../bench)
+BENCH_SITE_METHOD   = local
+BENCH_LICENSE       = GPL-2.0
+BENCH_LICENSE_FILES = LICENSE
+BENCH_DEPENDENCIES  = alsa-lib host-pkgconf
+
+$(eval $(cmake-package))
@@ -0,0 +1,8 @@
+# Note: EMULATOR_VERSION is specified as environment variable from cmake
+
+EMULATOR_SITE          = $(realpath $(BR2_EXTERNAL_VM_PATH)/../emulator)
+EMULATOR_SITE_METHOD   = local
+EMULATOR_LICENSE       = GPL-2.0
+EMULATOR_LICENSE_FILES = LICENSE
+
+$(eval $(cmake-package))